@@ -0,0 +1,191 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "AsyncFileWriter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <utility>
+
+#include <fmt/format.h>
+
+#include "FileUtils.h"
+
+AsyncFileWriter::AsyncFileWriter(size_t threadsCount, size_t maxBytesInFlight)
+    : mMaxBytesInFlight(maxBytesInFlight)
+{
+    threadsCount = std::max<size_t>(1, threadsCount);
+
+    mThreads.reserve(threadsCount);
+
+    for (size_t i = 0; i < threadsCount; ++i)
+        mThreads.emplace_back([this] { workerThread(); });
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        mCompletionCondition.wait(
+            lock, [this] { return mRequests.empty() && mRequestsInFlight == 0; });
+
+        mStopping = true;
+    }
+
+    mRequestsCondition.notify_all();
+
+    for (auto& thread : mThreads)
+        thread.join();
+
+    if (mError)
+        fmt::print("Some files were not written\n");
+}
+
+void AsyncFileWriter::write(
+    std::filesystem::path path, std::unique_ptr<Buffer> data)
+{
+    write(std::move(path), {}, std::move(data));
+}
+
+void AsyncFileWriter::write(
+    std::filesystem::path path, std::vector<uint8_t> header,
+    std::unique_ptr<Buffer> data)
+{
+    const size_t size =
+        header.size() + (data != nullptr ? data->getSize() : 0);
+
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        // A single request larger than the limit is still accepted
+        mCompletionCondition.wait(
+            lock,
+            [this, size]
+            {
+                return mError || mBytesInFlight == 0 ||
+                       mBytesInFlight + size <= mMaxBytesInFlight;
+            });
+
+        if (mError)
+            std::rethrow_exception(mError);
+
+        mBytesInFlight += size;
+        mRequests.push_back(
+            { std::move(path), std::move(header), std::move(data) });
+    }
+
+    mRequestsCondition.notify_one();
+}
+
+void AsyncFileWriter::wait()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    mCompletionCondition.wait(
+        lock, [this] { return mRequests.empty() && mRequestsInFlight == 0; });
+
+    if (mError)
+        std::rethrow_exception(std::exchange(mError, {}));
+}
+
+size_t AsyncFileWriter::getFilesWritten() const noexcept
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mFilesWritten;
+}
+
+void AsyncFileWriter::workerThread()
+{
+    std::vector<Request> batch;
+    batch.reserve(BatchSize);
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+
+            mRequestsCondition.wait(
+                lock, [this] { return mStopping || !mRequests.empty(); });
+
+            if (mRequests.empty())
+                return;
+
+            // Leave some work for the other threads
+            const size_t batchSize = std::clamp<size_t>(
+                mRequests.size() / mThreads.size(), 1, BatchSize);
+
+            for (size_t i = 0; i < batchSize; ++i)
+            {
+                batch.push_back(std::move(mRequests.front()));
+                mRequests.pop_front();
+            }
+
+            mRequestsInFlight += batch.size();
+        }
+
+        for (const auto& request : batch)
+        {
+            const size_t size =
+                request.Header.size() +
+                (request.Data != nullptr ? request.Data->getSize() : 0);
+
+            std::exception_ptr error;
+
+            try
+            {
+                processRequest(request);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+
+                mBytesInFlight -= size;
+                --mRequestsInFlight;
+
+                if (error && !mError)
+                    mError = error;
+                else if (!error)
+                    ++mFilesWritten;
+            }
+
+            mCompletionCondition.notify_all();
+        }
+
+        batch.clear();
+    }
+}
+
+void AsyncFileWriter::processRequest(const Request& request)
+{
+    std::unique_ptr<FILE, int (*)(FILE*)> file(OpenFile(request.Path, "wb"), fclose);
+
+    if (file == nullptr)
+        throw std::runtime_error(fmt::format(
+            "Failed to open {} for writing", request.Path.u8string()));
+
+    if (
+        !request.Header.empty() &&
+        fwrite(
+            request.Header.data(), 1, request.Header.size(), file.get()) !=
+            request.Header.size())
+        throw std::runtime_error(
+            fmt::format("Failed to write {}", request.Path.u8string()));
+
+    if (
+        request.Data != nullptr &&
+        request.Data->getSize() != request.Data->writeTo(file.get()))
+        throw std::runtime_error(
+            fmt::format("Failed to write {}", request.Path.u8string()));
+
+    if (0 != fclose(file.release()))
+        throw std::runtime_error(
+            fmt::format("Failed to close {}", request.Path.u8string()));
+}
@@ -0,0 +1,77 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Buffer.h"
+
+// Writes many small files concurrently. Every request is a complete
+// open/write/close sequence. Requests are queued and picked up by the worker
+// threads in batches, so many outputs are in flight at once and the caller
+// only blocks when the amount of queued data exceeds the limit.
+class AsyncFileWriter final
+{
+public:
+    static constexpr size_t DefaultThreadsCount = 16;
+    static constexpr size_t DefaultMaxBytesInFlight = 256 * 1024 * 1024;
+    static constexpr size_t BatchSize = 16;
+
+    explicit AsyncFileWriter(
+        size_t threadsCount = DefaultThreadsCount,
+        size_t maxBytesInFlight = DefaultMaxBytesInFlight);
+    ~AsyncFileWriter();
+
+    AsyncFileWriter(const AsyncFileWriter&) = delete;
+    AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+
+    void write(std::filesystem::path path, std::unique_ptr<Buffer> data);
+    // Writes the header followed by the data, so the data buffer
+    // can be moved in as is
+    void write(
+        std::filesystem::path path, std::vector<uint8_t> header,
+        std::unique_ptr<Buffer> data);
+
+    // Waits for all the queued requests. Rethrows the first error, if any.
+    void wait();
+
+    size_t getFilesWritten() const noexcept;
+
+private:
+    struct Request final
+    {
+        std::filesystem::path Path;
+        std::vector<uint8_t> Header;
+        std::unique_ptr<Buffer> Data;
+    };
+
+    void workerThread();
+    void processRequest(const Request& request);
+
+    std::vector<std::thread> mThreads;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mRequestsCondition;
+    std::condition_variable mCompletionCondition;
+
+    std::deque<Request> mRequests;
+
+    std::exception_ptr mError;
+
+    size_t mMaxBytesInFlight;
+    size_t mBytesInFlight { 0 };
+    size_t mRequestsInFlight { 0 };
+    size_t mFilesWritten { 0 };
+
+    bool mStopping { false };
+};
@@ -11,6 +11,14 @@
 #include <charconv>
 #include <locale>
 #include <algorithm>
+#include <unordered_map>
+#include <chrono>
+#include <limits>
+
+#ifdef __linux__
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
 
 #include <boost/process.hpp>
 #include <boost/filesystem.hpp>
@@ -19,6 +27,16 @@
 #include <sqlite3.h>
 
 #include "WaveFile.h"
+#include "AsyncFileWriter.h"
+#include "PackedSampleBlocks.h"
+#include "ProjectBlobReader.h"
+#include "ProjectBuilder.h"
+#include "BlockManifest.h"
+#include "SampleBlock.h"
+#include "Hash.h"
+#include "MemoryBudget.h"
+#include "Deadline.h"
+#include "FileUtils.h"
 
 namespace
 {
@@ -43,6 +61,110 @@ template<typename T> size_t readInt(const std::string& string, size_t offset, T&
 
     return result.ptr - string.data();
 }
+
+// Sequential profile settings
+constexpr int64_t SequentialCacheSizeKiB = 64 * 1024;
+
+// Asks the kernel to start reading the file into the page cache, which is
+// shared with the SQLite file descriptors. POSIX_FADV_SEQUENTIAL is not
+// used, as it only applies to the descriptor it is called on.
+void PrefetchFile(const std::filesystem::path& path)
+{
+#ifdef __linux__
+    const int fd = open(path.native().c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+
+    close(fd);
+#else
+    (void)path;
+#endif
+}
+
+// Offset of the file format write and read versions in the SQLite header
+constexpr size_t FileFormatVersionOffset = 18;
+constexpr uint8_t RollbackJournalFormatVersion = 1;
+
+size_t CountBlocksAfter(SQLite::Database& db, int64_t blockId)
+{
+    SQLite::Statement stmt(
+        db, "SELECT COUNT(1) FROM sampleblocks WHERE blockid > ?1;");
+
+    stmt.bind(1, blockId);
+    stmt.executeStep();
+
+    return stmt.getColumn(0).getInt64();
+}
+
+void ReportSkippedBlocks(
+    SQLite::Database& db, std::string_view operation, size_t processedBlocks,
+    int64_t lastBlockId)
+{
+    if (processedBlocks == 0)
+        Deadline::ReportPartial(
+            fmt::format("{}: no blocks were processed", operation));
+    else
+        Deadline::ReportPartial(fmt::format(
+            "{}: {} blocks were processed, {} blocks after block {} were skipped",
+            operation, processedBlocks, CountBlocksAfter(db, lastBlockId),
+            lastBlockId));
+}
+
+void RemoveDatabaseFiles(const std::filesystem::path& path)
+{
+    if (std::filesystem::exists(path))
+    {
+        std::filesystem::remove(path);
+
+        auto walFile = path;
+        walFile.replace_extension("aup3-wal");
+
+        if (std::filesystem::exists(walFile))
+            std::filesystem::remove(walFile);
+
+        auto shmFile = path;
+        shmFile.replace_extension("aup3-shm");
+
+        if (std::filesystem::exists(shmFile))
+            std::filesystem::remove(shmFile);
+    }
+}
+}
+
+ReadProfile ReadProfileFromString(std::string_view profile)
+{
+    if (profile == "default")
+        return ReadProfile::Default;
+    else if (profile == "sequential")
+        return ReadProfile::Sequential;
+
+    throw std::runtime_error(fmt::format("Unknown read profile '{}'", profile));
+}
+
+std::unique_ptr<SQLite::Database> CreateProjectDatabase(
+    const std::filesystem::path& path, uint32_t projectVersion)
+{
+    RemoveDatabaseFiles(path);
+
+    auto db = std::make_unique<SQLite::Database>(
+        path.u8string(), SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
+
+    db->exec(R"(
+    PRAGMA page_size = 65536;
+    PRAGMA busy_timeout = 5000;
+    PRAGMA journal_mode = WAL;
+    PRAGMA synchronous = NORMAL;
+    CREATE TABLE IF NOT EXISTS project (id INTEGER PRIMARY KEY, dict BLOB, doc BLOB);
+    CREATE TABLE IF NOT EXISTS autosave (id INTEGER PRIMARY KEY, dict BLOB, doc BLOB);
+    CREATE TABLE IF NOT EXISTS sampleblocks (blockid INTEGER PRIMARY KEY AUTOINCREMENT, sampleformat INTEGER, summin REAL, summax REAL, sumrms REAL, summary256 BLOB, summary64k BLOB, samples BLOB);)");
+
+    db->exec(fmt::format("PRAGMA application_id = {};", AudacityProjectID));
+    db->exec(fmt::format("PRAGMA user_version = {};", projectVersion));
+
+    return db;
 }
 
 AudacityDatabase::AudacityDatabase(
@@ -132,6 +254,188 @@ AudacityDatabase::AudacityDatabase(
         }, true);
 }
 
+AudacityDatabase::~AudacityDatabase()
+{
+    try
+    {
+        // The last save is explicit, this only handles early exits
+        if (
+            mInMemory &&
+            sqlite3_total_changes(mDatabase->getHandle()) != mSavedChanges)
+            saveInMemoryDatabase();
+    }
+    catch (const std::exception& ex)
+    {
+        fmt::print("Failed to save the database: {}\n", ex.what());
+    }
+
+    releaseInMemoryDatabase();
+}
+
+bool AudacityDatabase::loadIntoMemory(uint64_t maxSize)
+{
+    // Recovered databases are already a fresh copy
+    if (mInMemory || !mReadOnly)
+        return mInMemory;
+
+    const auto fileSize = std::filesystem::file_size(mProjectPath);
+
+    if (fileSize > maxSize || fileSize < 100)
+        return false;
+
+    // Pages in the WAL file are not a part of the main file
+    auto walPath = mProjectPath;
+    walPath += "-wal";
+
+    std::error_code ec;
+
+    if (std::filesystem::file_size(walPath, ec) > 0 && !ec)
+    {
+        fmt::print("Project has a WAL file, reading it from disk\n");
+        return false;
+    }
+
+    if (!MemoryBudget::TryAcquire(fileSize))
+    {
+        fmt::print("Project does not fit the memory budget, reading it from disk\n");
+        return false;
+    }
+
+    auto data = static_cast<uint8_t*>(sqlite3_malloc64(fileSize));
+
+    if (data == nullptr)
+    {
+        MemoryBudget::Release(fileSize);
+        return false;
+    }
+
+    PrefetchFile(mProjectPath);
+
+    std::unique_ptr<FILE, int (*)(FILE*)> file(
+        OpenFile(mProjectPath, "rb"), fclose);
+
+    // SQLite might still be able to open the file
+    if (file == nullptr)
+    {
+        sqlite3_free(data);
+        MemoryBudget::Release(fileSize);
+
+        fmt::print(
+            "Failed to open {}, reading it from disk\n",
+            mProjectPath.u8string());
+        return false;
+    }
+
+    if (fread(data, 1, fileSize, file.get()) != fileSize)
+    {
+        sqlite3_free(data);
+        MemoryBudget::Release(fileSize);
+
+        throw std::runtime_error(
+            fmt::format("Failed to read {}", mProjectPath.u8string()));
+    }
+
+    file.reset();
+
+    // The in memory database cannot use WAL
+    std::copy_n(data + FileFormatVersionOffset, 2, mFileFormatVersions);
+    std::fill_n(data + FileFormatVersionOffset, 2, RollbackJournalFormatVersion);
+
+    auto database = std::make_unique<SQLite::Database>(
+        ":memory:", SQLite::OPEN_READWRITE);
+
+    // SQLite takes the ownership of data, even if the call fails
+    const auto rc = sqlite3_deserialize(
+        database->getHandle(), "main", data, fileSize, fileSize,
+        SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE);
+
+    if (rc != SQLITE_OK)
+    {
+        MemoryBudget::Release(fileSize);
+        fmt::print(
+            "Failed to load the project into memory: {}\n",
+            sqlite3_errstr(rc));
+        return false;
+    }
+
+    mDatabase = std::move(database);
+    mInMemorySize = fileSize;
+    mInMemory = true;
+
+    fmt::print(
+        "Loaded the project into memory ({:.1f} MiB)\n",
+        fileSize / (1024.0 * 1024.0));
+
+    applyReadProfile();
+
+    return true;
+}
+
+bool AudacityDatabase::isInMemory() const noexcept
+{
+    return mInMemory;
+}
+
+void AudacityDatabase::saveInMemoryDatabase()
+{
+    if (!mInMemory || mReadOnly)
+        return;
+
+    sqlite3_int64 size = 0;
+
+    // Memory databases are contiguous, so no copy is needed
+    auto data = sqlite3_serialize(
+        mDatabase->getHandle(), "main", &size, SQLITE_SERIALIZE_NOCOPY);
+
+    std::unique_ptr<unsigned char, void (*)(void*)> copy(nullptr, sqlite3_free);
+
+    if (data == nullptr)
+    {
+        copy.reset(sqlite3_serialize(mDatabase->getHandle(), "main", &size, 0));
+        data = copy.get();
+    }
+
+    if (data == nullptr || size < 100)
+        throw std::runtime_error("Failed to serialize the database");
+
+    std::unique_ptr<FILE, int (*)(FILE*)> file(
+        OpenFile(mWritablePath, "wb"), fclose);
+
+    if (file == nullptr)
+        throw std::runtime_error(
+            fmt::format("Failed to open {}", mWritablePath.u8string()));
+
+    // Restore the journal mode of the original file
+    const bool written =
+        fwrite(data, 1, FileFormatVersionOffset, file.get()) ==
+            FileFormatVersionOffset &&
+        fwrite(mFileFormatVersions, 1, 2, file.get()) == 2 &&
+        fwrite(
+            data + FileFormatVersionOffset + 2, 1,
+            size - FileFormatVersionOffset - 2,
+            file.get()) == size_t(size - FileFormatVersionOffset - 2);
+
+    if (!written || fclose(file.release()) != 0)
+        throw std::runtime_error(
+            fmt::format("Failed to write {}", mWritablePath.u8string()));
+
+    mSavedChanges = sqlite3_total_changes(mDatabase->getHandle());
+
+    fmt::print("Saved the database to {}\n", mWritablePath.u8string());
+}
+
+void AudacityDatabase::releaseInMemoryDatabase()
+{
+    if (!mInMemory)
+        return;
+
+    mDatabase = {};
+    MemoryBudget::Release(mInMemorySize);
+
+    mInMemorySize = 0;
+    mInMemory = false;
+}
+
 void AudacityDatabase::reopenReadonlyAsWritable()
 {
     if (!mReadOnly)
@@ -143,11 +447,84 @@ void AudacityDatabase::reopenReadonlyAsWritable()
 
     removeOldFiles();
 
+    // The file is written once the database is closed
+    if (mInMemory)
+    {
+        mReadOnly = false;
+        return;
+    }
+
     std::filesystem::copy_file(mProjectPath, mWritablePath);
     mDatabase = std::make_unique<SQLite::Database>(
         mWritablePath.string(), SQLite::OPEN_READWRITE);
 
     mReadOnly = false;
+
+    applyReadProfile();
+}
+
+void AudacityDatabase::setReadProfile(ReadProfile profile)
+{
+    mReadProfile = profile;
+    applyReadProfile();
+}
+
+void AudacityDatabase::applyReadProfile()
+{
+    // Memory mapping and read ahead do not apply to memory databases
+    if (mDatabase == nullptr || mInMemory)
+        return;
+
+    if (mReadProfile == ReadProfile::Default)
+    {
+        mDatabase->exec(R"(
+        PRAGMA mmap_size = 0;
+        PRAGMA cache_size = -2000;
+        PRAGMA temp_store = DEFAULT;)");
+
+        return;
+    }
+
+    const auto path = getCurrentPath();
+
+    std::error_code ec;
+    const auto fileSize = std::filesystem::file_size(path, ec);
+
+    // SQLite clamps mmap_size to SQLITE_MAX_MMAP_SIZE
+    mDatabase->exec(fmt::format(
+        R"(
+        PRAGMA mmap_size = {};
+        PRAGMA cache_size = -{};
+        PRAGMA temp_store = MEMORY;)",
+        ec ? 0 : fileSize, SequentialCacheSizeKiB));
+
+    PrefetchFile(path);
+}
+
+void AudacityDatabase::benchmarkSampleBlocksScan()
+{
+    using Clock = std::chrono::steady_clock;
+
+    SQLite::Statement stmt(*mDatabase, "SELECT samples FROM sampleblocks;");
+
+    const auto start = Clock::now();
+
+    size_t blocksCount = 0;
+    uint64_t bytesRead = 0;
+
+    while (stmt.executeStep())
+    {
+        bytesRead += stmt.getColumn(0).getBytes();
+        ++blocksCount;
+    }
+
+    const double seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+
+    fmt::print(
+        "Read {} blocks ({:.1f} MiB) in {:.3f} s: {:.1f} MiB/s\n", blocksCount,
+        bytesRead / (1024.0 * 1024.0), seconds,
+        seconds > 0 ? bytesRead / (1024.0 * 1024.0) / seconds : 0.0);
 }
 
 void AudacityDatabase::recoverDatabase()
@@ -155,7 +532,9 @@ void AudacityDatabase::recoverDatabase()
     if (mRecoveredInConstructor)
         return;
 
+    releaseInMemoryDatabase();
     mDatabase = {};
+
     removeOldFiles();
 
     auto recoveredDB = std::make_unique<SQLite::Database>(
@@ -320,6 +699,8 @@ void AudacityDatabase::recoverDatabase()
 
     mDatabase = std::move(recoveredDB);
     mReadOnly = false;
+
+    applyReadProfile();
 }
 
 bool AudacityDatabase::hasAutosave()
@@ -340,6 +721,10 @@ bool AudacityDatabase::checkIntegrity()
 {
     fmt::print("Checking database integrity.\n");
 
+    Deadline::QueryInterruptGuard interruptGuard(DB());
+
+    bool hasErrors = false;
+
     try
     {
         SQLite::Statement integrityCheck(DB(), "PRAGMA integrity_check(10240);");
@@ -352,7 +737,23 @@ bool AudacityDatabase::checkIntegrity()
                 return true;
             else
                 fmt::print("{}\n", message);
+
+            hasErrors = true;
+        }
+    }
+    catch (const SQLite::Exception& ex)
+    {
+        if (ex.getErrorCode() != SQLITE_INTERRUPT)
+        {
+            fmt::print("Exception while checking the integrity: {}", ex.what());
+            return false;
         }
+
+        Deadline::ReportPartial(fmt::format(
+            "check_integrity: interrupted, {} errors were found before",
+            hasErrors ? "some" : "no"));
+
+        return !hasErrors;
     }
     catch (const std::exception& ex)
     {
@@ -362,6 +763,142 @@ bool AudacityDatabase::checkIntegrity()
     return false;
 }
 
+bool AudacityDatabase::verifySampleBlocks(uint32_t rehashPeriod)
+{
+    rehashPeriod = std::max<uint32_t>(1, rehashPeriod);
+
+    auto manifestPath = mProjectPath;
+    manifestPath += ".manifest";
+
+    const auto manifest = ReadBlockManifest(manifestPath);
+
+    std::unordered_map<int64_t, const BlockManifestEntry*> knownBlocks;
+
+    for (const auto& entry : manifest.Entries)
+        knownBlocks.emplace(entry.BlockId, &entry);
+
+    // Blocks are never modified in place, so the hash of a known block
+    // can only change if the file is damaged
+    const uint64_t rotation = manifest.RunsCount % rehashPeriod;
+
+    SQLite::Statement listBlocks(
+        *mDatabase,
+        "SELECT blockid, sampleformat, length(samples), length(summary256), length(summary64k) FROM sampleblocks ORDER BY blockid;");
+
+    SQLite::Statement readSamples(
+        *mDatabase, "SELECT samples FROM sampleblocks WHERE blockid = ?1;");
+
+    auto hashBlock = [&readSamples](int64_t blockId)
+    {
+        readSamples.bind(1, blockId);
+        readSamples.executeStep();
+
+        const auto samples = readSamples.getColumn(0);
+        const auto hash = CalculateHash(samples.getBlob(), samples.getBytes());
+
+        readSamples.reset();
+
+        return hash;
+    };
+
+    BlockManifest updatedManifest;
+    updatedManifest.RunsCount = manifest.RunsCount + 1;
+
+    size_t newBlocks = 0;
+    size_t rehashedBlocks = 0;
+    size_t failedBlocks = 0;
+    size_t matchedBlocks = 0;
+
+    int64_t lastBlockId = std::numeric_limits<int64_t>::min();
+    bool interrupted = false;
+
+    while (listBlocks.executeStep())
+    {
+        const int64_t blockId = listBlocks.getColumn(0).getInt64();
+        const int32_t format = listBlocks.getColumn(1).getInt();
+        const int64_t length = listBlocks.getColumn(2).getInt64();
+
+        if (Deadline::IsExpired())
+        {
+            interrupted = true;
+            break;
+        }
+
+        lastBlockId = blockId;
+
+        auto it = knownBlocks.find(blockId);
+
+        if (it == knownBlocks.end())
+        {
+            const auto problem = ValidateSampleBlockLayout(
+                format, length, listBlocks.getColumn(3).getInt64(),
+                listBlocks.getColumn(4).getInt64());
+
+            // Invalid blocks are not added, so they are checked again
+            if (!problem.empty())
+            {
+                fmt::print("Block {}: {}\n", blockId, problem);
+                ++failedBlocks;
+                continue;
+            }
+
+            updatedManifest.Entries.push_back(
+                { blockId, format, 0, uint64_t(length), hashBlock(blockId) });
+
+            ++newBlocks;
+
+            continue;
+        }
+
+        const auto& entry = *it->second;
+
+        ++matchedBlocks;
+        updatedManifest.Entries.push_back(entry);
+
+        if (entry.SampleFormat != format || entry.Length != uint64_t(length))
+        {
+            fmt::print("Block {} was modified\n", blockId);
+            ++failedBlocks;
+            continue;
+        }
+
+        if (uint64_t(blockId) % rehashPeriod != rotation)
+            continue;
+
+        ++rehashedBlocks;
+
+        if (hashBlock(blockId) != entry.Hash)
+        {
+            fmt::print("Block {} has unexpected hash\n", blockId);
+            ++failedBlocks;
+        }
+    }
+
+    if (interrupted)
+    {
+        listBlocks.reset();
+
+        // Blocks that were not checked stay in the manifest as is
+        for (const auto& entry : manifest.Entries)
+        {
+            if (entry.BlockId > lastBlockId)
+                updatedManifest.Entries.push_back(entry);
+        }
+
+        ReportSkippedBlocks(
+            *mDatabase, "verify_blocks", newBlocks + matchedBlocks, lastBlockId);
+    }
+
+    WriteBlockManifest(manifestPath, updatedManifest);
+
+    fmt::print(
+        "Verified {} new blocks, re-hashed {} of {} known blocks. {} blocks were removed\n",
+        newBlocks, rehashedBlocks, matchedBlocks,
+        manifest.Entries.size() - matchedBlocks);
+
+    return failedBlocks == 0;
+}
+
 SQLite::Database& AudacityDatabase::DB()
 {
     return *mDatabase;
@@ -404,22 +941,39 @@ void AudacityDatabase::extractSampleBlocks(
 
     auto baseDirectory = makePath(outerIndex, innerIndex);
 
+    AsyncFileWriter writer;
+
     SQLite::Statement stmt(*mDatabase, R"(SELECT blockid, samples FROM sampleblocks;)");
 
+    size_t extractedBlocks = 0;
+    int64_t lastBlockId = 0;
+
     while (stmt.executeStep())
     {
+        if (Deadline::IsExpired())
+        {
+            stmt.reset();
+            ReportSkippedBlocks(
+                *mDatabase, "extract_sample_blocks", extractedBlocks,
+                lastBlockId);
+            break;
+        }
+
         const int64_t blockId = stmt.getColumn(0).getInt64();
 
         const void* data = stmt.getColumn(1).getBlob();
         const int64_t bytes = stmt.getColumn(1).getBytes();
 
+        lastBlockId = blockId;
+        ++extractedBlocks;
+
         const auto wavePath = baseDirectory / fmt::format("{}.wav", blockId);
 
         WaveFile waveFile(wavePath, format, sampleRate, 1);
 
         waveFile.writeBlock(data, bytes, 0);
 
-        waveFile.writeFile();
+        waveFile.writeFile(writer);
 
         ++fileIndex;
 
@@ -438,6 +992,54 @@ void AudacityDatabase::extractSampleBlocks(
             baseDirectory = makePath(outerIndex, innerIndex);
         }
     }
+
+    writer.wait();
+}
+
+void AudacityDatabase::extractPackedSampleBlocks()
+{
+    std::filesystem::create_directories(mDataPath);
+
+    const auto dataPath = mDataPath / "sampleblocks.bin";
+    const auto indexPath = mDataPath / "sampleblocks.idx";
+
+    PackedSampleBlocksWriter writer(dataPath, indexPath);
+
+    SQLite::Statement stmt(
+        *mDatabase,
+        R"(SELECT blockid, sampleformat, summin, summax, sumrms, samples FROM sampleblocks;)");
+
+    int64_t lastBlockId = 0;
+
+    while (stmt.executeStep())
+    {
+        if (Deadline::IsExpired())
+        {
+            stmt.reset();
+            ReportSkippedBlocks(
+                *mDatabase, "extract_sample_blocks", writer.getBlocksCount(),
+                lastBlockId);
+            break;
+        }
+
+        const int64_t blockId = stmt.getColumn(0).getInt64();
+        const int32_t sampleFormat = stmt.getColumn(1).getInt();
+
+        lastBlockId = blockId;
+
+        const void* data = stmt.getColumn(5).getBlob();
+        const int64_t bytes = stmt.getColumn(5).getBytes();
+
+        writer.writeBlock(
+            blockId, sampleFormat, data, bytes, stmt.getColumn(2).getDouble(),
+            stmt.getColumn(3).getDouble(), stmt.getColumn(4).getDouble());
+    }
+
+    writer.finalize();
+
+    fmt::print(
+        "Packed {} sample blocks ({} bytes) into {}\n", writer.getBlocksCount(),
+        writer.getDataSize(), dataPath.u8string());
 }
 
 void AudacityDatabase::extractTrack(
@@ -452,13 +1054,29 @@ void AudacityDatabase::extractTrack(
     SQLite::Statement stmt(
         *mDatabase, R"(SELECT blockid, samples FROM sampleblocks;)");
 
+    size_t extractedBlocks = 0;
+    int64_t lastBlockId = 0;
+
     while (stmt.executeStep())
     {
+        if (Deadline::IsExpired())
+        {
+            stmt.reset();
+            ReportSkippedBlocks(
+                *mDatabase,
+                asStereo ? "extract_as_stereo_track" : "extract_as_mono_track",
+                extractedBlocks, lastBlockId);
+            break;
+        }
+
         const int64_t blockId = stmt.getColumn(0).getInt64();
 
         const void* data = stmt.getColumn(1).getBlob();
         const int64_t bytes = stmt.getColumn(1).getBytes();
 
+        lastBlockId = blockId;
+        ++extractedBlocks;
+
         waveFile.writeBlock(
             data, bytes, asStereo && (blockId % 2 == 0) ? 1 : 0);
     }
@@ -466,22 +1084,250 @@ void AudacityDatabase::extractTrack(
     waveFile.writeFile();
 }
 
-void AudacityDatabase::removeOldFiles()
+namespace
+{
+struct RebuiltBlock final
+{
+    int64_t BlockId;
+    int32_t Format;
+    int64_t Length;
+};
+
+struct RebuiltTrack final
 {
-    if (std::filesystem::exists(mWritablePath))
+    int32_t Format { 0 };
+    int64_t MaxSamples { 0 };
+    std::vector<RebuiltBlock> Blocks;
+};
+} // namespace
+
+void AudacityDatabase::rebuildProject(
+    int32_t sampleRate, size_t tracksCount,
+    const std::vector<int64_t>& blocksOrder)
+{
+    if (tracksCount == 0)
+        throw std::runtime_error("At least one track is required");
+
+    // Only the metadata is read, samples are never copied
+    SQLite::Statement stmt(
+        *mDatabase,
+        R"(SELECT blockid, sampleformat, length(samples) FROM sampleblocks ORDER BY blockid;)");
+
+    std::vector<RebuiltBlock> availableBlocks;
+
+    while (stmt.executeStep())
     {
-        std::filesystem::remove(mWritablePath);
+        const auto format = stmt.getColumn(1).getInt();
+        const auto bytes = stmt.getColumn(2).getInt64();
 
-        auto walFile = mWritablePath;
-        walFile.replace_extension("aup3-wal");
+        availableBlocks.push_back(
+            { stmt.getColumn(0).getInt64(), format,
+              bytes / DiskBytesPerSample(SampleFormat(format)) });
+    }
 
-        if (std::filesystem::exists(walFile))
-            std::filesystem::remove(walFile);
+    std::vector<RebuiltBlock> orderedBlocks;
 
-        auto shmFile = mWritablePath;
-        shmFile.replace_extension("aup3-shm");
+    if (blocksOrder.empty())
+    {
+        orderedBlocks = std::move(availableBlocks);
+    }
+    else
+    {
+        std::unordered_map<int64_t, size_t> blocksLookup;
 
-        if (std::filesystem::exists(shmFile))
-            std::filesystem::remove(shmFile);
+        for (size_t i = 0; i < availableBlocks.size(); ++i)
+            blocksLookup.emplace(availableBlocks[i].BlockId, i);
+
+        for (auto blockId : blocksOrder)
+        {
+            auto it = blocksLookup.find(blockId);
+
+            if (it == blocksLookup.end())
+            {
+                fmt::print("Block {} is not found, skipping\n", blockId);
+                continue;
+            }
+
+            orderedBlocks.push_back(availableBlocks[it->second]);
+        }
+    }
+
+    std::vector<RebuiltTrack> tracks(tracksCount);
+
+    for (const auto& block : orderedBlocks)
+    {
+        // Negative ids are silence in the project document
+        if (block.BlockId <= 0)
+        {
+            fmt::print("Block {} has invalid id, skipping\n", block.BlockId);
+            continue;
+        }
+
+        // Same as -extract_as_stereo_track for two tracks
+        auto& track = tracks[(block.BlockId - 1) % tracksCount];
+
+        if (track.Blocks.empty())
+            track.Format = block.Format;
+
+        if (block.Format != track.Format)
+        {
+            fmt::print(
+                "Block {} has unexpected sample format, skipping\n",
+                block.BlockId);
+            continue;
+        }
+
+        track.MaxSamples = std::max(track.MaxSamples, block.Length);
+        track.Blocks.push_back(block);
     }
+
+    ProjectBuilder builder;
+
+    auto& root = builder.getRoot();
+
+    builder.setAttribute(root, "version", std::string_view("1.3.0"));
+    builder.setAttribute(
+        root, "audacityversion",
+        std::string_view(fmt::format(
+            "{}.{}.{}", (mProjectVersion >> 24) & 0xFF,
+            (mProjectVersion >> 16) & 0xFF, (mProjectVersion >> 8) & 0xFF)));
+    builder.setAttribute(root, "rate", double(sampleRate));
+
+    const bool stereo = tracksCount == 2;
+
+    for (size_t trackIndex = 0; trackIndex < tracksCount; ++trackIndex)
+    {
+        const auto& track = tracks[trackIndex];
+
+        if (track.Blocks.empty())
+            continue;
+
+        const auto format = SampleFormat(track.Format);
+
+        // Same as the Audacity default, unless some block is larger
+        const int64_t maxSamples = std::max<int64_t>(
+            1024 * 1024 / DiskBytesPerSample(format), track.MaxSamples);
+
+        auto& trackNode = builder.addNode(root, "wavetrack");
+
+        builder.setAttribute(
+            trackNode, "name",
+            std::string_view(fmt::format("Recovered {}", trackIndex + 1)));
+        builder.setAttribute(
+            trackNode, "channel",
+            int32_t(stereo ? trackIndex : 2));
+        builder.setAttribute(trackNode, "linked", stereo && trackIndex == 0);
+        builder.setAttribute(trackNode, "mute", false);
+        builder.setAttribute(trackNode, "solo", false);
+        builder.setAttribute(trackNode, "rate", double(sampleRate));
+        builder.setAttribute(trackNode, "gain", 1.0);
+        builder.setAttribute(trackNode, "pan", 0.0);
+        builder.setAttribute(trackNode, "sampleformat", track.Format);
+
+        auto& clipNode = builder.addNode(trackNode, "waveclip");
+
+        builder.setAttribute(clipNode, "offset", 0.0);
+        builder.setAttribute(clipNode, "trimLeft", 0.0);
+        builder.setAttribute(clipNode, "trimRight", 0.0);
+        builder.setAttribute(clipNode, "name", std::string_view("Recovered"));
+
+        auto& sequenceNode = builder.addNode(clipNode, "sequence");
+
+        builder.setAttribute(sequenceNode, "maxsamples", maxSamples);
+        builder.setAttribute(sequenceNode, "sampleformat", track.Format);
+
+        int64_t start = 0;
+
+        for (const auto& block : track.Blocks)
+        {
+            auto& blockNode = builder.addNode(sequenceNode, "waveblock");
+
+            builder.setAttribute(blockNode, "start", start);
+            builder.setAttribute(blockNode, "blockid", block.BlockId);
+
+            start += block.Length;
+        }
+
+        builder.setAttribute(sequenceNode, "numsamples", start);
+
+        auto& envelopeNode = builder.addNode(clipNode, "envelope");
+        builder.setAttribute(envelopeNode, "numpoints", int32_t(0));
+
+        fmt::print(
+            "Track {}: {} blocks, {} samples\n", trackIndex + 1,
+            track.Blocks.size(), start);
+    }
+
+    reopenReadonlyAsWritable();
+
+    auto document = builder.serialize();
+
+    mDatabase->exec("BEGIN;");
+    mDatabase->exec("DELETE FROM autosave;");
+
+    WriteProjectBlob(*mDatabase, "project", *document.first, *document.second);
+
+    mDatabase->exec("COMMIT;");
+}
+
+std::unique_ptr<SQLite::Database>
+AudacityDatabase::createProjectDatabase(const std::filesystem::path& path) const
+{
+    return CreateProjectDatabase(path, mProjectVersion);
+}
+
+size_t AudacityDatabase::copySampleBlocks(
+    SQLite::Database& target, const std::vector<int64_t>& blockIds,
+    int64_t blockIdOffset) const
+{
+    SQLite::Statement attach(target, "ATTACH DATABASE ?1 AS source;");
+    attach.bind(1, getCurrentPath().u8string());
+    attach.exec();
+
+    size_t copiedBlocks = 0;
+
+    try
+    {
+        target.exec(R"(
+        BEGIN;
+        CREATE TEMP TABLE copied_blocks (blockid INTEGER PRIMARY KEY);)");
+
+        SQLite::Statement insertId(
+            target, "INSERT OR IGNORE INTO temp.copied_blocks VALUES (?1);");
+
+        for (auto blockId : blockIds)
+        {
+            insertId.bind(1, blockId);
+            insertId.exec();
+            insertId.reset();
+        }
+
+        copiedBlocks = target.exec(fmt::format(
+            R"(
+        INSERT INTO main.sampleblocks (blockid, sampleformat, summin, summax, sumrms, summary256, summary64k, samples)
+            SELECT s.blockid + {}, s.sampleformat, s.summin, s.summax, s.sumrms, s.summary256, s.summary64k, s.samples
+            FROM temp.copied_blocks c JOIN source.sampleblocks s ON s.blockid = c.blockid;)",
+            blockIdOffset));
+
+        target.exec(R"(
+        DROP TABLE temp.copied_blocks;
+        COMMIT;)");
+    }
+    catch (...)
+    {
+        if (!sqlite3_get_autocommit(target.getHandle()))
+            target.exec("ROLLBACK;");
+
+        target.exec("DETACH DATABASE source;");
+        throw;
+    }
+
+    target.exec("DETACH DATABASE source;");
+
+    return copiedBlocks;
+}
+
+void AudacityDatabase::removeOldFiles()
+{
+    RemoveDatabaseFiles(mWritablePath);
 }
@@ -8,9 +8,26 @@
 #include <SQLiteCpp/SQLiteCpp.h>
 #include <filesystem>
 #include <memory>
+#include <string_view>
+#include <vector>
 
 #include "SampleFormat.h"
 
+// Creates an empty project file with the Audacity schema
+std::unique_ptr<SQLite::Database> CreateProjectDatabase(
+    const std::filesystem::path& path, uint32_t projectVersion);
+
+enum class ReadProfile
+{
+    // SQLite defaults
+    Default,
+    // Large page cache, memory mapped I/O and read ahead hints,
+    // tuned for the full scans of the sampleblocks table
+    Sequential,
+};
+
+ReadProfile ReadProfileFromString(std::string_view profile);
+
 struct RecoveryConfig final
 {
     const std::filesystem::path BinaryPath;
@@ -24,6 +41,22 @@ class AudacityDatabase final
 public:
     explicit AudacityDatabase(
         const std::filesystem::path& path, RecoveryConfig recoveryConfig);
+    ~AudacityDatabase();
+
+    // The profile is kept when the database is reopened
+    void setReadProfile(ReadProfile profile);
+
+    // Loads the database into memory with a single sequential read, if the
+    // file is not larger than maxSize. The modified database is written
+    // to the writable path once closed. Returns false if the database
+    // stays on disk.
+    bool loadIntoMemory(uint64_t maxSize);
+    bool isInMemory() const noexcept;
+
+    // Writes the in memory database to the writable path, if it was modified.
+    // Throws on failure. The destructor only saves the changes made after
+    // the last call.
+    void saveInMemoryDatabase();
 
     void reopenReadonlyAsWritable();
     void recoverDatabase();
@@ -32,6 +65,14 @@ public:
     void dropAutosave();
     bool checkIntegrity();
 
+    // Hashes the new sample blocks and stores the hashes in the manifest
+    // next to the project. Known blocks are re-hashed once in rehashPeriod
+    // runs. Returns false if any block has failed the verification.
+    bool verifySampleBlocks(uint32_t rehashPeriod);
+
+    // Reads all the sample blocks and prints the throughput
+    void benchmarkSampleBlocksScan();
+
     SQLite::Database& DB();
 
     std::filesystem::path getProjectPath() const;
@@ -40,10 +81,33 @@ public:
     std::filesystem::path getDataPath() const;
 
     void extractSampleBlocks(SampleFormat format, int32_t sampleRate);
+    void extractPackedSampleBlocks();
     void extractTrack(SampleFormat format, int32_t sampleRate, bool asStereo);
 
+    // Replaces the project document with a new one, that references
+    // the existing sample blocks. Blocks are distributed between the tracks
+    // by the block id. If blocksOrder is empty, all the blocks are used
+    // in the ascending order.
+    void rebuildProject(
+        int32_t sampleRate, size_t tracksCount,
+        const std::vector<int64_t>& blocksOrder);
+
+    // Creates an empty project file with the same version as this project
+    std::unique_ptr<SQLite::Database>
+    createProjectDatabase(const std::filesystem::path& path) const;
+
+    // Copies sample blocks as is into another project database,
+    // blockIdOffset is added to the block ids. Blocks are read from the file,
+    // so the modified in memory database must be saved first.
+    // Returns the number of blocks copied.
+    size_t copySampleBlocks(
+        SQLite::Database& target, const std::vector<int64_t>& blockIds,
+        int64_t blockIdOffset = 0) const;
+
 private:
     void removeOldFiles();
+    void applyReadProfile();
+    void releaseInMemoryDatabase();
 
     std::unique_ptr<SQLite::Database> mDatabase;
     std::filesystem::path mProjectPath;
@@ -54,6 +118,16 @@ private:
 
     RecoveryConfig mRecoveryConfig;
 
+    ReadProfile mReadProfile { ReadProfile::Default };
+
+    // File format versions from the header of the loaded file,
+    // WAL files have 2 here
+    uint8_t mFileFormatVersions[2] {};
+    uint64_t mInMemorySize { 0 };
+    // sqlite3_total_changes at the last save, -1 if never saved
+    int mSavedChanges { -1 };
+    bool mInMemory { false };
+
     bool mReadOnly { true };
     bool mRecoveredInConstructor { false };
 };
@@ -9,6 +9,9 @@
 #include <vector>
 #include <deque>
 #include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <unordered_map>
 
 #include "ProjectModel.h"
 
@@ -39,8 +42,7 @@ class Stream final
 {
 public:
     explicit Stream(const Buffer& buffer)
-        : mBuffer(buffer)
-        , mBufferSize(buffer.getSize())
+        : mCursor(buffer)
     {
     }
 
@@ -48,10 +50,8 @@ public:
     {
         T result;
 
-        if (sizeof(T) != mBuffer.read(result, mOffset))
-            throw std::overflow_error(fmt::format("Unable to read {} bytes at offset {}", sizeof(T), mOffset));
-
-        mOffset += sizeof(T);
+        if (!mCursor.read(result))
+            throw std::overflow_error(fmt::format("Unable to read {} bytes at offset {}", sizeof(T), mCursor.getOffset()));
 
         return result;
     }
@@ -69,16 +69,15 @@ public:
         const auto bytesCount =
             useInt ? read<uint32_t>() : uint32_t(read<uint16_t>());
 
-        mTempData.reserve(bytesCount);
+        mTempData.resize(bytesCount);
 
-        if (bytesCount != mBuffer.read(mTempData.data(), mOffset, bytesCount))
+        if (bytesCount != mCursor.read(mTempData.data(), bytesCount))
         {
             throw std::overflow_error(fmt::format(
-                "Unable to read {} bytes at offset {}", bytesCount, mOffset));
+                "Unable to read {} bytes at offset {}", bytesCount,
+                mCursor.getOffset()));
         }
 
-        mOffset += bytesCount;
-
         if (mCharSize == 1)
         {
             return std::string(mTempData.data(), bytesCount);
@@ -118,15 +117,12 @@ public:
 
     void skip(size_t bytes)
     {
-        const auto targetOffset = mOffset + bytes;
-
-        if (targetOffset > mBufferSize)
+        if (!mCursor.skip(bytes))
         {
             throw std::overflow_error(fmt::format(
-                "Unable to skip {} bytes at offset {}", bytes, mOffset));
+                "Unable to skip {} bytes at offset {}", bytes,
+                mCursor.getOffset()));
         }
-
-        mOffset = targetOffset;
     }
 
     void skipString(bool useInt = false)
@@ -139,17 +135,14 @@ public:
 
     bool isEof() const noexcept
     {
-        return mBufferSize == mOffset;
+        return mCursor.getBytesLeft() == 0;
     }
 
 private:
-    const Buffer& mBuffer;
+    BufferCursor mCursor;
 
     std::vector<char> mTempData;
 
-    size_t mOffset { 0 };
-    size_t mBufferSize;
-
     size_t mCharSize { 0 };
 };
 
@@ -179,7 +172,12 @@ public:
 
             std::visit(
                 [this](auto&& value) {
-                    write(fmt::format("{}", value));
+                    using T = std::decay_t<decltype(value)>;
+
+                    if constexpr (std::is_same_v<T, std::string_view>)
+                        writeEscaped(value);
+                    else
+                        write(fmt::format("{}", value));
                 },
                 attr.Value);
 
@@ -214,6 +212,21 @@ public:
     }
 
     void HandleCharData(std::string_view data) override
+    {
+        writeEscaped(data);
+    }
+
+    std::unique_ptr<Buffer> Consume()
+    {
+        return std::move(mBuffer);
+    }
+
+    void write(std::string_view data)
+    {
+        mBuffer->append(data.data(), data.size());
+    }
+
+    void writeEscaped(std::string_view data)
     {
         static int charXMLCompatiblity[] = {
 
@@ -257,16 +270,6 @@ public:
         }
     }
 
-    std::unique_ptr<Buffer> Consume()
-    {
-        return std::move(mBuffer);
-    }
-
-    void write(std::string_view data)
-    {
-        mBuffer->append(data.data(), data.size());
-    }
-
 private:
     std::unique_ptr<Buffer> mBuffer;
     std::string_view mLastTagName;
@@ -481,10 +484,49 @@ std::unique_ptr<Buffer> BinaryXMLConverter::ConvertToXML(const Buffer& buffer)
 
 namespace
 {
+void ConvertNode(XMLHandler& handler, const ProjectTreeNode& node)
+{
+    handler.HandleTagStart(node.TagName, node.Attributes);
+
+    if (!node.Data.empty())
+        handler.HandleCharData(node.Data);
+
+    for (const auto& child : node.Children)
+        ConvertNode(handler, *child);
+
+    handler.HandleTagEnd(node.TagName);
+}
+} // namespace
+
+std::unique_ptr<Buffer>
+BinaryXMLConverter::ConvertToXML(const ProjectTreeNode& project)
+{
+    XMLConverter converter;
+
+    ConvertNode(converter, project);
+
+    return converter.Consume();
+}
+
+namespace
+{
+// Audacity 3.0 and 3.1 convert the document to text before parsing it,
+// floats are written with 7 significant digits
+bool IsLosslessFloat(double value)
+{
+    if (double(float(value)) != value)
+        return false;
+
+    const auto text = fmt::format("{:.7g}", value);
+
+    return std::strtod(text.c_str(), nullptr) == value;
+}
+
+// In the compact mode, the smallest field type that keeps the value is used
 template<typename StringLookup>
 void WriteNode(
     const StringLookup& indexLookup, Buffer& buffer,
-    const ProjectTreeNode& node)
+    const ProjectTreeNode& node, bool compact)
 {
     const uint16_t tagIndex = indexLookup(node.TagName);
 
@@ -494,7 +536,7 @@ void WriteNode(
     for (const auto& attr : node.Attributes)
     {
         std::visit(
-            [attrNameIndex = indexLookup(attr.Name), &buffer](auto&& value) {
+            [attrNameIndex = indexLookup(attr.Name), &buffer, compact](auto&& value) {
                 using T = std::decay_t<decltype(value)>;
 
                 if constexpr (std::is_same_v<T, bool>)
@@ -517,6 +559,17 @@ void WriteNode(
                 }
                 else if constexpr (std::is_same_v<T, int64_t>)
                 {
+                    if (
+                        compact &&
+                        value >= std::numeric_limits<int32_t>::min() &&
+                        value <= std::numeric_limits<int32_t>::max())
+                    {
+                        buffer.append(FieldTypes::FT_Int);
+                        buffer.append(attrNameIndex);
+                        buffer.append(int32_t(value));
+                        return;
+                    }
+
                     buffer.append(FieldTypes::FT_LongLong);
                     buffer.append(attrNameIndex);
                     buffer.append(value);
@@ -536,6 +589,15 @@ void WriteNode(
                 }
                 else if constexpr (std::is_same_v<T, double>)
                 {
+                    if (compact && IsLosslessFloat(value))
+                    {
+                        buffer.append(FieldTypes::FT_Float);
+                        buffer.append(attrNameIndex);
+                        buffer.append(float(value));
+                        buffer.append(int32_t(7));
+                        return;
+                    }
+
                     buffer.append(FieldTypes::FT_Double);
                     buffer.append(attrNameIndex);
                     buffer.append(value);
@@ -560,13 +622,171 @@ void WriteNode(
     }
 
     for (const auto& child : node.Children)
-        WriteNode(indexLookup, buffer, *child);
+        WriteNode(indexLookup, buffer, *child, compact);
 
     buffer.append(FieldTypes::FT_EndTag);
     buffer.append(tagIndex);
 }
+
+template<typename Names>
+void WriteNames(Buffer& buffer, const Names& names)
+{
+    // We write strings solely in UTF-8
+    buffer.append(FieldTypes::FT_CharSize);
+    buffer.append(uint8_t(1));
+
+    uint16_t stringIndex = 0;
+
+    for (const auto& name : names)
+    {
+        buffer.append(FieldTypes::FT_Name);
+        buffer.append(uint16_t(stringIndex++));
+        buffer.append(uint16_t(name.length()));
+        buffer.append(name.data(), name.length());
+    }
+}
+
+// Collects the names in the order of the first use
+void CollectNames(
+    const ProjectTreeNode& node,
+    std::unordered_map<std::string_view, uint16_t>& indices,
+    std::vector<std::string_view>& names)
+{
+    auto addName = [&indices, &names](std::string_view name)
+    {
+        if (indices.count(name))
+            return;
+
+        if (names.size() > std::numeric_limits<uint16_t>::max())
+            throw std::runtime_error("Too many names in the project");
+
+        indices.emplace(name, uint16_t(names.size()));
+        names.push_back(name);
+    };
+
+    addName(node.TagName);
+
+    for (const auto& attr : node.Attributes)
+        addName(attr.Name);
+
+    for (const auto& child : node.Children)
+        CollectNames(*child, indices, names);
+}
+
+bool IsSameValue(const AttributeValue& lhs, const AttributeValue& rhs)
+{
+    return std::visit(
+        [](auto&& left, auto&& right)
+        {
+            using L = std::decay_t<decltype(left)>;
+            using R = std::decay_t<decltype(right)>;
+
+            if constexpr (
+                std::is_same_v<L, std::string_view> ||
+                std::is_same_v<R, std::string_view> ||
+                std::is_same_v<L, bool> || std::is_same_v<R, bool>)
+            {
+                if constexpr (std::is_same_v<L, R>)
+                    return left == right;
+                else
+                    return false;
+            }
+            else if constexpr (
+                std::is_integral_v<L> && std::is_integral_v<R>)
+            {
+                return (left < 0) == (right < 0) &&
+                       int64_t(left) == int64_t(right);
+            }
+            else if constexpr (
+                std::is_floating_point_v<L> && std::is_floating_point_v<R>)
+            {
+                return double(left) == double(right);
+            }
+            else
+            {
+                return false;
+            }
+        },
+        lhs, rhs);
 }
 
+// Walks the tree along with the parsed document
+class ProjectTreeComparer final : public XMLHandler
+{
+public:
+    explicit ProjectTreeComparer(const ProjectTreeNode& root)
+        : mRoot(root)
+    {
+    }
+
+    void HandleTagStart(
+        std::string_view name, const AttributeList& attributes) override
+    {
+        const ProjectTreeNode* node = nullptr;
+
+        if (mStack.empty())
+        {
+            node = mRootVisited ? nullptr : &mRoot;
+            mRootVisited = true;
+        }
+        else
+        {
+            auto& [parent, childIndex] = mStack.back();
+
+            if (childIndex < parent->Children.size())
+                node = parent->Children[childIndex++].get();
+        }
+
+        if (node == nullptr || node->TagName != name ||
+            node->Attributes.size() != attributes.size())
+            fail(name);
+
+        for (size_t index = 0; index < attributes.size(); ++index)
+        {
+            if (
+                node->Attributes[index].Name != attributes[index].Name ||
+                !IsSameValue(node->Attributes[index].Value, attributes[index].Value))
+                fail(name);
+        }
+
+        mStack.emplace_back(node, 0);
+    }
+
+    void HandleTagEnd(std::string_view name) override
+    {
+        if (mStack.empty() ||
+            mStack.back().second != mStack.back().first->Children.size())
+            fail(name);
+
+        mStack.pop_back();
+    }
+
+    void HandleCharData(std::string_view data) override
+    {
+        if (mStack.empty() || mStack.back().first->Data != data)
+            fail("data");
+    }
+
+    void finish()
+    {
+        if (!mRootVisited || !mStack.empty())
+            fail(mRoot.TagName);
+    }
+
+private:
+    [[noreturn]] void fail(std::string_view tag)
+    {
+        throw std::runtime_error(fmt::format(
+            "Serialized document differs from the project at tag {}", tag));
+    }
+
+    const ProjectTreeNode& mRoot;
+
+    std::vector<std::pair<const ProjectTreeNode*, size_t>> mStack;
+    bool mRootVisited { false };
+};
+} // namespace
+
 std::pair<std::unique_ptr<Buffer>, std::unique_ptr<Buffer>>
 BinaryXMLConverter::SerializeProject(
     const std::deque<std::string>& names, const ProjectTreeNode& project)
@@ -575,19 +795,7 @@ BinaryXMLConverter::SerializeProject(
         std::make_unique<Buffer>(), std::make_unique<Buffer>()
     };
 
-    // We write strings solely in UTF-8
-    result.first->append(FieldTypes::FT_CharSize);
-    result.first->append(uint8_t(1));
-
-    uint16_t stringIndex = 0;
-
-    for (const auto& name : names)
-    {
-        result.first->append(FieldTypes::FT_Name);
-        result.first->append(uint16_t(stringIndex++));
-        result.first->append(uint16_t(name.length()));
-        result.first->append(name.data(), name.length());
-    }
+    WriteNames(*result.first, names);
 
     auto getStringIndex = [&names](std::string_view name)
     {
@@ -599,7 +807,46 @@ BinaryXMLConverter::SerializeProject(
         return uint16_t(std::distance(names.begin(), it));
     };
 
-    WriteNode(getStringIndex, *result.second, project);
+    WriteNode(getStringIndex, *result.second, project, false);
 
     return result;
 }
+
+std::pair<std::unique_ptr<Buffer>, std::unique_ptr<Buffer>>
+BinaryXMLConverter::SerializeCompactProject(const ProjectTreeNode& project)
+{
+    std::pair<std::unique_ptr<Buffer>, std::unique_ptr<Buffer>> result = {
+        std::make_unique<Buffer>(), std::make_unique<Buffer>()
+    };
+
+    std::unordered_map<std::string_view, uint16_t> indices;
+    std::vector<std::string_view> names;
+
+    CollectNames(project, indices, names);
+
+    WriteNames(*result.first, names);
+
+    WriteNode(
+        [&indices](std::string_view name) { return indices.at(name); },
+        *result.second, project, true);
+
+    return result;
+}
+
+void BinaryXMLConverter::VerifyProject(
+    const Buffer& dict, const Buffer& doc, const ProjectTreeNode& project)
+{
+    Buffer document;
+
+    for (const auto& chunk : dict.getChunks())
+        document.append(chunk.Data, chunk.Size);
+
+    for (const auto& chunk : doc.getChunks())
+        document.append(chunk.Data, chunk.Size);
+
+    ProjectTreeComparer comparer(project);
+
+    Parse(document, comparer);
+
+    comparer.finish();
+}
@@ -20,7 +20,17 @@ class BinaryXMLConverter final
 public:
     static void Parse(const Buffer& buffer, XMLHandler& handler);
     static std::unique_ptr<Buffer> ConvertToXML(const Buffer& buffer);
+    static std::unique_ptr<Buffer> ConvertToXML(const ProjectTreeNode& project);
 
     static std::pair<std::unique_ptr<Buffer>, std::unique_ptr<Buffer>>
     SerializeProject(const std::deque<std::string>& names, const ProjectTreeNode& project);
+
+    // Writes only the names used by the project and the smallest field types
+    // that keep the attribute values
+    static std::pair<std::unique_ptr<Buffer>, std::unique_ptr<Buffer>>
+    SerializeCompactProject(const ProjectTreeNode& project);
+
+    // Throws if the serialized project does not parse into the same tree
+    static void VerifyProject(
+        const Buffer& dict, const Buffer& doc, const ProjectTreeNode& project);
 };
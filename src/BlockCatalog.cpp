@@ -0,0 +1,224 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "BlockCatalog.h"
+
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "AudacityDatabase.h"
+#include "ProjectModel.h"
+
+namespace
+{
+struct BlockUsage final
+{
+    uint32_t References { 0 };
+
+    int32_t Track { -1 };
+    int32_t Clip { -1 };
+    int32_t Sequence { -1 };
+
+    uint8_t Flags { 0 };
+};
+
+std::unordered_map<int64_t, BlockUsage>
+CollectBlockUsage(const AudacityProject& project)
+{
+    std::unordered_map<int64_t, BlockUsage> usage;
+
+    for (const auto& track : project.getWaveTracks())
+    {
+        const double rate = track.getSampleRate();
+
+        for (auto clip : track.getClips())
+        {
+            const int64_t firstSample = llrint(clip->getTrimLeft() * rate);
+            const int64_t lastSampleOffset = llrint(clip->getTrimRight() * rate);
+
+            for (auto sequence : *clip)
+            {
+                const int64_t lastSample =
+                    sequence->getNumSamples() - lastSampleOffset;
+
+                for (auto block : *sequence)
+                {
+                    if (block->isSilence())
+                        continue;
+
+                    auto& blockUsage = usage[block->getBlockId()];
+
+                    if (blockUsage.References++ == 0)
+                    {
+                        blockUsage.Track = int32_t(track.getParentIndex());
+                        blockUsage.Clip = int32_t(clip->getParentIndex());
+                        blockUsage.Sequence = int32_t(sequence->getParentIndex());
+                    }
+
+                    const int64_t blockStart = block->getStart();
+                    const int64_t blockEnd = blockStart + block->getLength();
+
+                    if (blockEnd > firstSample && blockStart < lastSample)
+                        blockUsage.Flags |= BlockAudible;
+
+                    if (blockStart < firstSample || blockEnd > lastSample)
+                        blockUsage.Flags |= BlockTrimmed;
+                }
+            }
+        }
+    }
+
+    return usage;
+}
+
+struct CatalogColumns final
+{
+    std::vector<int64_t> BlockId;
+    std::vector<int32_t> Format;
+    std::vector<uint32_t> Length;
+    std::vector<float> SumMin;
+    std::vector<float> SumMax;
+    std::vector<float> SumRms;
+    std::vector<uint32_t> References;
+    std::vector<int32_t> Track;
+    std::vector<int32_t> Clip;
+    std::vector<int32_t> Sequence;
+    std::vector<uint8_t> Flags;
+};
+
+struct ColumnData final
+{
+    const char* Name;
+    BlockCatalogType Type;
+    const void* Data;
+    size_t ValueSize;
+};
+
+template<typename T>
+ColumnData MakeColumn(const char* name, BlockCatalogType type, const std::vector<T>& data)
+{
+    return { name, type, data.data(), sizeof(T) };
+}
+
+uint64_t AlignOffset(uint64_t offset)
+{
+    return (offset + BlockCatalogAlignment - 1) / BlockCatalogAlignment *
+           BlockCatalogAlignment;
+}
+} // namespace
+
+void ExportBlockCatalog(
+    AudacityDatabase& db, const AudacityProject& project,
+    const std::filesystem::path& path)
+{
+    const auto usage = CollectBlockUsage(project);
+
+    CatalogColumns columns;
+
+    SQLite::Statement stmt(
+        db.DB(),
+        "SELECT blockid, sampleformat, length(samples), summin, summax, sumrms FROM sampleblocks ORDER BY blockid;");
+
+    while (stmt.executeStep())
+    {
+        const int64_t blockId = stmt.getColumn(0).getInt64();
+
+        columns.BlockId.push_back(blockId);
+        columns.Format.push_back(stmt.getColumn(1).getInt());
+        columns.Length.push_back(uint32_t(stmt.getColumn(2).getInt64()));
+        columns.SumMin.push_back(float(stmt.getColumn(3).getDouble()));
+        columns.SumMax.push_back(float(stmt.getColumn(4).getDouble()));
+        columns.SumRms.push_back(float(stmt.getColumn(5).getDouble()));
+
+        auto it = usage.find(blockId);
+
+        const BlockUsage blockUsage =
+            it != usage.end() ? it->second : BlockUsage {};
+
+        columns.References.push_back(blockUsage.References);
+        columns.Track.push_back(blockUsage.Track);
+        columns.Clip.push_back(blockUsage.Clip);
+        columns.Sequence.push_back(blockUsage.Sequence);
+        columns.Flags.push_back(blockUsage.Flags);
+    }
+
+    const std::array<ColumnData, 11> columnsData {
+        MakeColumn("blockid", BlockCatalogType::Int64, columns.BlockId),
+        MakeColumn("sampleformat", BlockCatalogType::Int32, columns.Format),
+        MakeColumn("length", BlockCatalogType::UInt32, columns.Length),
+        MakeColumn("summin", BlockCatalogType::Float32, columns.SumMin),
+        MakeColumn("summax", BlockCatalogType::Float32, columns.SumMax),
+        MakeColumn("sumrms", BlockCatalogType::Float32, columns.SumRms),
+        MakeColumn("references", BlockCatalogType::UInt32, columns.References),
+        MakeColumn("track", BlockCatalogType::Int32, columns.Track),
+        MakeColumn("clip", BlockCatalogType::Int32, columns.Clip),
+        MakeColumn("sequence", BlockCatalogType::Int32, columns.Sequence),
+        MakeColumn("flags", BlockCatalogType::UInt8, columns.Flags),
+    };
+
+    const uint64_t rowsCount = columns.BlockId.size();
+
+    BlockCatalogHeader header;
+
+    std::memcpy(header.Magic, BlockCatalogMagic, sizeof(header.Magic));
+    header.ColumnsCount = uint32_t(columnsData.size());
+    header.RowsCount = rowsCount;
+
+    std::vector<BlockCatalogColumn> descriptors;
+
+    uint64_t offset = AlignOffset(
+        sizeof(BlockCatalogHeader) +
+        columnsData.size() * sizeof(BlockCatalogColumn));
+
+    for (const auto& column : columnsData)
+    {
+        BlockCatalogColumn descriptor {};
+
+        std::strncpy(descriptor.Name, column.Name, sizeof(descriptor.Name) - 1);
+        descriptor.Type = column.Type;
+        descriptor.Offset = offset;
+
+        descriptors.push_back(descriptor);
+
+        offset = AlignOffset(offset + rowsCount * column.ValueSize);
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+    if (!file)
+        throw std::runtime_error(
+            fmt::format("Failed to open {} for writing", path.u8string()));
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(
+        reinterpret_cast<const char*>(descriptors.data()),
+        descriptors.size() * sizeof(BlockCatalogColumn));
+
+    static const std::array<char, BlockCatalogAlignment> padding {};
+
+    for (size_t i = 0; i < columnsData.size(); ++i)
+    {
+        const uint64_t position = file.tellp();
+
+        file.write(padding.data(), descriptors[i].Offset - position);
+        file.write(
+            static_cast<const char*>(columnsData[i].Data),
+            rowsCount * columnsData[i].ValueSize);
+    }
+
+    if (!file.flush())
+        throw std::runtime_error(
+            fmt::format("Failed to write {}", path.u8string()));
+
+    fmt::print(
+        "Catalog of {} blocks was written to {}\n", rowsCount, path.u8string());
+}
@@ -0,0 +1,71 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+class AudacityDatabase;
+class AudacityProject;
+
+// Block catalog file.
+//
+// A columnar dump of the sample blocks metadata, one row per sample block,
+// ordered by block id. The file consists of BlockCatalogHeader, ColumnsCount
+// BlockCatalogColumn descriptors and the column data. Every column stores
+// RowsCount values of the descriptor type back to back, starting at an offset
+// aligned to BlockCatalogAlignment. All values use the native (little endian)
+// byte order.
+//
+// Blocks that are not referenced by the project have the track, clip and
+// sequence columns set to -1. Shared blocks reference the first use.
+
+constexpr char BlockCatalogMagic[8] = { 'A', 'U', 'P', '3', 'C', 'T', 'L', 'G' };
+constexpr uint32_t BlockCatalogVersion = 1;
+constexpr uint64_t BlockCatalogAlignment = 16;
+
+enum class BlockCatalogType : uint32_t
+{
+    Int64,
+    Int32,
+    UInt32,
+    Float32,
+    UInt8,
+};
+
+enum BlockCatalogFlags : uint8_t
+{
+    // Some samples of the block are played
+    BlockAudible = 1,
+    // Some samples of the block are hidden by the clip trimming
+    BlockTrimmed = 2,
+};
+
+struct BlockCatalogHeader final
+{
+    char Magic[8];
+    uint32_t Version { BlockCatalogVersion };
+    uint32_t ColumnsCount { 0 };
+    uint64_t RowsCount { 0 };
+    uint64_t Reserved { 0 };
+};
+
+struct BlockCatalogColumn final
+{
+    char Name[16];
+    BlockCatalogType Type;
+    uint32_t Reserved { 0 };
+    uint64_t Offset;
+};
+
+static_assert(sizeof(BlockCatalogHeader) == 32);
+static_assert(sizeof(BlockCatalogColumn) == 32);
+
+// Writes the catalog of all the blocks in the database using a single
+// scan of the sampleblocks table.
+void ExportBlockCatalog(
+    AudacityDatabase& db, const AudacityProject& project,
+    const std::filesystem::path& path);
@@ -0,0 +1,337 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "BlockIdSet.h"
+
+#include <algorithm>
+
+#include "MemoryBudget.h"
+
+int64_t BlockIdSet::const_iterator::operator*() const noexcept
+{
+    return mSet->getBlockId(mIndex);
+}
+
+BlockIdSet::const_iterator& BlockIdSet::const_iterator::operator++() noexcept
+{
+    mIndex = mSet->findNext(mIndex + 1);
+    return *this;
+}
+
+BlockIdSet::const_iterator BlockIdSet::const_iterator::operator++(int) noexcept
+{
+    auto copy = *this;
+    ++(*this);
+    return copy;
+}
+
+bool BlockIdSet::const_iterator::operator==(
+    const const_iterator& rhs) const noexcept
+{
+    return mSet == rhs.mSet && mIndex == rhs.mIndex;
+}
+
+bool BlockIdSet::const_iterator::operator!=(
+    const const_iterator& rhs) const noexcept
+{
+    return !(*this == rhs);
+}
+
+BlockIdSet::const_iterator::const_iterator(
+    const BlockIdSet* set, size_t index) noexcept
+    : mSet(set)
+    , mIndex(index)
+{
+}
+
+BlockIdSet::~BlockIdSet()
+{
+    MemoryBudget::Release(getAccountedSize());
+}
+
+BlockIdSet::BlockIdSet(const BlockIdSet& other)
+    : mNegative(other.mNegative)
+    , mPositive(other.mPositive)
+    , mOutliers(other.mOutliers)
+    , mSize(other.mSize)
+{
+    MemoryBudget::Acquire(getAccountedSize());
+}
+
+BlockIdSet& BlockIdSet::operator=(const BlockIdSet& other)
+{
+    if (this != &other)
+        *this = BlockIdSet(other);
+
+    return *this;
+}
+
+BlockIdSet::BlockIdSet(BlockIdSet&& other) noexcept
+    : mNegative(std::move(other.mNegative))
+    , mPositive(std::move(other.mPositive))
+    , mOutliers(std::move(other.mOutliers))
+    , mSize(other.mSize)
+{
+    other.mNegative.clear();
+    other.mPositive.clear();
+    other.mOutliers.clear();
+    other.mSize = 0;
+}
+
+BlockIdSet& BlockIdSet::operator=(BlockIdSet&& other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    MemoryBudget::Release(getAccountedSize());
+
+    mNegative = std::move(other.mNegative);
+    mPositive = std::move(other.mPositive);
+    mOutliers = std::move(other.mOutliers);
+    mSize = other.mSize;
+
+    other.mNegative.clear();
+    other.mPositive.clear();
+    other.mOutliers.clear();
+    other.mSize = 0;
+
+    return *this;
+}
+
+bool BlockIdSet::emplace(int64_t blockId)
+{
+    if (IsOutlier(blockId))
+        return emplaceOutlier(blockId);
+
+    auto& words = blockId < 0 ? mNegative : mPositive;
+    const uint64_t bit = blockId < 0 ? uint64_t(-(blockId + 1)) : uint64_t(blockId);
+
+    const size_t wordIndex = bit / WordBits;
+    const Word mask = Word(1) << (bit % WordBits);
+
+    if (wordIndex >= words.size())
+        resize(words, wordIndex + 1);
+
+    if (words[wordIndex] & mask)
+        return false;
+
+    words[wordIndex] |= mask;
+    ++mSize;
+
+    return true;
+}
+
+bool BlockIdSet::erase(int64_t blockId) noexcept
+{
+    if (IsOutlier(blockId))
+        return eraseOutlier(blockId);
+
+    auto& words = blockId < 0 ? mNegative : mPositive;
+    const uint64_t bit = blockId < 0 ? uint64_t(-(blockId + 1)) : uint64_t(blockId);
+
+    const size_t wordIndex = bit / WordBits;
+    const Word mask = Word(1) << (bit % WordBits);
+
+    if (wordIndex >= words.size() || (words[wordIndex] & mask) == 0)
+        return false;
+
+    words[wordIndex] &= ~mask;
+    --mSize;
+
+    return true;
+}
+
+size_t BlockIdSet::count(int64_t blockId) const noexcept
+{
+    if (IsOutlier(blockId))
+        return std::binary_search(mOutliers.begin(), mOutliers.end(), blockId);
+
+    const auto& words = blockId < 0 ? mNegative : mPositive;
+    const uint64_t bit = blockId < 0 ? uint64_t(-(blockId + 1)) : uint64_t(blockId);
+
+    const size_t wordIndex = bit / WordBits;
+
+    if (wordIndex >= words.size())
+        return 0;
+
+    return (words[wordIndex] >> (bit % WordBits)) & 1;
+}
+
+size_t BlockIdSet::size() const noexcept
+{
+    return mSize;
+}
+
+bool BlockIdSet::empty() const noexcept
+{
+    return mSize == 0;
+}
+
+void BlockIdSet::clear() noexcept
+{
+    MemoryBudget::Release(getAccountedSize());
+
+    mNegative = {};
+    mPositive = {};
+    mOutliers = {};
+    mSize = 0;
+}
+
+BlockIdSet::const_iterator BlockIdSet::begin() const noexcept
+{
+    return const_iterator(this, findNext(0));
+}
+
+BlockIdSet::const_iterator BlockIdSet::end() const noexcept
+{
+    return const_iterator(this, getBitsCount() + mOutliers.size());
+}
+
+bool BlockIdSet::IsOutlier(int64_t blockId) noexcept
+{
+    return blockId >= MaxBitmapId || blockId < -MaxBitmapId;
+}
+
+void BlockIdSet::resize(std::vector<Word>& words, size_t wordsCount)
+{
+    const size_t oldCapacity = words.capacity();
+
+    // Ids are usually added in the ascending order
+    if (wordsCount > oldCapacity)
+        words.reserve(std::max(wordsCount, oldCapacity * 2));
+
+    words.resize(wordsCount);
+
+    MemoryBudget::Acquire((words.capacity() - oldCapacity) * sizeof(Word));
+}
+
+bool BlockIdSet::emplaceOutlier(int64_t blockId)
+{
+    auto it = std::lower_bound(mOutliers.begin(), mOutliers.end(), blockId);
+
+    if (it != mOutliers.end() && *it == blockId)
+        return false;
+
+    const size_t oldCapacity = mOutliers.capacity();
+
+    mOutliers.insert(it, blockId);
+    ++mSize;
+
+    MemoryBudget::Acquire(
+        (mOutliers.capacity() - oldCapacity) * sizeof(int64_t));
+
+    return true;
+}
+
+bool BlockIdSet::eraseOutlier(int64_t blockId) noexcept
+{
+    auto it = std::lower_bound(mOutliers.begin(), mOutliers.end(), blockId);
+
+    if (it == mOutliers.end() || *it != blockId)
+        return false;
+
+    mOutliers.erase(it);
+    --mSize;
+
+    return true;
+}
+
+size_t BlockIdSet::findNext(size_t index) const noexcept
+{
+    const size_t negativeOutliers = getNegativeOutliersCount();
+
+    if (index < negativeOutliers)
+        return index;
+
+    const size_t bitsCount = getBitsCount();
+
+    if (index < negativeOutliers + bitsCount)
+        return negativeOutliers + findNextBit(index - negativeOutliers);
+
+    return std::min(index, bitsCount + mOutliers.size());
+}
+
+size_t BlockIdSet::findNextBit(size_t index) const noexcept
+{
+    const size_t negativeBits = mNegative.size() * WordBits;
+    const size_t bitsCount = getBitsCount();
+
+    for (; index < negativeBits; ++index)
+    {
+        if (testBit(index))
+            return index;
+    }
+
+    while (index < bitsCount)
+    {
+        const size_t bit = index - negativeBits;
+        const Word word = mPositive[bit / WordBits] >> (bit % WordBits);
+
+        if (word != 0)
+        {
+            size_t offset = 0;
+
+            while (((word >> offset) & 1) == 0)
+                ++offset;
+
+            return index + offset;
+        }
+
+        index += WordBits - bit % WordBits;
+    }
+
+    return bitsCount;
+}
+
+size_t BlockIdSet::getBitsCount() const noexcept
+{
+    return (mNegative.size() + mPositive.size()) * WordBits;
+}
+
+size_t BlockIdSet::getNegativeOutliersCount() const noexcept
+{
+    return std::lower_bound(mOutliers.begin(), mOutliers.end(), 0) -
+           mOutliers.begin();
+}
+
+bool BlockIdSet::testBit(size_t index) const noexcept
+{
+    const size_t negativeBits = mNegative.size() * WordBits;
+
+    if (index < negativeBits)
+    {
+        const size_t bit = negativeBits - index - 1;
+        return (mNegative[bit / WordBits] >> (bit % WordBits)) & 1;
+    }
+
+    const size_t bit = index - negativeBits;
+    return (mPositive[bit / WordBits] >> (bit % WordBits)) & 1;
+}
+
+int64_t BlockIdSet::getBlockId(size_t index) const noexcept
+{
+    const size_t negativeOutliers = getNegativeOutliersCount();
+
+    if (index < negativeOutliers)
+        return mOutliers[index];
+
+    index -= negativeOutliers;
+
+    if (index >= getBitsCount())
+        return mOutliers[negativeOutliers + index - getBitsCount()];
+
+    const size_t negativeBits = mNegative.size() * WordBits;
+
+    if (index < negativeBits)
+        return -int64_t(negativeBits - index);
+
+    return int64_t(index - negativeBits);
+}
+
+size_t BlockIdSet::getAccountedSize() const noexcept
+{
+    return (mNegative.capacity() + mPositive.capacity()) * sizeof(Word) +
+           mOutliers.capacity() * sizeof(int64_t);
+}
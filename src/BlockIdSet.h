@@ -0,0 +1,106 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+// Ordered set of block ids, stored as a bitmap.
+// Block ids are assigned sequentially by SQLite, so the bitmap uses about
+// a bit per block in the project instead of ~40 bytes per std::set node.
+// Ids outside of the bitmap range, e.g. from a corrupted document, are kept
+// in a sorted vector. The memory is accounted against the MemoryBudget.
+class BlockIdSet final
+{
+public:
+    class const_iterator final
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = int64_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const int64_t*;
+        using reference = int64_t;
+
+        int64_t operator*() const noexcept;
+
+        const_iterator& operator++() noexcept;
+        const_iterator operator++(int) noexcept;
+
+        bool operator==(const const_iterator& rhs) const noexcept;
+        bool operator!=(const const_iterator& rhs) const noexcept;
+
+    private:
+        const_iterator(const BlockIdSet* set, size_t index) noexcept;
+
+        const BlockIdSet* mSet;
+        // Index in the negative outliers, followed by the negative bitmap,
+        // the positive bitmap and the positive outliers
+        size_t mIndex;
+
+        friend class BlockIdSet;
+    };
+
+    BlockIdSet() = default;
+    ~BlockIdSet();
+
+    BlockIdSet(const BlockIdSet& other);
+    BlockIdSet& operator=(const BlockIdSet& other);
+
+    BlockIdSet(BlockIdSet&& other) noexcept;
+    BlockIdSet& operator=(BlockIdSet&& other) noexcept;
+
+    // Returns true if the id was not in the set
+    bool emplace(int64_t blockId);
+    bool erase(int64_t blockId) noexcept;
+
+    size_t count(int64_t blockId) const noexcept;
+
+    size_t size() const noexcept;
+    bool empty() const noexcept;
+
+    void clear() noexcept;
+
+    const_iterator begin() const noexcept;
+    const_iterator end() const noexcept;
+
+private:
+    using Word = uint64_t;
+    static constexpr size_t WordBits = 64;
+
+    // Up to 32 MiB for each of the bitmaps
+    static constexpr int64_t MaxBitmapId = int64_t(1) << 28;
+
+    static bool IsOutlier(int64_t blockId) noexcept;
+
+    void resize(std::vector<Word>& words, size_t wordsCount);
+
+    bool emplaceOutlier(int64_t blockId);
+    bool eraseOutlier(int64_t blockId) noexcept;
+
+    // Returns the index of the first value starting from index
+    size_t findNext(size_t index) const noexcept;
+    // Returns the index of the first set bit starting from index
+    size_t findNextBit(size_t index) const noexcept;
+    size_t getBitsCount() const noexcept;
+    size_t getNegativeOutliersCount() const noexcept;
+    bool testBit(size_t index) const noexcept;
+    int64_t getBlockId(size_t index) const noexcept;
+
+    size_t getAccountedSize() const noexcept;
+
+    // Block id -k is stored as the bit k - 1 of mNegative. Projects
+    // normally have no negative ids besides the silence, so it stays empty.
+    std::vector<Word> mNegative;
+    std::vector<Word> mPositive;
+
+    // Sorted ids, that do not fit the bitmaps
+    std::vector<int64_t> mOutliers;
+
+    size_t mSize { 0 };
+};
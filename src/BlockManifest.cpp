@@ -0,0 +1,75 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "BlockManifest.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+BlockManifest ReadBlockManifest(const std::filesystem::path& path)
+{
+    BlockManifest manifest;
+
+    if (!std::filesystem::exists(path))
+        return manifest;
+
+    std::ifstream file(path, std::ios::binary);
+
+    BlockManifestHeader header;
+
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        throw std::runtime_error(
+            fmt::format("Failed to read {}", path.u8string()));
+
+    if (
+        std::memcmp(header.Magic, BlockManifestMagic, sizeof(header.Magic)) != 0 ||
+        header.Version != BlockManifestVersion ||
+        header.EntrySize != sizeof(BlockManifestEntry))
+        throw std::runtime_error(
+            fmt::format("{} is not a supported manifest", path.u8string()));
+
+    manifest.RunsCount = header.RunsCount;
+    manifest.Entries.resize(header.EntriesCount);
+
+    if (!file.read(
+            reinterpret_cast<char*>(manifest.Entries.data()),
+            manifest.Entries.size() * sizeof(BlockManifestEntry)))
+        throw std::runtime_error(
+            fmt::format("{} is truncated", path.u8string()));
+
+    return manifest;
+}
+
+void WriteBlockManifest(
+    const std::filesystem::path& path, const BlockManifest& manifest)
+{
+    auto tempPath = path;
+    tempPath += ".tmp";
+
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+
+        BlockManifestHeader header;
+
+        std::memcpy(header.Magic, BlockManifestMagic, sizeof(header.Magic));
+        header.EntrySize = sizeof(BlockManifestEntry);
+        header.RunsCount = manifest.RunsCount;
+        header.EntriesCount = manifest.Entries.size();
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(
+            reinterpret_cast<const char*>(manifest.Entries.data()),
+            manifest.Entries.size() * sizeof(BlockManifestEntry));
+
+        if (!file.flush())
+            throw std::runtime_error(
+                fmt::format("Failed to write {}", tempPath.u8string()));
+    }
+
+    std::filesystem::rename(tempPath, path);
+}
@@ -0,0 +1,53 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Sidecar file with the hashes of the verified sample blocks.
+//
+// The file consists of BlockManifestHeader followed by EntriesCount
+// BlockManifestEntry records, sorted by the block id. All values use the
+// native (little endian) byte order.
+
+constexpr char BlockManifestMagic[8] = { 'A', 'U', 'P', '3', 'M', 'N', 'F', 'T' };
+constexpr uint32_t BlockManifestVersion = 1;
+
+struct BlockManifestHeader final
+{
+    char Magic[8];
+    uint32_t Version { BlockManifestVersion };
+    uint32_t EntrySize;
+    // Number of the verification passes, used to rotate the sampling
+    uint64_t RunsCount { 0 };
+    uint64_t EntriesCount { 0 };
+};
+
+struct BlockManifestEntry final
+{
+    int64_t BlockId;
+    int32_t SampleFormat;
+    uint32_t Reserved { 0 };
+    uint64_t Length;
+    uint64_t Hash;
+};
+
+static_assert(sizeof(BlockManifestHeader) == 32);
+static_assert(sizeof(BlockManifestEntry) == 32);
+
+struct BlockManifest final
+{
+    uint64_t RunsCount { 0 };
+    std::vector<BlockManifestEntry> Entries;
+};
+
+// Returns an empty manifest if the file does not exist
+BlockManifest ReadBlockManifest(const std::filesystem::path& path);
+// Manifest is written to a temporary file first and then renamed
+void WriteBlockManifest(
+    const std::filesystem::path& path, const BlockManifest& manifest);
@@ -8,19 +8,190 @@
 
 #include <algorithm>
 #include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+#ifdef _WIN32
+#   define SeekFile _fseeki64
+#else
+#   define SeekFile fseeko
+#endif
+
+namespace
+{
+constexpr size_t GeometricChunksCount = 8;
+constexpr size_t GeometricChunksSize =
+    Buffer::MIN_CHUNK_SIZE * ((size_t(1) << GeometricChunksCount) - 1);
+
+static_assert(
+    (Buffer::MIN_CHUNK_SIZE << GeometricChunksCount) == Buffer::BUFFER_SIZE);
+
+// Free chunks are kept per size class. The pooled chunks stay accounted
+// against the MemoryBudget.
+class ChunkPool final
+{
+public:
+    static constexpr size_t SizeClassesCount = GeometricChunksCount + 1;
+    static constexpr size_t PoolCapacity = 64 * 1024 * 1024;
+
+    static ChunkPool& Get()
+    {
+        static ChunkPool pool;
+        return pool;
+    }
+
+    ~ChunkPool()
+    {
+        trim();
+    }
+
+    uint8_t* allocate(size_t sizeClass)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            auto& freeChunks = mFreeChunks[sizeClass];
+
+            if (!freeChunks.empty())
+            {
+                auto chunk = freeChunks.back();
+                freeChunks.pop_back();
+
+                mPooledSize -= GetClassSize(sizeClass);
+
+                return chunk;
+            }
+        }
+
+        const size_t size = GetClassSize(sizeClass);
+
+        if (!MemoryBudget::TryAcquire(size))
+        {
+            // Pooled chunks of other sizes may be the reason
+            trim();
+
+            if (!MemoryBudget::TryAcquire(size))
+                return nullptr;
+        }
+
+        return new uint8_t[size];
+    }
+
+    void release(uint8_t* chunk, size_t sizeClass) noexcept
+    {
+        const size_t size = GetClassSize(sizeClass);
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            if (mPooledSize + size <= PoolCapacity)
+            {
+                try
+                {
+                    mFreeChunks[sizeClass].push_back(chunk);
+                    mPooledSize += size;
+                    return;
+                }
+                catch (...)
+                {
+                }
+            }
+        }
+
+        delete[] chunk;
+        MemoryBudget::Release(size);
+    }
+
+    void trim() noexcept
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        for (size_t sizeClass = 0; sizeClass < SizeClassesCount; ++sizeClass)
+        {
+            for (auto chunk : mFreeChunks[sizeClass])
+                delete[] chunk;
+
+            MemoryBudget::Release(
+                mFreeChunks[sizeClass].size() * GetClassSize(sizeClass));
+
+            mFreeChunks[sizeClass].clear();
+        }
+
+        mPooledSize = 0;
+    }
+
+    static size_t GetSizeClass(size_t chunkIndex) noexcept
+    {
+        return std::min(chunkIndex, GeometricChunksCount);
+    }
+
+private:
+    static size_t GetClassSize(size_t sizeClass) noexcept
+    {
+        return Buffer::MIN_CHUNK_SIZE << sizeClass;
+    }
+
+    std::mutex mMutex;
+    std::array<std::vector<uint8_t*>, SizeClassesCount> mFreeChunks;
+    size_t mPooledSize { 0 };
+};
+} // namespace
+
+Buffer::~Buffer()
+{
+    reset();
+}
+
+Buffer::Buffer(Buffer&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+Buffer& Buffer::operator=(Buffer&& other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    reset();
+
+    mChunks = std::move(other.mChunks);
+    mLastChunkOffset = other.mLastChunkOffset;
+    mSpillFile = std::move(other.mSpillFile);
+    mSpilledSize = other.mSpilledSize;
+    mSpillFileOffset = other.mSpillFileOffset;
+    mSpillFileWriting = other.mSpillFileWriting;
+
+    other.mChunks.clear();
+    other.mLastChunkOffset = 0;
+    other.mSpilledSize = 0;
+
+    return *this;
+}
 
 void Buffer::reset()
 {
-    mChunks.clear();
-    mLastChunkOffset = {};
+    releaseChunks();
+
+    mSpillFile.reset();
+    mSpilledSize = 0;
+    mSpillFileOffset = 0;
+    mSpillFileWriting = false;
 }
 
 size_t Buffer::getSize() const noexcept
 {
+    if (mSpillFile != nullptr)
+        return mSpilledSize;
+
     if (mChunks.empty())
         return 0;
 
-    return (mChunks.size() - 1) * BUFFER_SIZE + mLastChunkOffset;
+    return GetChunkStart(mChunks.size() - 1) + mLastChunkOffset;
+}
+
+bool Buffer::isSpilled() const noexcept
+{
+    return mSpillFile != nullptr;
 }
 
 bool Buffer::append(const void* data, size_t size)
@@ -30,17 +201,29 @@ bool Buffer::append(const void* data, size_t size)
 
     const uint8_t* dataPtr = static_cast<const uint8_t*>(data);
 
-    while (size > 0)
+    while (size > 0 && mSpillFile == nullptr)
     {
-        if (mChunks.empty() || mLastChunkOffset == BUFFER_SIZE)
+        if (mChunks.empty() || mLastChunkOffset == mChunks.back().Size)
         {
-            mChunks.emplace_back();
+            const size_t chunkIndex = mChunks.size();
+
+            auto data = ChunkPool::Get().allocate(
+                ChunkPool::GetSizeClass(chunkIndex));
+
+            if (data == nullptr)
+            {
+                spill();
+                break;
+            }
+
+            mChunks.push_back({ data, GetChunkSize(chunkIndex) });
             mLastChunkOffset = 0;
         }
 
-        const size_t chunkSize = std::min(BUFFER_SIZE - mLastChunkOffset, size);
+        const size_t chunkSize =
+            std::min(mChunks.back().Size - mLastChunkOffset, size);
 
-        void* ptr = mChunks.back().data() + mLastChunkOffset;
+        void* ptr = mChunks.back().Data + mLastChunkOffset;
 
         std::memcpy(ptr, dataPtr, chunkSize);
 
@@ -49,6 +232,24 @@ bool Buffer::append(const void* data, size_t size)
         size -= chunkSize;
     }
 
+    if (size == 0)
+        return true;
+
+    // Switching from reading to writing requires a seek
+    if (!mSpillFileWriting || mSpillFileOffset != mSpilledSize)
+    {
+        if (0 != SeekFile(mSpillFile.get(), mSpilledSize, SEEK_SET))
+            throw std::runtime_error("Failed to seek the spill file");
+
+        mSpillFileWriting = true;
+    }
+
+    if (size != fwrite(dataPtr, 1, size, mSpillFile.get()))
+        throw std::runtime_error("Failed to write the spill file");
+
+    mSpilledSize += size;
+    mSpillFileOffset = mSpilledSize;
+
     return true;
 }
 
@@ -66,26 +267,43 @@ Buffer::read(void* data, size_t offset, size_t size) const noexcept
     if (offset + size > bufferSize)
         size = bufferSize - offset;
 
+    if (mSpillFile != nullptr)
+    {
+        if (mSpillFileWriting || mSpillFileOffset != offset)
+        {
+            if (0 != SeekFile(mSpillFile.get(), offset, SEEK_SET))
+                return {};
+
+            mSpillFileWriting = false;
+        }
+
+        const size_t bytesRead = fread(data, 1, size, mSpillFile.get());
+
+        mSpillFileOffset = offset + bytesRead;
+
+        return bytesRead;
+    }
+
     uint8_t* outPtr = static_cast<uint8_t*>(data);
 
     size_t bytesLeft = size;
 
-    const size_t chunkIndex = offset / BUFFER_SIZE;
-    offset = offset - BUFFER_SIZE * chunkIndex;
+    const size_t chunkIndex = GetChunkIndex(offset);
+    offset = offset - GetChunkStart(chunkIndex);
 
-    auto chunk = mChunks.begin();
-    std::advance(chunk, chunkIndex);
+    auto chunk = mChunks.begin() + chunkIndex;
 
     while (bytesLeft > 0)
     {
-        const size_t chunkSize = std::min(BUFFER_SIZE - offset, bytesLeft);
-        const uint8_t* inPtr = chunk->data() + offset;
+        const size_t chunkSize = std::min(chunk->Size - offset, bytesLeft);
+        const uint8_t* inPtr = chunk->Data + offset;
 
         std::memcpy(outPtr, inPtr, chunkSize);
 
         offset = 0;
         bytesLeft -= chunkSize;
         outPtr += chunkSize;
+        ++chunk;
     }
 
     return size;
@@ -93,6 +311,13 @@ Buffer::read(void* data, size_t offset, size_t size) const noexcept
 
 std::vector<uint8_t> Buffer::getLinearRepresentation() const
 {
+    if (mSpillFile != nullptr)
+    {
+        std::vector<uint8_t> result(mSpilledSize);
+        read(result.data(), 0, result.size());
+        return result;
+    }
+
     size_t bytesLeft = getSize();
 
     std::vector<uint8_t> result;
@@ -100,12 +325,264 @@ std::vector<uint8_t> Buffer::getLinearRepresentation() const
 
     for (const auto& chunk : mChunks)
     {
-        const size_t chunkSize = std::min(BUFFER_SIZE, bytesLeft);
+        const size_t chunkSize = std::min(chunk.Size, bytesLeft);
 
-        result.insert(result.end(), chunk.begin(), chunk.begin() + chunkSize);
+        result.insert(result.end(), chunk.Data, chunk.Data + chunkSize);
 
         bytesLeft -= chunkSize;
     }
 
     return result;
 }
+
+void Buffer::spill()
+{
+    const size_t size = getSize();
+
+    mSpillFile = MemoryBudget::CreateSpillFile();
+
+    size_t bytesLeft = size;
+
+    for (const auto& chunk : mChunks)
+    {
+        const size_t chunkSize = std::min(chunk.Size, bytesLeft);
+
+        if (chunkSize != fwrite(chunk.Data, 1, chunkSize, mSpillFile.get()))
+            throw std::runtime_error("Failed to write the spill file");
+
+        bytesLeft -= chunkSize;
+    }
+
+    mSpilledSize = size;
+
+    releaseChunks();
+
+    mSpillFileOffset = mSpilledSize;
+    mSpillFileWriting = true;
+}
+
+void Buffer::releaseChunks() noexcept
+{
+    auto& pool = ChunkPool::Get();
+
+    for (size_t i = 0; i < mChunks.size(); ++i)
+        pool.release(mChunks[i].Data, ChunkPool::GetSizeClass(i));
+
+    mChunks.clear();
+    mLastChunkOffset = 0;
+}
+
+size_t Buffer::GetChunkSize(size_t chunkIndex) noexcept
+{
+    return MIN_CHUNK_SIZE << std::min(chunkIndex, GeometricChunksCount);
+}
+
+size_t Buffer::GetChunkStart(size_t chunkIndex) noexcept
+{
+    if (chunkIndex < GeometricChunksCount)
+        return MIN_CHUNK_SIZE * ((size_t(1) << chunkIndex) - 1);
+
+    return GeometricChunksSize +
+           (chunkIndex - GeometricChunksCount) * BUFFER_SIZE;
+}
+
+size_t Buffer::GetChunkIndex(size_t offset) noexcept
+{
+    if (offset >= GeometricChunksSize)
+        return GeometricChunksCount +
+               (offset - GeometricChunksSize) / BUFFER_SIZE;
+
+    // Chunk i starts at MIN_CHUNK_SIZE * (2^i - 1)
+    size_t chunkIndex = 0;
+
+    for (size_t blocks = offset / MIN_CHUNK_SIZE + 1; blocks > 1; blocks >>= 1)
+        ++chunkIndex;
+
+    return chunkIndex;
+}
+
+Buffer::ChunksView Buffer::getChunks() const
+{
+    return ChunksView(*this);
+}
+
+size_t Buffer::writeTo(FILE* file) const
+{
+    size_t bytesWritten = 0;
+
+    for (const auto& chunk : getChunks())
+    {
+        const size_t chunkBytesWritten =
+            fwrite(chunk.Data, 1, chunk.Size, file);
+
+        bytesWritten += chunkBytesWritten;
+
+        if (chunkBytesWritten != chunk.Size)
+            break;
+    }
+
+    return bytesWritten;
+}
+
+Buffer::ChunksView::ChunksView(const Buffer& buffer)
+    : mBuffer(buffer)
+{
+}
+
+Buffer::ChunksView::const_iterator Buffer::ChunksView::begin() const
+{
+    return const_iterator(this, 0);
+}
+
+Buffer::ChunksView::const_iterator Buffer::ChunksView::end() const
+{
+    return const_iterator(this, mBuffer.getSize());
+}
+
+Buffer::ChunksView::const_iterator::const_iterator(
+    const ChunksView* view, size_t offset)
+    : mView(view)
+    , mOffset(offset)
+{
+    const auto& buffer = mView->mBuffer;
+    const size_t size = buffer.getSize();
+
+    if (mOffset >= size)
+        return;
+
+    if (buffer.mSpillFile != nullptr)
+    {
+        auto& scratch = mView->mScratch;
+        scratch.resize(std::min(BUFFER_SIZE, size - mOffset));
+
+        mChunk = { scratch.data(),
+                   buffer.read(scratch.data(), mOffset, scratch.size()) };
+    }
+    else
+    {
+        mChunkIndex = GetChunkIndex(mOffset);
+
+        const auto& chunk = buffer.mChunks[mChunkIndex];
+        const size_t chunkOffset = mOffset - GetChunkStart(mChunkIndex);
+
+        mChunk = { chunk.Data + chunkOffset,
+                   std::min(chunk.Size - chunkOffset, size - mOffset) };
+    }
+}
+
+const BufferChunk&
+Buffer::ChunksView::const_iterator::operator*() const noexcept
+{
+    return mChunk;
+}
+
+const BufferChunk*
+Buffer::ChunksView::const_iterator::operator->() const noexcept
+{
+    return &mChunk;
+}
+
+Buffer::ChunksView::const_iterator&
+Buffer::ChunksView::const_iterator::operator++()
+{
+    // A failed read of the spill file ends the iteration
+    if (mChunk.Size == 0)
+        mOffset = mView->mBuffer.getSize();
+
+    *this = const_iterator(mView, mOffset + mChunk.Size);
+
+    return *this;
+}
+
+bool Buffer::ChunksView::const_iterator::operator==(
+    const const_iterator& rhs) const noexcept
+{
+    return mView == rhs.mView && mOffset == rhs.mOffset;
+}
+
+bool Buffer::ChunksView::const_iterator::operator!=(
+    const const_iterator& rhs) const noexcept
+{
+    return !(*this == rhs);
+}
+
+BufferCursor::BufferCursor(const Buffer& buffer, size_t offset) noexcept
+    : mBuffer(buffer)
+    , mOffset(std::min(offset, buffer.getSize()))
+    , mChunkIndex(Buffer::GetChunkIndex(mOffset))
+    , mChunkOffset(mOffset - Buffer::GetChunkStart(mChunkIndex))
+{
+}
+
+size_t BufferCursor::getOffset() const noexcept
+{
+    return mOffset;
+}
+
+size_t BufferCursor::getBytesLeft() const noexcept
+{
+    const size_t size = mBuffer.getSize();
+    return mOffset < size ? size - mOffset : 0;
+}
+
+size_t BufferCursor::read(void* data, size_t size) noexcept
+{
+    size = std::min(size, getBytesLeft());
+
+    if (mBuffer.mSpillFile != nullptr)
+    {
+        size = mBuffer.read(data, mOffset, size);
+        advance(size);
+
+        return size;
+    }
+
+    uint8_t* outPtr = static_cast<uint8_t*>(data);
+    size_t bytesLeft = size;
+
+    while (bytesLeft > 0)
+    {
+        const size_t chunkSize =
+            std::min(getChunkSize() - mChunkOffset, bytesLeft);
+
+        std::memcpy(
+            outPtr, mBuffer.mChunks[mChunkIndex].Data + mChunkOffset,
+            chunkSize);
+
+        advance(chunkSize);
+
+        outPtr += chunkSize;
+        bytesLeft -= chunkSize;
+    }
+
+    return size;
+}
+
+bool BufferCursor::skip(size_t size) noexcept
+{
+    if (size > getBytesLeft())
+        return false;
+
+    advance(size);
+
+    return true;
+}
+
+size_t BufferCursor::getChunkSize() const noexcept
+{
+    return Buffer::GetChunkSize(mChunkIndex);
+}
+
+void BufferCursor::advance(size_t size) noexcept
+{
+    size = std::min(size, getBytesLeft());
+
+    mOffset += size;
+    mChunkOffset += size;
+
+    if (mChunkOffset < getChunkSize())
+        return;
+
+    mChunkIndex = Buffer::GetChunkIndex(mOffset);
+    mChunkOffset = mOffset - Buffer::GetChunkStart(mChunkIndex);
+}
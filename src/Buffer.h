@@ -5,31 +5,107 @@
 
 #pragma once
 
-#include <deque>
 #include <array>
 #include <cstdint>
+#include <cstring>
+#include <iterator>
 #include <type_traits>
 #include <vector>
 #include <cstddef>
 
+#include "MemoryBudget.h"
+
+// Contiguous part of the Buffer data
+struct BufferChunk final
+{
+    const uint8_t* Data;
+    size_t Size;
+};
+
+class BufferCursor;
+
+// Chunks grow geometrically from MIN_CHUNK_SIZE up to BUFFER_SIZE and are
+// taken from a process wide pool, so short lived buffers are cheap.
+// Chunks are accounted against the MemoryBudget. Once the budget is
+// exhausted, the buffer moves its data into a spill file and keeps
+// appending there. Reading the spilled buffer is not thread safe.
 class Buffer final
 {
 public:
+    // Iterates the data chunk by chunk without copying. Spilled data is
+    // read into the view scratch storage, so a chunk is only valid until
+    // the iterator is advanced.
+    class ChunksView final
+    {
+    public:
+        class const_iterator final
+        {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = BufferChunk;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const BufferChunk*;
+            using reference = const BufferChunk&;
+
+            const BufferChunk& operator*() const noexcept;
+            const BufferChunk* operator->() const noexcept;
+
+            const_iterator& operator++();
+
+            bool operator==(const const_iterator& rhs) const noexcept;
+            bool operator!=(const const_iterator& rhs) const noexcept;
+
+        private:
+            const_iterator(const ChunksView* view, size_t offset);
+
+            const ChunksView* mView;
+            size_t mOffset;
+            size_t mChunkIndex { 0 };
+            BufferChunk mChunk { nullptr, 0 };
+
+            friend class ChunksView;
+        };
+
+        const_iterator begin() const;
+        const_iterator end() const;
+
+    private:
+        explicit ChunksView(const Buffer& buffer);
+
+        const Buffer& mBuffer;
+        mutable std::vector<uint8_t> mScratch;
+
+        friend class Buffer;
+    };
+
+
+    static constexpr size_t MIN_CHUNK_SIZE = 4 * 1024;
     static constexpr size_t BUFFER_SIZE = 1024 * 1024;
 
+    Buffer() = default;
+    ~Buffer();
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    Buffer(Buffer&& other) noexcept;
+    Buffer& operator=(Buffer&& other) noexcept;
+
     void reset();
 
     size_t getSize() const noexcept;
 
+    bool isSpilled() const noexcept;
+
     template<typename T>
     std::enable_if_t<std::is_trivial_v<T>, bool> append(T data)
     {
         constexpr auto size = sizeof(T);
 
-        if (mChunks.empty() || (BUFFER_SIZE - mLastChunkOffset) < size)
+        if (mChunks.empty() || (mChunks.back().Size - mLastChunkOffset) < size)
             return append(&data, size);
 
-        void* ptr = mChunks.back().data() + mLastChunkOffset;
+        void* ptr = mChunks.back().Data + mLastChunkOffset;
 
         *static_cast<T*>(ptr) = data;
         mLastChunkOffset += size;
@@ -47,13 +123,16 @@ public:
         if (getSize() < (offset + size))
             return 0;
 
-        const size_t chunkIndex = offset / BUFFER_SIZE;
-        offset = offset - BUFFER_SIZE * chunkIndex;
+        if (mSpillFile != nullptr)
+            return read(&data, offset, size);
+
+        const size_t chunkIndex = GetChunkIndex(offset);
+        const size_t chunkOffset = offset - GetChunkStart(chunkIndex);
 
-        if (BUFFER_SIZE < (offset + size))
+        if (mChunks[chunkIndex].Size < (chunkOffset + size))
             return read(&data, offset, size);
 
-        const void* ptr = mChunks[chunkIndex].data() + offset;
+        const void* ptr = mChunks[chunkIndex].Data + chunkOffset;
 
         data = *static_cast<const T*>(ptr);
 
@@ -64,10 +143,78 @@ public:
 
     std::vector<uint8_t> getLinearRepresentation() const;
 
+    ChunksView getChunks() const;
+
+    // Writes the data chunk by chunk, returns the number of bytes written
+    size_t writeTo(FILE* file) const;
+
+    static size_t GetChunkSize(size_t chunkIndex) noexcept;
+    static size_t GetChunkStart(size_t chunkIndex) noexcept;
+    static size_t GetChunkIndex(size_t offset) noexcept;
+
 private:
-    using Chunk = std::array<uint8_t, BUFFER_SIZE>;
-    using ChunkList = std::deque<Chunk>;
+    struct Chunk final
+    {
+        uint8_t* Data;
+        size_t Size;
+    };
 
-    ChunkList mChunks;
+    void spill();
+    void releaseChunks() noexcept;
+
+    friend class BufferCursor;
+
+    std::vector<Chunk> mChunks;
     size_t mLastChunkOffset { 0 };
+
+    MemoryBudget::FilePtr mSpillFile { nullptr, fclose };
+    size_t mSpilledSize { 0 };
+    // Position of the spill file, the stream is repositioned only when needed
+    mutable size_t mSpillFileOffset { 0 };
+    mutable bool mSpillFileWriting { false };
+};
+
+// Sequential reader, that keeps the position of the current chunk
+class BufferCursor final
+{
+public:
+    explicit BufferCursor(const Buffer& buffer, size_t offset = 0) noexcept;
+
+    size_t getOffset() const noexcept;
+    size_t getBytesLeft() const noexcept;
+
+    template<typename T>
+    std::enable_if_t<std::is_trivial_v<T>, bool> read(T& data) noexcept
+    {
+        constexpr auto size = sizeof(T);
+
+        // The last chunk is only partially filled
+        if (mBuffer.mSpillFile == nullptr && size <= getBytesLeft() &&
+            mChunkIndex < mBuffer.mChunks.size() &&
+            mChunkOffset + size <= getChunkSize())
+        {
+            std::memcpy(
+                &data, mBuffer.mChunks[mChunkIndex].Data + mChunkOffset, size);
+            advance(size);
+
+            return true;
+        }
+
+        return size == read(&data, size);
+    }
+
+    // Returns the number of bytes read
+    size_t read(void* data, size_t size) noexcept;
+    // Returns false if there is less than size bytes left
+    bool skip(size_t size) noexcept;
+
+private:
+    size_t getChunkSize() const noexcept;
+    void advance(size_t size) noexcept;
+
+    const Buffer& mBuffer;
+
+    size_t mOffset;
+    size_t mChunkIndex;
+    size_t mChunkOffset;
 };
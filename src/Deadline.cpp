@@ -0,0 +1,74 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "Deadline.h"
+
+#include <atomic>
+#include <mutex>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+#include <sqlite3.h>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+// Number of the virtual machine instructions between the deadline checks
+constexpr int QueryCheckPeriod = 10000;
+
+std::atomic<bool> DeadlineSet { false };
+std::atomic<Clock::rep> ExpirationTime { 0 };
+
+std::mutex PartialResultsMutex;
+std::vector<std::string> PartialResults;
+
+int QueryProgressHandler(void*)
+{
+    return Deadline::IsExpired() ? 1 : 0;
+}
+} // namespace
+
+void Deadline::Set(std::chrono::seconds timeout) noexcept
+{
+    ExpirationTime = (Clock::now() + timeout).time_since_epoch().count();
+    DeadlineSet = timeout.count() > 0;
+}
+
+bool Deadline::IsSet() noexcept
+{
+    return DeadlineSet;
+}
+
+bool Deadline::IsExpired() noexcept
+{
+    return DeadlineSet &&
+           Clock::now().time_since_epoch().count() >= ExpirationTime;
+}
+
+void Deadline::ReportPartial(std::string description)
+{
+    std::lock_guard<std::mutex> lock(PartialResultsMutex);
+    PartialResults.push_back(std::move(description));
+}
+
+std::vector<std::string> Deadline::GetPartialResults()
+{
+    std::lock_guard<std::mutex> lock(PartialResultsMutex);
+    return PartialResults;
+}
+
+Deadline::QueryInterruptGuard::QueryInterruptGuard(SQLite::Database& db) noexcept
+    : mDatabase(db)
+{
+    if (IsSet())
+        sqlite3_progress_handler(
+            mDatabase.getHandle(), QueryCheckPeriod, QueryProgressHandler,
+            nullptr);
+}
+
+Deadline::QueryInterruptGuard::~QueryInterruptGuard()
+{
+    sqlite3_progress_handler(mDatabase.getHandle(), 0, nullptr, nullptr);
+}
@@ -0,0 +1,47 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace SQLite
+{
+class Database;
+}
+
+// Process wide deadline for the long running operations.
+// Operations check the deadline between the units of work. Once it has
+// expired, they stop at a consistent state and describe the unfinished
+// work using ReportPartial.
+class Deadline final
+{
+public:
+    // Starts counting from now. Zero timeout means no deadline
+    static void Set(std::chrono::seconds timeout) noexcept;
+
+    static bool IsSet() noexcept;
+    static bool IsExpired() noexcept;
+
+    static void ReportPartial(std::string description);
+    static std::vector<std::string> GetPartialResults();
+
+    // Makes the queries on db fail with SQLITE_INTERRUPT once the deadline
+    // has expired, until the returned guard is destroyed
+    class QueryInterruptGuard final
+    {
+    public:
+        explicit QueryInterruptGuard(SQLite::Database& db) noexcept;
+        ~QueryInterruptGuard();
+
+        QueryInterruptGuard(const QueryInterruptGuard&) = delete;
+        QueryInterruptGuard& operator=(const QueryInterruptGuard&) = delete;
+
+    private:
+        SQLite::Database& mDatabase;
+    };
+};
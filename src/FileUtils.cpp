@@ -0,0 +1,19 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "FileUtils.h"
+
+#include <cstring>
+#include <string>
+
+FILE* OpenFile(const std::filesystem::path& path, const char* mode)
+{
+#ifdef _WIN32
+    const std::wstring wideMode(mode, mode + std::strlen(mode));
+    return _wfopen(path.native().c_str(), wideMode.c_str());
+#else
+    return fopen(path.native().c_str(), mode);
+#endif
+}
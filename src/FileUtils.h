@@ -0,0 +1,13 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <filesystem>
+
+// fopen, that uses the wide path on Windows, so the paths with non ASCII
+// characters can be opened
+FILE* OpenFile(const std::filesystem::path& path, const char* mode);
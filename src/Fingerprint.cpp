@@ -0,0 +1,774 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "Fingerprint.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include <fmt/format.h>
+
+#include "AudacityDatabase.h"
+#include "ProjectModel.h"
+#include "SampleFormat.h"
+
+namespace
+{
+constexpr double Pi = 3.14159265358979323846;
+
+constexpr size_t BandsCount = 33;
+constexpr double MinBandFrequency = 300.0;
+constexpr double MaxBandFrequency = 2000.0;
+
+// Only every IndexStride-th sub-fingerprint is stored, queries use all of them
+constexpr size_t IndexStride = 4;
+
+// Queries also look up the variants with these bits flipped
+constexpr size_t WeakBitsCount = 4;
+
+constexpr size_t MinMatchesCount = 8;
+constexpr size_t MaxResultsCount = 10;
+
+// Radix-2 FFT of FingerprintFrameSize points. Real and imaginary parts are
+// kept in separate arrays and every stage has contiguous twiddles,
+// so the butterfly loops are vectorized by the compiler.
+class FrameSpectrum final
+{
+public:
+    FrameSpectrum()
+        : mBitReversed(FingerprintFrameSize)
+        , mTwiddlesRe(FingerprintFrameSize)
+        , mTwiddlesIm(FingerprintFrameSize)
+        , mWindow(FingerprintFrameSize)
+        , mRe(FingerprintFrameSize)
+        , mIm(FingerprintFrameSize)
+    {
+        constexpr size_t size = FingerprintFrameSize;
+
+        size_t bits = 0;
+
+        while ((size_t(1) << bits) < size)
+            ++bits;
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            size_t reversed = 0;
+
+            for (size_t bit = 0; bit < bits; ++bit)
+                reversed |= ((i >> bit) & 1) << (bits - 1 - bit);
+
+            mBitReversed[i] = uint32_t(reversed);
+        }
+
+        // Twiddles of the stage with half size h start at h - 1
+        for (size_t half = 1; half < size; half *= 2)
+        {
+            for (size_t j = 0; j < half; ++j)
+            {
+                const double angle = -Pi * j / half;
+
+                mTwiddlesRe[half - 1 + j] = float(std::cos(angle));
+                mTwiddlesIm[half - 1 + j] = float(std::sin(angle));
+            }
+        }
+
+        for (size_t i = 0; i < size; ++i)
+            mWindow[i] = float(0.5 - 0.5 * std::cos(2.0 * Pi * i / (size - 1)));
+    }
+
+    // Writes FingerprintFrameSize / 2 + 1 power values
+    void compute(const float* samples, float* power)
+    {
+        constexpr size_t size = FingerprintFrameSize;
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            mRe[mBitReversed[i]] = samples[i] * mWindow[i];
+            mIm[i] = 0.0f;
+        }
+
+        float* re = mRe.data();
+        float* im = mIm.data();
+
+        for (size_t half = 1; half < size; half *= 2)
+        {
+            const float* twRe = mTwiddlesRe.data() + half - 1;
+            const float* twIm = mTwiddlesIm.data() + half - 1;
+
+            for (size_t start = 0; start < size; start += 2 * half)
+            {
+                float* aRe = re + start;
+                float* aIm = im + start;
+                float* bRe = aRe + half;
+                float* bIm = aIm + half;
+
+                for (size_t j = 0; j < half; ++j)
+                {
+                    const float tRe = bRe[j] * twRe[j] - bIm[j] * twIm[j];
+                    const float tIm = bRe[j] * twIm[j] + bIm[j] * twRe[j];
+
+                    bRe[j] = aRe[j] - tRe;
+                    bIm[j] = aIm[j] - tIm;
+                    aRe[j] += tRe;
+                    aIm[j] += tIm;
+                }
+            }
+        }
+
+        for (size_t i = 0; i <= size / 2; ++i)
+            power[i] = re[i] * re[i] + im[i] * im[i];
+    }
+
+private:
+    std::vector<uint32_t> mBitReversed;
+    std::vector<float> mTwiddlesRe;
+    std::vector<float> mTwiddlesIm;
+    std::vector<float> mWindow;
+    std::vector<float> mRe;
+    std::vector<float> mIm;
+};
+
+// Logarithmically spaced band edges, in FFT bins
+std::array<size_t, BandsCount + 1> GetBandEdges()
+{
+    std::array<size_t, BandsCount + 1> edges;
+
+    for (size_t i = 0; i <= BandsCount; ++i)
+    {
+        const double frequency =
+            MinBandFrequency *
+            std::pow(MaxBandFrequency / MinBandFrequency, double(i) / BandsCount);
+
+        edges[i] = size_t(std::lround(
+            frequency * FingerprintFrameSize / FingerprintSampleRate));
+    }
+
+    return edges;
+}
+
+struct WaveFormat final
+{
+    uint16_t AudioFormat { 0 };
+    uint16_t NumChannels { 0 };
+    uint32_t SampleRate { 0 };
+    uint16_t BitsPerSample { 0 };
+};
+
+float DecodeWaveSample(const WaveFormat& format, const uint8_t* data)
+{
+    if (format.AudioFormat == 3)
+    {
+        float value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    switch (format.BitsPerSample)
+    {
+    case 16:
+    {
+        int16_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value / 32768.0f;
+    }
+    case 24:
+    {
+        const int32_t value =
+            int32_t(uint32_t(data[0]) << 8 | uint32_t(data[1]) << 16 |
+                    uint32_t(data[2]) << 24) >> 8;
+        return value / 8388608.0f;
+    }
+    case 32:
+    {
+        int32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value / 2147483648.0f;
+    }
+    default:
+        throw std::runtime_error(fmt::format(
+            "Unsupported WAV sample size: {} bits", format.BitsPerSample));
+    }
+}
+
+// Reads a PCM or float WAV file, downmixed and resampled
+std::vector<float> ReadWaveFile(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file)
+        throw std::runtime_error(
+            fmt::format("Failed to open {}", path.u8string()));
+
+    char riff[12];
+
+    if (!file.read(riff, sizeof(riff)) || std::memcmp(riff, "RIFF", 4) != 0 ||
+        std::memcmp(riff + 8, "WAVE", 4) != 0)
+        throw std::runtime_error(
+            fmt::format("{} is not a WAV file", path.u8string()));
+
+    WaveFormat format;
+
+    char chunkId[4];
+    uint32_t chunkSize;
+
+    while (file.read(chunkId, sizeof(chunkId)) &&
+           file.read(reinterpret_cast<char*>(&chunkSize), sizeof(chunkSize)))
+    {
+        if (std::memcmp(chunkId, "fmt ", 4) == 0)
+        {
+            std::vector<uint8_t> fmtChunk(std::max<uint32_t>(chunkSize, 16));
+
+            file.read(reinterpret_cast<char*>(fmtChunk.data()), chunkSize);
+            file.seekg(chunkSize & 1, std::ios::cur);
+
+            std::memcpy(&format.AudioFormat, fmtChunk.data(), 2);
+            std::memcpy(&format.NumChannels, fmtChunk.data() + 2, 2);
+            std::memcpy(&format.SampleRate, fmtChunk.data() + 4, 4);
+            std::memcpy(&format.BitsPerSample, fmtChunk.data() + 14, 2);
+
+            // WAVE_FORMAT_EXTENSIBLE keeps the format in the sub format GUID
+            if (format.AudioFormat == 0xFFFE && chunkSize >= 26)
+                std::memcpy(&format.AudioFormat, fmtChunk.data() + 24, 2);
+        }
+        else if (std::memcmp(chunkId, "data", 4) == 0)
+        {
+            if (format.NumChannels == 0 || format.SampleRate == 0 ||
+                format.BitsPerSample < 8 ||
+                (format.AudioFormat != 1 && format.AudioFormat != 3))
+                throw std::runtime_error(fmt::format(
+                    "Unsupported WAV format in {}", path.u8string()));
+
+            const size_t bytesPerSample = format.BitsPerSample / 8;
+            const size_t frameSize = bytesPerSample * format.NumChannels;
+
+            FingerprintResampler resampler(format.SampleRate);
+
+            std::vector<uint8_t> data(frameSize * 4096);
+            std::vector<float> mono(4096);
+
+            size_t bytesLeft = chunkSize;
+
+            while (bytesLeft >= frameSize && file)
+            {
+                const size_t bytesToRead =
+                    std::min(data.size(), bytesLeft / frameSize * frameSize);
+
+                file.read(reinterpret_cast<char*>(data.data()), bytesToRead);
+
+                const size_t framesCount = size_t(file.gcount()) / frameSize;
+
+                for (size_t frame = 0; frame < framesCount; ++frame)
+                {
+                    float sum = 0.0f;
+
+                    for (size_t channel = 0; channel < format.NumChannels; ++channel)
+                        sum += DecodeWaveSample(
+                            format, data.data() + frame * frameSize +
+                                        channel * bytesPerSample);
+
+                    mono[frame] = sum / format.NumChannels;
+                }
+
+                resampler.append(mono.data(), framesCount);
+                bytesLeft -= bytesToRead;
+            }
+
+            return resampler.finish();
+        }
+        else
+        {
+            // Chunks are padded to the even size
+            file.seekg(chunkSize + (chunkSize & 1), std::ios::cur);
+        }
+    }
+
+    throw std::runtime_error(
+        fmt::format("{} has no audio data", path.u8string()));
+}
+
+struct ClipAudio final
+{
+    const WaveTrack* Track;
+    const Clip* AudioClip;
+
+    std::vector<float> Samples;
+    std::vector<uint32_t> Fingerprints;
+};
+
+// Reads the audible part of the clip
+std::vector<float> ReadClipAudio(SQLite::Statement& readBlock, const Clip& clip)
+{
+    const auto& track = *clip.getParent();
+
+    const auto format = SampleFormat(track.getSampleFormat());
+    const size_t bytesPerSample = DiskBytesPerSample(format);
+
+    FingerprintResampler resampler(track.getSampleRate());
+
+    std::vector<float> samples;
+
+    for (auto sequence : clip)
+    {
+        const int64_t firstSample =
+            llrint(clip.getTrimLeft() * track.getSampleRate());
+        const int64_t lastSample =
+            sequence->getNumSamples() -
+            llrint(clip.getTrimRight() * track.getSampleRate());
+
+        for (auto block : *sequence)
+        {
+            const int64_t blockStart = std::max(block->getStart(), firstSample);
+            const int64_t blockEnd =
+                std::min(block->getStart() + block->getLength(), lastSample);
+
+            if (blockEnd <= blockStart)
+                continue;
+
+            const size_t count = size_t(blockEnd - blockStart);
+
+            if (block->isSilence())
+            {
+                resampler.appendSilence(count);
+                continue;
+            }
+
+            readBlock.bind(1, block->getBlockId());
+
+            const size_t offset =
+                size_t(blockStart - block->getStart()) * bytesPerSample;
+
+            if (readBlock.executeStep() &&
+                size_t(readBlock.getColumn(0).getBytes()) >=
+                    offset + count * bytesPerSample)
+            {
+                samples.resize(count);
+
+                ConvertToFloat(
+                    format,
+                    static_cast<const uint8_t*>(readBlock.getColumn(0).getBlob()) +
+                        offset,
+                    count, samples.data());
+
+                resampler.append(samples.data(), count);
+            }
+            else
+            {
+                // Missing blocks keep the timing
+                resampler.appendSilence(count);
+            }
+
+            readBlock.reset();
+        }
+    }
+
+    return resampler.finish();
+}
+
+void CreateIndexSchema(SQLite::Database& index)
+{
+    index.exec(R"(
+    CREATE TABLE IF NOT EXISTS projects (
+        id INTEGER PRIMARY KEY,
+        path TEXT NOT NULL UNIQUE
+    );
+
+    CREATE TABLE IF NOT EXISTS clips (
+        id INTEGER PRIMARY KEY,
+        project_id INTEGER NOT NULL,
+        track INTEGER NOT NULL,
+        clip INTEGER NOT NULL,
+        track_name TEXT,
+        clip_name TEXT,
+        clip_start REAL NOT NULL
+    );
+
+    CREATE INDEX IF NOT EXISTS clips_project ON clips (project_id);
+
+    CREATE TABLE IF NOT EXISTS fingerprints (
+        hash INTEGER NOT NULL,
+        clip_id INTEGER NOT NULL,
+        frame INTEGER NOT NULL,
+        PRIMARY KEY (hash, clip_id, frame)
+    ) WITHOUT ROWID;)");
+}
+} // namespace
+
+FingerprintResampler::FingerprintResampler(uint32_t sampleRate)
+    : mSampleRate(std::max<uint32_t>(1, sampleRate))
+{
+}
+
+void FingerprintResampler::append(const float* samples, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        // Every output sample is the average of its input period
+        const uint64_t bucket =
+            mInputIndex++ * FingerprintSampleRate / mSampleRate;
+
+        if (bucket != mBucket)
+            flush(bucket);
+
+        mSum += samples[i];
+        ++mCount;
+    }
+}
+
+void FingerprintResampler::appendSilence(size_t count)
+{
+    static const std::array<float, 1024> silence {};
+
+    while (count > 0)
+    {
+        const size_t chunk = std::min(count, silence.size());
+
+        append(silence.data(), chunk);
+        count -= chunk;
+    }
+}
+
+std::vector<float> FingerprintResampler::finish()
+{
+    if (mCount > 0)
+        flush(mBucket + 1);
+
+    return std::move(mOutput);
+}
+
+void FingerprintResampler::flush(uint64_t nextBucket)
+{
+    const float value = mCount > 0 ? float(mSum / mCount) : 0.0f;
+
+    // Input rates below FingerprintSampleRate repeat the samples
+    for (; mBucket < nextBucket; ++mBucket)
+        mOutput.push_back(value);
+
+    mSum = 0;
+    mCount = 0;
+}
+
+std::vector<uint32_t> ComputeFingerprints(
+    const std::vector<float>& samples, std::vector<uint32_t>* weakBits)
+{
+    if (samples.size() < FingerprintFrameSize)
+        return {};
+
+    static const auto bandEdges = GetBandEdges();
+
+    const size_t framesCount =
+        (samples.size() - FingerprintFrameSize) / FingerprintFrameStep + 1;
+
+    FrameSpectrum spectrum;
+
+    std::vector<float> power(FingerprintFrameSize / 2 + 1);
+    std::array<float, BandsCount> energy {};
+    std::array<float, BandsCount> previousEnergy {};
+
+    std::vector<uint32_t> fingerprints;
+    fingerprints.reserve(framesCount - 1);
+
+    std::array<std::pair<float, size_t>, BandsCount - 1> reliability;
+
+    for (size_t frame = 0; frame < framesCount; ++frame)
+    {
+        spectrum.compute(
+            samples.data() + frame * FingerprintFrameStep, power.data());
+
+        for (size_t band = 0; band < BandsCount; ++band)
+        {
+            float sum = 0.0f;
+
+            for (size_t bin = bandEdges[band]; bin < bandEdges[band + 1]; ++bin)
+                sum += power[bin];
+
+            energy[band] = sum;
+        }
+
+        if (frame > 0)
+        {
+            uint32_t fingerprint = 0;
+
+            for (size_t band = 0; band + 1 < BandsCount; ++band)
+            {
+                const float difference =
+                    (energy[band] - energy[band + 1]) -
+                    (previousEnergy[band] - previousEnergy[band + 1]);
+
+                if (difference > 0)
+                    fingerprint |= uint32_t(1) << band;
+
+                reliability[band] = { std::abs(difference), band };
+            }
+
+            fingerprints.push_back(fingerprint);
+
+            if (weakBits != nullptr)
+            {
+                // Bits with the smallest differences flip first
+                std::partial_sort(
+                    reliability.begin(), reliability.begin() + WeakBitsCount,
+                    reliability.end());
+
+                uint32_t mask = 0;
+
+                for (size_t i = 0; i < WeakBitsCount; ++i)
+                    mask |= uint32_t(1) << reliability[i].second;
+
+                weakBits->push_back(mask);
+            }
+        }
+
+        std::swap(energy, previousEnergy);
+    }
+
+    return fingerprints;
+}
+
+void IndexProjectFingerprints(
+    AudacityDatabase& db, const AudacityProject& project,
+    const std::filesystem::path& indexPath, size_t threadsCount)
+{
+    std::vector<ClipAudio> clips;
+
+    SQLite::Statement readBlock(
+        db.DB(), "SELECT samples FROM sampleblocks WHERE blockid = ?1;");
+
+    // Reading is bound by the disk, fingerprints are computed in parallel
+    for (const auto& track : project.getWaveTracks())
+    {
+        for (auto clip : track.getClips())
+            clips.push_back({ &track, clip, ReadClipAudio(readBlock, *clip), {} });
+    }
+
+    std::atomic<size_t> nextClip { 0 };
+
+    auto worker = [&]()
+    {
+        for (size_t index = nextClip++; index < clips.size();
+             index = nextClip++)
+        {
+            clips[index].Fingerprints = ComputeFingerprints(clips[index].Samples);
+            clips[index].Samples = {};
+        }
+    };
+
+    threadsCount = std::clamp<size_t>(threadsCount, 1, std::max<size_t>(1, clips.size()));
+
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < threadsCount; ++i)
+        threads.emplace_back(worker);
+
+    for (auto& thread : threads)
+        thread.join();
+
+    SQLite::Database index(
+        indexPath.u8string(), SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
+
+    CreateIndexSchema(index);
+
+    const auto projectPath =
+        std::filesystem::absolute(db.getProjectPath()).u8string();
+
+    SQLite::Transaction transaction(index);
+
+    SQLite::Statement findProject(
+        index, "SELECT id FROM projects WHERE path = ?1;");
+
+    findProject.bind(1, projectPath);
+
+    if (findProject.executeStep())
+    {
+        const int64_t projectId = findProject.getColumn(0).getInt64();
+
+        SQLite::Statement deleteFingerprints(
+            index,
+            "DELETE FROM fingerprints WHERE clip_id IN (SELECT id FROM clips WHERE project_id = ?1);");
+        deleteFingerprints.bind(1, projectId);
+        deleteFingerprints.exec();
+
+        SQLite::Statement deleteClips(
+            index, "DELETE FROM clips WHERE project_id = ?1;");
+        deleteClips.bind(1, projectId);
+        deleteClips.exec();
+    }
+    else
+    {
+        SQLite::Statement insertProject(
+            index, "INSERT INTO projects (path) VALUES (?1);");
+        insertProject.bind(1, projectPath);
+        insertProject.exec();
+    }
+
+    findProject.reset();
+    findProject.executeStep();
+
+    const int64_t projectId = findProject.getColumn(0).getInt64();
+
+    SQLite::Statement insertClip(
+        index,
+        "INSERT INTO clips (project_id, track, clip, track_name, clip_name, clip_start) VALUES (?1, ?2, ?3, ?4, ?5, ?6);");
+
+    SQLite::Statement insertFingerprint(
+        index,
+        "INSERT OR IGNORE INTO fingerprints (hash, clip_id, frame) VALUES (?1, ?2, ?3);");
+
+    size_t fingerprintsCount = 0;
+
+    for (const auto& clip : clips)
+    {
+        insertClip.bind(1, projectId);
+        insertClip.bind(2, int64_t(clip.Track->getParentIndex()));
+        insertClip.bind(3, int64_t(clip.AudioClip->getParentIndex()));
+        insertClip.bind(4, std::string(clip.Track->getTrackName()));
+        insertClip.bind(5, std::string(clip.AudioClip->getName()));
+        // Fingerprints start at the first audible sample
+        insertClip.bind(
+            6, clip.AudioClip->getOffset() + clip.AudioClip->getTrimLeft());
+        insertClip.exec();
+        insertClip.reset();
+
+        const int64_t clipId = index.getLastInsertRowid();
+
+        for (size_t frame = 0; frame < clip.Fingerprints.size();
+             frame += IndexStride)
+        {
+            // Silence gives zero fingerprints, that match everything
+            if (clip.Fingerprints[frame] == 0)
+                continue;
+
+            insertFingerprint.bind(1, int64_t(clip.Fingerprints[frame]));
+            insertFingerprint.bind(2, clipId);
+            insertFingerprint.bind(3, int64_t(frame));
+            insertFingerprint.exec();
+            insertFingerprint.reset();
+
+            ++fingerprintsCount;
+        }
+    }
+
+    transaction.commit();
+
+    fmt::print(
+        "Indexed {} clips ({} fingerprints) of {}\n", clips.size(),
+        fingerprintsCount, projectPath);
+}
+
+void FindAudio(
+    const std::filesystem::path& indexPath,
+    const std::filesystem::path& wavePath)
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<uint32_t> weakBits;
+
+    const auto fingerprints =
+        ComputeFingerprints(ReadWaveFile(wavePath), &weakBits);
+
+    if (fingerprints.empty())
+        throw std::runtime_error(
+            fmt::format("{} is too short", wavePath.u8string()));
+
+    SQLite::Database index(indexPath.u8string());
+
+    const auto start = Clock::now();
+
+    SQLite::Statement lookup(
+        index, "SELECT clip_id, frame FROM fingerprints WHERE hash = ?1;");
+
+    // Matches of the same clip at the same offset are voted together
+    std::unordered_map<int64_t, std::unordered_map<int64_t, size_t>> votes;
+
+    for (size_t frame = 0; frame < fingerprints.size(); ++frame)
+    {
+        const uint32_t mask = weakBits[frame];
+
+        // Enumerates all the subsets of the weak bits
+        uint32_t flipped = 0;
+
+        do
+        {
+            const uint32_t fingerprint = fingerprints[frame] ^ flipped;
+
+            if (fingerprint != 0)
+            {
+                lookup.bind(1, int64_t(fingerprint));
+
+                while (lookup.executeStep())
+                    ++votes[lookup.getColumn(0).getInt64()]
+                           [lookup.getColumn(1).getInt64() - int64_t(frame)];
+
+                lookup.reset();
+            }
+
+            flipped = (flipped - mask) & mask;
+        } while (flipped != 0);
+    }
+
+    struct Match final
+    {
+        int64_t ClipId;
+        int64_t FrameOffset;
+        size_t Votes;
+    };
+
+    std::vector<Match> matches;
+
+    for (const auto& [clipId, offsets] : votes)
+    {
+        auto best = std::max_element(
+            offsets.begin(), offsets.end(),
+            [](const auto& lhs, const auto& rhs)
+            { return lhs.second < rhs.second; });
+
+        if (best->second >= MinMatchesCount)
+            matches.push_back({ clipId, best->first, best->second });
+    }
+
+    std::sort(
+        matches.begin(), matches.end(),
+        [](const auto& lhs, const auto& rhs) { return lhs.Votes > rhs.Votes; });
+
+    if (matches.size() > MaxResultsCount)
+        matches.resize(MaxResultsCount);
+
+    SQLite::Statement describe(
+        index,
+        "SELECT projects.path, clips.track, clips.track_name, clips.clip, clips.clip_name, clips.clip_start FROM clips JOIN projects ON projects.id = clips.project_id WHERE clips.id = ?1;");
+
+    for (const auto& match : matches)
+    {
+        describe.bind(1, match.ClipId);
+
+        if (describe.executeStep())
+        {
+            const double clipTime = double(match.FrameOffset) *
+                                    FingerprintFrameStep / FingerprintSampleRate;
+
+            fmt::print(
+                "{}: track {} '{}', clip {} '{}' at {:.2f} s (project time {:.2f} s), {} matching fingerprints\n",
+                describe.getColumn(0).getString(), describe.getColumn(1).getInt(),
+                describe.getColumn(2).getString(), describe.getColumn(3).getInt(),
+                describe.getColumn(4).getString(), clipTime,
+                describe.getColumn(5).getDouble() + clipTime, match.Votes);
+        }
+
+        describe.reset();
+    }
+
+    fmt::print(
+        "{}: {} matches found in {:.1f} ms\n", wavePath.u8string(),
+        matches.size(),
+        std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+}
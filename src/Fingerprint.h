@@ -0,0 +1,68 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <filesystem>
+#include <vector>
+
+class AudacityDatabase;
+class AudacityProject;
+
+// Audio fingerprints.
+//
+// Audio is resampled to FingerprintSampleRate and split into overlapping
+// frames. Every frame gets a 32 bit sub-fingerprint: the signs of the energy
+// differences between the adjacent frequency bands and the adjacent frames.
+// Sub-fingerprints survive the format conversions, so the index is looked up
+// for the exact matches, that are then voted by the time offset.
+
+constexpr uint32_t FingerprintSampleRate = 5512;
+constexpr size_t FingerprintFrameSize = 2048;
+constexpr size_t FingerprintFrameStep = 64;
+
+// Converts the mono audio to FingerprintSampleRate
+class FingerprintResampler final
+{
+public:
+    explicit FingerprintResampler(uint32_t sampleRate);
+
+    void append(const float* samples, size_t count);
+    void appendSilence(size_t count);
+
+    std::vector<float> finish();
+
+private:
+    void flush(uint64_t nextBucket);
+
+    std::vector<float> mOutput;
+
+    uint64_t mSampleRate;
+    uint64_t mInputIndex { 0 };
+    uint64_t mBucket { 0 };
+
+    double mSum { 0 };
+    size_t mCount { 0 };
+};
+
+// Returns a sub-fingerprint for every frame, starting from the second one.
+// If weakBits is set, it receives the mask of the least reliable bits
+// of every sub-fingerprint.
+std::vector<uint32_t> ComputeFingerprints(
+    const std::vector<float>& samples,
+    std::vector<uint32_t>* weakBits = nullptr);
+
+// Adds the fingerprints of all the clips of the project to the index,
+// replacing the previous entries of the project
+void IndexProjectFingerprints(
+    AudacityDatabase& db, const AudacityProject& project,
+    const std::filesystem::path& indexPath, size_t threadsCount);
+
+// Prints the indexed clips, that contain the audio from the WAV file
+void FindAudio(
+    const std::filesystem::path& indexPath,
+    const std::filesystem::path& wavePath);
@@ -0,0 +1,118 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "Hash.h"
+
+#include <cstring>
+
+namespace
+{
+constexpr uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t Prime3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t Prime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t Prime5 = 0x27D4EB2F165667C5ULL;
+
+uint64_t RotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t Read64(const uint8_t* data)
+{
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint32_t Read32(const uint8_t* data)
+{
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint64_t Round(uint64_t accumulator, uint64_t input)
+{
+    accumulator += input * Prime2;
+    accumulator = RotateLeft(accumulator, 31);
+    return accumulator * Prime1;
+}
+
+uint64_t MergeRound(uint64_t accumulator, uint64_t value)
+{
+    accumulator ^= Round(0, value);
+    return accumulator * Prime1 + Prime4;
+}
+} // namespace
+
+uint64_t CalculateHash(const void* data, size_t size, uint64_t seed)
+{
+    auto input = static_cast<const uint8_t*>(data);
+    const auto end = input + size;
+
+    uint64_t hash;
+
+    if (size >= 32)
+    {
+        uint64_t v1 = seed + Prime1 + Prime2;
+        uint64_t v2 = seed + Prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - Prime1;
+
+        const auto limit = end - 32;
+
+        do
+        {
+            v1 = Round(v1, Read64(input));
+            v2 = Round(v2, Read64(input + 8));
+            v3 = Round(v3, Read64(input + 16));
+            v4 = Round(v4, Read64(input + 24));
+
+            input += 32;
+        } while (input <= limit);
+
+        hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) +
+               RotateLeft(v4, 18);
+
+        hash = MergeRound(hash, v1);
+        hash = MergeRound(hash, v2);
+        hash = MergeRound(hash, v3);
+        hash = MergeRound(hash, v4);
+    }
+    else
+    {
+        hash = seed + Prime5;
+    }
+
+    hash += size;
+
+    for (; input + 8 <= end; input += 8)
+    {
+        hash ^= Round(0, Read64(input));
+        hash = RotateLeft(hash, 27) * Prime1 + Prime4;
+    }
+
+    if (input + 4 <= end)
+    {
+        hash ^= uint64_t(Read32(input)) * Prime1;
+        hash = RotateLeft(hash, 23) * Prime2 + Prime3;
+        input += 4;
+    }
+
+    for (; input < end; ++input)
+    {
+        hash ^= *input * Prime5;
+        hash = RotateLeft(hash, 11) * Prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= Prime2;
+    hash ^= hash >> 29;
+    hash *= Prime3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
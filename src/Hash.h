@@ -0,0 +1,13 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// XXH64 of the data. The result is compatible with the reference
+// implementation on the little endian machines.
+uint64_t CalculateHash(const void* data, size_t size, uint64_t seed = 0);
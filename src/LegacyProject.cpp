@@ -0,0 +1,994 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "LegacyProject.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <expat.h>
+#include <fmt/format.h>
+
+#include "AsyncFileWriter.h"
+#include "AudacityDatabase.h"
+#include "BlockIdSet.h"
+#include "BinaryXMLConverter.h"
+#include "ProjectBlobReader.h"
+#include "ProjectBuilder.h"
+#include "ProjectModel.h"
+#include "SampleBlock.h"
+#include "SampleFormat.h"
+
+namespace
+{
+// Audacity 2.x stores the .au header in the native byte order
+constexpr uint32_t AuMagic = 0x2e736e64;
+constexpr uint32_t AuSampleRate = 44100;
+
+enum AuEncoding : uint32_t
+{
+    AuInt16 = 3,
+    AuInt24 = 4,
+    AuFloat = 6,
+};
+
+struct AuHeader final
+{
+    uint32_t Magic;
+    uint32_t DataOffset;
+    uint32_t DataSize;
+    uint32_t Encoding;
+    uint32_t SampleRate;
+    uint32_t Channels;
+};
+
+constexpr std::string_view SummaryHeaderTag = "AudacityBlockFile112";
+constexpr size_t SummaryFrameSize = 3 * sizeof(float);
+
+// Audacity 2.x derives the directory from the file name,
+// so only 28 bits of the block id can be used
+constexpr int64_t MaxLegacyBlockId = (int64_t(1) << 28) - 1;
+
+constexpr std::string_view LegacyProjectPrologue =
+    "<?xml version=\"1.0\" standalone=\"no\" ?>\n"
+    "<!DOCTYPE project PUBLIC \"-//audacityproject-1.3.0//DTD//EN\" "
+    "\"http://audacity.sourceforge.net/xml/audacityproject-1.3.0.dtd\" >\n";
+
+struct LegacyBlockFile final
+{
+    std::string FileName;
+
+    int64_t Length;
+
+    double Min;
+    double Max;
+    double Rms;
+};
+
+struct ExportState final
+{
+    std::unordered_map<const ProjectTreeNode*, const WaveBlock*> Blocks;
+    std::unordered_map<int64_t, LegacyBlockFile> BlockFiles;
+
+    std::string ProjectName;
+
+    // Owns the strings referenced by the converted tree
+    std::deque<std::string> Strings;
+};
+
+AuEncoding GetAuEncoding(SampleFormat format)
+{
+    switch (format)
+    {
+    case SampleFormat::Int16:
+        return AuInt16;
+    case SampleFormat::Int24:
+        return AuInt24;
+    case SampleFormat::Float32:
+        return AuFloat;
+    }
+
+    throw std::runtime_error(
+        fmt::format("Unsupported sample format {}", int(format)));
+}
+
+std::string GetBlockFileName(int64_t blockId)
+{
+    return fmt::format(
+        "e{:02x}{:02x}{:03x}", (blockId >> 20) & 0xFF, (blockId >> 12) & 0xFF,
+        blockId & 0xFFF);
+}
+
+std::filesystem::path
+GetBlockFileDirectory(const std::filesystem::path& dataPath, int64_t blockId)
+{
+    return dataPath / fmt::format("e{:02x}", (blockId >> 20) & 0xFF) /
+           fmt::format("d{:02x}", (blockId >> 12) & 0xFF);
+}
+
+// Summaries are padded or truncated to the size expected by Audacity 2.x
+void AppendSummary(
+    Buffer& buffer, const SQLite::Column& column, size_t expectedSize)
+{
+    const size_t size = std::min<size_t>(column.getBytes(), expectedSize);
+
+    buffer.append(column.getBlob(), size);
+
+    for (size_t i = size; i < expectedSize; ++i)
+        buffer.append(uint8_t(0));
+}
+
+// Block files store 24 bit samples packed to 3 bytes, in the byte order of
+// the machine. Projects store them as 4 byte integers.
+constexpr size_t PackedInt24Size = 3;
+
+size_t GetInt24LowByteOffset()
+{
+    const uint32_t probe = 1;
+    return *reinterpret_cast<const uint8_t*>(&probe) == 1 ? 0 : 1;
+}
+
+std::vector<uint8_t> PackInt24(const void* data, size_t samplesCount)
+{
+    const size_t offset = GetInt24LowByteOffset();
+    const auto input = static_cast<const uint8_t*>(data);
+
+    std::vector<uint8_t> packed(samplesCount * PackedInt24Size);
+
+    for (size_t i = 0; i < samplesCount; ++i)
+        std::memcpy(
+            packed.data() + i * PackedInt24Size, input + i * sizeof(int32_t) + offset,
+            PackedInt24Size);
+
+    return packed;
+}
+
+std::vector<uint8_t> UnpackInt24(const uint8_t* data, size_t samplesCount)
+{
+    const size_t offset = GetInt24LowByteOffset();
+
+    std::vector<uint8_t> unpacked(samplesCount * sizeof(int32_t));
+
+    for (size_t i = 0; i < samplesCount; ++i)
+    {
+        uint8_t bytes[sizeof(int32_t)] = {};
+        std::memcpy(bytes + offset, data + i * PackedInt24Size, PackedInt24Size);
+
+        int32_t value;
+        std::memcpy(&value, bytes, sizeof(value));
+
+        // Extends the sign
+        value = int32_t(uint32_t(value) << 8) >> 8;
+
+        std::memcpy(unpacked.data() + i * sizeof(int32_t), &value, sizeof(value));
+    }
+
+    return unpacked;
+}
+
+std::unique_ptr<Buffer> MakeBlockFile(
+    SampleFormat format, const SQLite::Column& summary64k,
+    const SQLite::Column& summary256, const SQLite::Column& samples)
+{
+    const size_t samplesCount = samples.getBytes() / DiskBytesPerSample(format);
+
+    const size_t frames64k = (samplesCount + 65535) / 65536;
+    const size_t frames256 = frames64k * 256;
+
+    const size_t summarySize = SummaryHeaderTag.size() +
+                               (frames64k + frames256) * SummaryFrameSize;
+
+    AuHeader header;
+
+    header.Magic = AuMagic;
+    header.DataOffset = uint32_t(sizeof(AuHeader) + summarySize);
+    header.DataSize = uint32_t(
+        format == SampleFormat::Int24 ? samplesCount * PackedInt24Size :
+                                        samples.getBytes());
+    header.Encoding = GetAuEncoding(format);
+    header.SampleRate = AuSampleRate;
+    header.Channels = 1;
+
+    auto buffer = std::make_unique<Buffer>();
+
+    buffer->append(&header, sizeof(header));
+    buffer->append(SummaryHeaderTag.data(), SummaryHeaderTag.size());
+
+    AppendSummary(*buffer, summary64k, frames64k * SummaryFrameSize);
+    AppendSummary(*buffer, summary256, frames256 * SummaryFrameSize);
+
+    if (format == SampleFormat::Int24)
+    {
+        const auto packed = PackInt24(samples.getBlob(), samplesCount);
+        buffer->append(packed.data(), packed.size());
+    }
+    else
+    {
+        buffer->append(samples.getBlob(), samples.getBytes());
+    }
+
+    return buffer;
+}
+
+std::unique_ptr<ProjectTreeNode> MakeNode(std::string_view tagName)
+{
+    auto node = std::make_unique<ProjectTreeNode>();
+    node->TagName = tagName;
+    return node;
+}
+
+std::unique_ptr<ProjectTreeNode>
+ConvertWaveBlock(ExportState& state, const WaveBlock& block)
+{
+    auto result = MakeNode("waveblock");
+    result->Attributes.emplace_back("start", block.getStart());
+
+    auto it = state.BlockFiles.find(block.getBlockId());
+
+    if (it == state.BlockFiles.end())
+    {
+        // Silent or missing blocks
+        auto silence = MakeNode("silentblockfile");
+        silence->Attributes.emplace_back("len", block.getLength());
+
+        result->Children.push_back(std::move(silence));
+
+        return result;
+    }
+
+    const auto& blockFile = it->second;
+
+    auto simpleBlock = MakeNode("simpleblockfile");
+
+    simpleBlock->Attributes.emplace_back(
+        "filename", std::string_view(blockFile.FileName));
+    simpleBlock->Attributes.emplace_back("len", blockFile.Length);
+    simpleBlock->Attributes.emplace_back("min", blockFile.Min);
+    simpleBlock->Attributes.emplace_back("max", blockFile.Max);
+    simpleBlock->Attributes.emplace_back("rms", blockFile.Rms);
+
+    result->Children.push_back(std::move(simpleBlock));
+
+    return result;
+}
+
+std::unique_ptr<ProjectTreeNode>
+ConvertNode(ExportState& state, const ProjectTreeNode& node, bool isRoot)
+{
+    if (node.TagName == "waveblock")
+    {
+        auto it = state.Blocks.find(&node);
+
+        if (it != state.Blocks.end())
+            return ConvertWaveBlock(state, *it->second);
+    }
+
+    auto result = MakeNode(node.TagName);
+
+    if (isRoot)
+    {
+        state.Strings.emplace_back(
+            fmt::format("{}_data", state.ProjectName));
+
+        result->Attributes.emplace_back(
+            "xmlns", std::string_view("http://audacity.sourceforge.net/xml/"));
+        result->Attributes.emplace_back(
+            "projname", std::string_view(state.Strings.back()));
+        result->Attributes.emplace_back("version", std::string_view("1.3.0"));
+        result->Attributes.emplace_back(
+            "audacityversion", std::string_view("2.4.2"));
+    }
+
+    for (const auto& attr : node.Attributes)
+    {
+        if (
+            isRoot &&
+            (attr.Name == "version" || attr.Name == "audacityversion"))
+            continue;
+
+        // Audacity 2.x only accepts integers for the boolean attributes
+        if (std::holds_alternative<bool>(attr.Value))
+            result->Attributes.emplace_back(
+                attr.Name, int32_t(std::get<bool>(attr.Value)));
+        else
+            result->Attributes.push_back(attr);
+    }
+
+    result->Data = node.Data;
+
+    for (const auto& child : node.Children)
+        result->Children.push_back(ConvertNode(state, *child, false));
+
+    return result;
+}
+} // namespace
+
+void ExportLegacyProject(
+    AudacityDatabase& db, const AudacityProject& project,
+    const std::filesystem::path& path)
+{
+    ExportState state;
+
+    state.ProjectName = path.stem().u8string();
+
+    const auto dataPath =
+        path.parent_path() /
+        std::filesystem::u8path(fmt::format("{}_data", state.ProjectName));
+
+    BlockIdSet blockIds;
+
+    for (const auto& track : project.getWaveTracks())
+    {
+        for (auto clip : track.getClips())
+        {
+            for (auto sequence : *clip)
+            {
+                for (auto block : *sequence)
+                {
+                    state.Blocks.emplace(block->getXMLNode(), block);
+
+                    if (!block->isSilence())
+                        blockIds.emplace(block->getBlockId());
+                }
+            }
+        }
+    }
+
+    fmt::print(
+        "Exporting {} blocks to {}\n", blockIds.size(), dataPath.u8string());
+
+    AsyncFileWriter writer;
+
+    SQLite::Statement stmt(
+        db.DB(),
+        "SELECT sampleformat, summin, summax, sumrms, summary256, summary64k, samples FROM sampleblocks WHERE blockid = ?1;");
+
+    std::set<std::filesystem::path> createdDirectories;
+    size_t missingBlocks = 0;
+
+    for (auto blockId : blockIds)
+    {
+        if (blockId > MaxLegacyBlockId)
+            throw std::runtime_error(fmt::format(
+                "Block id {} can't be represented in the legacy format",
+                blockId));
+
+        stmt.bind(1, blockId);
+
+        if (!stmt.executeStep())
+        {
+            ++missingBlocks;
+            stmt.reset();
+            continue;
+        }
+
+        const auto format = SampleFormat(stmt.getColumn(0).getInt());
+        const auto samples = stmt.getColumn(6);
+
+        LegacyBlockFile blockFile;
+
+        blockFile.FileName = fmt::format("{}.au", GetBlockFileName(blockId));
+        blockFile.Length = samples.getBytes() / DiskBytesPerSample(format);
+        blockFile.Min = stmt.getColumn(1).getDouble();
+        blockFile.Max = stmt.getColumn(2).getDouble();
+        blockFile.Rms = stmt.getColumn(3).getDouble();
+
+        const auto directory = GetBlockFileDirectory(dataPath, blockId);
+
+        if (createdDirectories.emplace(directory).second)
+            std::filesystem::create_directories(directory);
+
+        writer.write(
+            directory / blockFile.FileName,
+            MakeBlockFile(
+                format, stmt.getColumn(5), stmt.getColumn(4), samples));
+
+        state.BlockFiles.emplace(blockId, std::move(blockFile));
+
+        stmt.reset();
+    }
+
+    if (missingBlocks > 0)
+        fmt::print(
+            "{} blocks are missing and will be replaced with silence\n",
+            missingBlocks);
+
+    const auto root =
+        ConvertNode(state, project.getProjectTree(), true);
+
+    auto document = BinaryXMLConverter::ConvertToXML(*root);
+
+    auto xml = std::make_unique<Buffer>();
+    xml->append(LegacyProjectPrologue.data(), LegacyProjectPrologue.size());
+
+    for (const auto& chunk : document->getChunks())
+        xml->append(chunk.Data, chunk.Size);
+
+    writer.write(path, std::move(xml));
+
+    writer.wait();
+
+    fmt::print(
+        "Written {} ({} files)\n", path.u8string(), writer.getFilesWritten());
+}
+
+namespace
+{
+constexpr size_t XMLReadBufferSize = 64 * 1024;
+
+// Number of decoded blocks waiting to be inserted
+constexpr size_t ImportQueueSize = 64;
+constexpr size_t ImportTransactionSize = 1024;
+
+// The oldest version that can read projects produced by the import
+constexpr uint32_t ImportedProjectVersion = (3 << 24) + (0 << 16) + (0 << 8);
+
+struct BlockReference final
+{
+    ProjectTreeNode* Node;
+    size_t FileIndex;
+};
+
+struct ImportState final
+{
+    XML_Parser Parser { nullptr };
+
+    ProjectBuilder Builder;
+    std::vector<ProjectTreeNode*> NodesStack;
+
+    // Block file nodes are not copied to the new tree
+    size_t SkippedDepth { 0 };
+
+    std::string DataDirectoryName;
+
+    std::vector<std::string> FileNames;
+    std::vector<int64_t> FileLengths;
+    std::unordered_map<std::string, size_t> FileIndices;
+
+    std::vector<BlockReference> References;
+
+    size_t UnsupportedBlocks { 0 };
+
+    std::string Error;
+};
+
+struct ImportedBlock final
+{
+    size_t FileIndex;
+
+    SampleFormat Format;
+    std::vector<uint8_t> Samples;
+    SampleBlockSummary Summary;
+
+    std::string Error;
+};
+
+// Audacity 2.x stores all the attributes as text. Numbers are restored
+// so Audacity reads them back using the expected types. Only the values
+// formatted back to the same text are converted, so free text such as
+// a name "007" is kept as is.
+AttributeValue ParseAttributeValue(std::string_view value)
+{
+    const char* begin = value.data();
+    const char* end = value.data() + value.size();
+
+    int64_t intValue;
+    auto result = std::from_chars(begin, end, intValue);
+
+    if (
+        result.ec == std::errc {} && result.ptr == end &&
+        fmt::format("{}", intValue) == value)
+    {
+        if (
+            intValue >= std::numeric_limits<int32_t>::min() &&
+            intValue <= std::numeric_limits<int32_t>::max())
+            return int32_t(intValue);
+
+        return intValue;
+    }
+
+    double doubleValue;
+    result = std::from_chars(begin, end, doubleValue);
+
+    if (
+        result.ec == std::errc {} && result.ptr == end &&
+        fmt::format("{}", doubleValue) == value)
+        return doubleValue;
+
+    return value;
+}
+
+const XML_Char*
+FindAttribute(const XML_Char** attributes, std::string_view name)
+{
+    for (auto attr = attributes; *attr != nullptr; attr += 2)
+    {
+        if (name == attr[0])
+            return attr[1];
+    }
+
+    return nullptr;
+}
+
+int64_t GetLengthAttribute(const XML_Char** attributes)
+{
+    auto value = FindAttribute(attributes, "len");
+
+    if (value == nullptr)
+        value = FindAttribute(attributes, "aliaslen");
+
+    if (value == nullptr)
+        return 0;
+
+    int64_t length = 0;
+    std::from_chars(value, value + std::strlen(value), length);
+
+    return length;
+}
+
+void StopParser(ImportState& state, std::string error)
+{
+    state.Error = std::move(error);
+    XML_StopParser(state.Parser, XML_FALSE);
+}
+
+void HandleBlockFile(
+    ImportState& state, ProjectTreeNode& waveBlock, std::string_view tagName,
+    const XML_Char** attributes)
+{
+    const int64_t length = GetLengthAttribute(attributes);
+
+    if (tagName == "simpleblockfile")
+    {
+        const auto fileName = FindAttribute(attributes, "filename");
+
+        if (fileName == nullptr)
+        {
+            StopParser(state, "simpleblockfile has no filename attribute");
+            return;
+        }
+
+        auto [it, inserted] =
+            state.FileIndices.emplace(fileName, state.FileNames.size());
+
+        if (inserted)
+        {
+            state.FileNames.emplace_back(fileName);
+            state.FileLengths.push_back(length);
+        }
+
+        state.References.push_back({ &waveBlock, it->second });
+    }
+    else
+    {
+        // Alias block files reference external audio files
+        if (tagName != "silentblockfile")
+            ++state.UnsupportedBlocks;
+
+        state.Builder.setAttribute(waveBlock, "blockid", -length);
+    }
+}
+
+void XMLCALL StartElement(
+    void* userData, const XML_Char* name, const XML_Char** attributes)
+{
+    auto& state = *static_cast<ImportState*>(userData);
+    const std::string_view tagName = name;
+
+    if (state.SkippedDepth > 0)
+    {
+        ++state.SkippedDepth;
+        return;
+    }
+
+    if (state.NodesStack.empty())
+    {
+        if (tagName != "project")
+        {
+            StopParser(state, "Not an Audacity project");
+            return;
+        }
+
+        auto& root = state.Builder.getRoot();
+
+        for (auto attr = attributes; *attr != nullptr; attr += 2)
+        {
+            const std::string_view attrName = attr[0];
+
+            if (attrName == "projname")
+                state.DataDirectoryName = attr[1];
+            else if (attrName != "xmlns")
+                state.Builder.setAttribute(
+                    root, attrName, ParseAttributeValue(attr[1]));
+        }
+
+        state.NodesStack.push_back(&root);
+
+        return;
+    }
+
+    auto& parent = *state.NodesStack.back();
+
+    if (parent.TagName == "waveblock")
+    {
+        HandleBlockFile(state, parent, tagName, attributes);
+        state.SkippedDepth = 1;
+        return;
+    }
+
+    auto& node = state.Builder.addNode(parent, tagName);
+
+    for (auto attr = attributes; *attr != nullptr; attr += 2)
+        state.Builder.setAttribute(
+            node, attr[0], ParseAttributeValue(attr[1]));
+
+    state.NodesStack.push_back(&node);
+}
+
+void XMLCALL EndElement(void* userData, const XML_Char*)
+{
+    auto& state = *static_cast<ImportState*>(userData);
+
+    if (state.SkippedDepth > 0)
+        --state.SkippedDepth;
+    else
+        state.NodesStack.pop_back();
+}
+
+void ParseLegacyProject(const std::filesystem::path& path, ImportState& state)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file)
+        throw std::runtime_error(
+            fmt::format("Failed to open {}", path.u8string()));
+
+    std::unique_ptr<XML_ParserStruct, decltype(&XML_ParserFree)> parser(
+        XML_ParserCreate("UTF-8"), XML_ParserFree);
+
+    if (parser == nullptr)
+        throw std::runtime_error("Failed to create XML parser");
+
+    state.Parser = parser.get();
+
+    XML_SetUserData(parser.get(), &state);
+    XML_SetElementHandler(parser.get(), StartElement, EndElement);
+
+    std::vector<char> buffer(XMLReadBufferSize);
+
+    while (true)
+    {
+        file.read(buffer.data(), buffer.size());
+
+        const auto bytesRead = file.gcount();
+        const bool isFinal = bytesRead < std::streamsize(buffer.size());
+
+        if (XML_Parse(parser.get(), buffer.data(), int(bytesRead), isFinal) !=
+            XML_STATUS_OK)
+        {
+            if (!state.Error.empty())
+                throw std::runtime_error(fmt::format(
+                    "Failed to parse {}: {}", path.u8string(), state.Error));
+
+            throw std::runtime_error(fmt::format(
+                "Failed to parse {}: {} at line {}", path.u8string(),
+                XML_ErrorString(XML_GetErrorCode(parser.get())),
+                XML_GetCurrentLineNumber(parser.get())));
+        }
+
+        if (isFinal)
+            break;
+    }
+
+    state.Parser = nullptr;
+}
+
+uint32_t SwapBytes(uint32_t value)
+{
+    return ((value & 0xFF) << 24) | ((value & 0xFF00) << 8) |
+           ((value >> 8) & 0xFF00) | (value >> 24);
+}
+
+void ReadBlockFile(const std::filesystem::path& path, ImportedBlock& block)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+    if (!file)
+        throw std::runtime_error(
+            fmt::format("Failed to open {}", path.u8string()));
+
+    std::vector<uint8_t> data(size_t(file.tellg()));
+
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(data.data()), data.size());
+
+    AuHeader header;
+
+    if (!file || data.size() < sizeof(header))
+        throw std::runtime_error(
+            fmt::format("Failed to read {}", path.u8string()));
+
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    // Block files are written in the byte order of the machine
+    const bool swapped = header.Magic == SwapBytes(AuMagic);
+
+    if (swapped)
+    {
+        header.DataOffset = SwapBytes(header.DataOffset);
+        header.DataSize = SwapBytes(header.DataSize);
+        header.Encoding = SwapBytes(header.Encoding);
+    }
+    else if (header.Magic != AuMagic)
+    {
+        throw std::runtime_error(
+            fmt::format("{} is not a block file", path.u8string()));
+    }
+
+    switch (header.Encoding)
+    {
+    case AuInt16:
+        block.Format = SampleFormat::Int16;
+        break;
+    case AuInt24:
+        block.Format = SampleFormat::Int24;
+        break;
+    case AuFloat:
+        block.Format = SampleFormat::Float32;
+        break;
+    default:
+        throw std::runtime_error(fmt::format(
+            "{} has unsupported encoding {}", path.u8string(),
+            header.Encoding));
+    }
+
+    if (header.DataOffset > data.size())
+        throw std::runtime_error(
+            fmt::format("{} is truncated", path.u8string()));
+
+    const size_t sampleSize = block.Format == SampleFormat::Int24 ?
+                                  PackedInt24Size :
+                                  DiskBytesPerSample(block.Format);
+
+    size_t dataSize =
+        std::min<size_t>(header.DataSize, data.size() - header.DataOffset);
+    dataSize -= dataSize % sampleSize;
+
+    block.Samples.assign(
+        data.begin() + header.DataOffset,
+        data.begin() + header.DataOffset + dataSize);
+
+    if (swapped)
+    {
+        for (size_t offset = 0; offset < dataSize; offset += sampleSize)
+            std::reverse(
+                block.Samples.begin() + offset,
+                block.Samples.begin() + offset + sampleSize);
+    }
+
+    const size_t samplesCount = dataSize / sampleSize;
+
+    if (block.Format == SampleFormat::Int24)
+        block.Samples = UnpackInt24(block.Samples.data(), samplesCount);
+
+    block.Summary = CalculateSampleBlockSummary(
+        block.Format, block.Samples.data(), samplesCount);
+}
+} // namespace
+
+void ImportLegacyProject(
+    const std::filesystem::path& aupPath, const std::filesystem::path& path,
+    size_t threadsCount)
+{
+    if (std::filesystem::exists(path))
+        throw std::runtime_error(
+            fmt::format("{} already exists", path.u8string()));
+
+    ImportState state;
+
+    ParseLegacyProject(aupPath, state);
+
+    const auto dataPath =
+        aupPath.parent_path() /
+        std::filesystem::u8path(
+            state.DataDirectoryName.empty() ?
+                fmt::format("{}_data", aupPath.stem().u8string()) :
+                state.DataDirectoryName);
+
+    fmt::print(
+        "Importing {}: {} block files\n", aupPath.u8string(),
+        state.FileNames.size());
+
+    // Block files are expected in the eXX/dYY subdirectories, but some
+    // projects have them moved around
+    std::once_flag indexFlag;
+    std::unordered_map<std::string, std::filesystem::path> filesIndex;
+
+    auto locateBlockFile = [&](const std::string& fileName)
+    {
+        if (fileName.size() >= 5)
+        {
+            auto expectedPath = dataPath /
+                                fmt::format("e{}", fileName.substr(1, 2)) /
+                                fmt::format("d{}", fileName.substr(3, 2)) /
+                                std::filesystem::u8path(fileName);
+
+            if (std::filesystem::exists(expectedPath))
+                return expectedPath;
+        }
+
+        std::call_once(
+            indexFlag,
+            [&]()
+            {
+                if (!std::filesystem::exists(dataPath))
+                    return;
+
+                for (const auto& entry :
+                     std::filesystem::recursive_directory_iterator(dataPath))
+                {
+                    if (entry.is_regular_file())
+                        filesIndex.emplace(
+                            entry.path().filename().u8string(), entry.path());
+                }
+            });
+
+        auto it = filesIndex.find(fileName);
+
+        return it != filesIndex.end() ? it->second : std::filesystem::path();
+    };
+
+    auto db = CreateProjectDatabase(path, ImportedProjectVersion);
+
+    std::vector<int64_t> blockIds(state.FileNames.size());
+
+    std::atomic<size_t> nextFile { 0 };
+
+    std::mutex queueMutex;
+    std::condition_variable queueNotEmpty;
+    std::condition_variable queueNotFull;
+    std::deque<ImportedBlock> queue;
+    bool cancelled = false;
+
+    auto worker = [&]()
+    {
+        while (true)
+        {
+            const size_t index = nextFile++;
+
+            if (index >= state.FileNames.size())
+                return;
+
+            ImportedBlock block;
+            block.FileIndex = index;
+
+            try
+            {
+                const auto blockPath = locateBlockFile(state.FileNames[index]);
+
+                if (blockPath.empty())
+                    throw std::runtime_error(fmt::format(
+                        "{} is not found", state.FileNames[index]));
+
+                ReadBlockFile(blockPath, block);
+            }
+            catch (const std::exception& ex)
+            {
+                block.Error = ex.what();
+            }
+
+            std::unique_lock<std::mutex> lock(queueMutex);
+
+            queueNotFull.wait(
+                lock,
+                [&] { return cancelled || queue.size() < ImportQueueSize; });
+
+            if (cancelled)
+                return;
+
+            queue.push_back(std::move(block));
+            queueNotEmpty.notify_one();
+        }
+    };
+
+    threadsCount =
+        std::clamp<size_t>(threadsCount, 1, std::max<size_t>(1, blockIds.size()));
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadsCount);
+
+    for (size_t i = 0; i < threadsCount; ++i)
+        threads.emplace_back(worker);
+
+    size_t missingBlocks = 0;
+
+    try
+    {
+        db->exec("BEGIN;");
+
+        for (size_t received = 0; received < blockIds.size(); ++received)
+        {
+            ImportedBlock block;
+
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueNotEmpty.wait(lock, [&] { return !queue.empty(); });
+
+                block = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            queueNotFull.notify_one();
+
+            if (!block.Error.empty())
+            {
+                fmt::print("{}, replacing with silence\n", block.Error);
+                ++missingBlocks;
+                continue;
+            }
+
+            blockIds[block.FileIndex] = InsertSampleBlock(
+                *db, block.Format, block.Samples.data(),
+                block.Samples.size() / DiskBytesPerSample(block.Format),
+                block.Summary);
+
+            if ((received + 1) % ImportTransactionSize == 0)
+                db->exec("COMMIT; BEGIN;");
+        }
+    }
+    catch (...)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            cancelled = true;
+        }
+
+        queueNotFull.notify_all();
+
+        for (auto& thread : threads)
+            thread.join();
+
+        throw;
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    for (const auto& reference : state.References)
+    {
+        const auto blockId = blockIds[reference.FileIndex];
+
+        state.Builder.setAttribute(
+            *reference.Node, "blockid",
+            blockId != 0 ? blockId : -state.FileLengths[reference.FileIndex]);
+    }
+
+    auto document = state.Builder.serialize();
+
+    WriteProjectBlob(*db, "project", *document.first, *document.second);
+
+    db->exec("COMMIT;");
+
+    if (state.UnsupportedBlocks > 0)
+        fmt::print(
+            "{} alias blocks were replaced with silence\n",
+            state.UnsupportedBlocks);
+
+    fmt::print(
+        "Written {}: {} blocks, {} missing\n", path.u8string(),
+        blockIds.size() - missingBlocks, missingBlocks);
+}
@@ -0,0 +1,23 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <filesystem>
+
+class AudacityDatabase;
+class AudacityProject;
+
+// Writes the project in the Audacity 2.x format: an XML .aup file and
+// a <name>_data directory with a simple block file for every sample block.
+void ExportLegacyProject(
+    AudacityDatabase& db, const AudacityProject& project,
+    const std::filesystem::path& path);
+
+// Converts an Audacity 2.x project into a new .aup3 file. Block files are
+// read and summarized by up to threadsCount threads.
+void ImportLegacyProject(
+    const std::filesystem::path& aupPath, const std::filesystem::path& path,
+    size_t threadsCount);
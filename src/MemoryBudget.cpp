@@ -0,0 +1,159 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "MemoryBudget.h"
+
+#include <atomic>
+#include <charconv>
+#include <mutex>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "FileUtils.h"
+
+#ifdef _WIN32
+#   include <process.h>
+#else
+#   include <unistd.h>
+#endif
+
+namespace
+{
+std::atomic<size_t> Limit { 0 };
+std::atomic<size_t> Used { 0 };
+std::atomic<size_t> Peak { 0 };
+std::atomic<size_t> SpillFilesCount { 0 };
+
+std::mutex SpillDirectoryMutex;
+std::filesystem::path SpillDirectory;
+
+void UpdatePeak(size_t used) noexcept
+{
+    size_t peak = Peak.load();
+
+    while (peak < used && !Peak.compare_exchange_weak(peak, used))
+        ;
+}
+} // namespace
+
+void MemoryBudget::SetLimit(size_t bytes) noexcept
+{
+    Limit = bytes;
+}
+
+size_t MemoryBudget::GetLimit() noexcept
+{
+    return Limit;
+}
+
+void MemoryBudget::SetSpillDirectory(const std::filesystem::path& path)
+{
+    std::lock_guard<std::mutex> lock(SpillDirectoryMutex);
+    SpillDirectory = path;
+}
+
+bool MemoryBudget::TryAcquire(size_t bytes) noexcept
+{
+    const size_t limit = Limit;
+
+    if (limit == 0)
+    {
+        Acquire(bytes);
+        return true;
+    }
+
+    size_t used = Used.load();
+
+    do
+    {
+        if (used + bytes > limit)
+            return false;
+    } while (!Used.compare_exchange_weak(used, used + bytes));
+
+    UpdatePeak(used + bytes);
+
+    return true;
+}
+
+void MemoryBudget::Acquire(size_t bytes) noexcept
+{
+    UpdatePeak(Used += bytes);
+}
+
+void MemoryBudget::Release(size_t bytes) noexcept
+{
+    Used -= bytes;
+}
+
+size_t MemoryBudget::GetUsed() noexcept
+{
+    return Used;
+}
+
+size_t MemoryBudget::GetPeak() noexcept
+{
+    return Peak;
+}
+
+MemoryBudget::FilePtr MemoryBudget::CreateSpillFile()
+{
+    std::filesystem::path directory;
+
+    {
+        std::lock_guard<std::mutex> lock(SpillDirectoryMutex);
+        directory = SpillDirectory;
+    }
+
+    if (directory.empty())
+        directory = std::filesystem::temp_directory_path();
+
+#ifdef _WIN32
+    const auto path = directory / fmt::format(
+        "aup3-spill-{}-{}.tmp", _getpid(), SpillFilesCount++);
+    // D flag removes the file once it is closed
+    FilePtr file(OpenFile(path, "w+bD"), fclose);
+#else
+    const auto path = directory / fmt::format(
+        "aup3-spill-{}-{}.tmp", getpid(), SpillFilesCount++);
+    FilePtr file(OpenFile(path, "w+b"), fclose);
+
+    // The file stays available until it is closed
+    if (file != nullptr)
+        std::filesystem::remove(path);
+#endif
+
+    if (file == nullptr)
+        throw std::runtime_error(fmt::format(
+            "Failed to create the spill file {}", path.u8string()));
+
+    return file;
+}
+
+size_t ParseMemorySize(std::string_view size)
+{
+    size_t result = 0;
+
+    const auto conversion =
+        std::from_chars(size.data(), size.data() + size.size(), result);
+
+    if (conversion.ec != std::errc {})
+        throw std::runtime_error(
+            fmt::format("Invalid memory size '{}'", size));
+
+    const std::string_view suffix(
+        conversion.ptr, size.data() + size.size() - conversion.ptr);
+
+    if (suffix.empty())
+        return result;
+    else if (suffix == "K" || suffix == "k")
+        return result * 1024;
+    else if (suffix == "M" || suffix == "m")
+        return result * 1024 * 1024;
+    else if (suffix == "G" || suffix == "g")
+        return result * 1024 * 1024 * 1024;
+
+    throw std::runtime_error(fmt::format("Invalid memory size '{}'", size));
+}
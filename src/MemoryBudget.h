@@ -0,0 +1,43 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+
+// Process wide accounting of the large intermediate allocations.
+// Once the limit is reached, the allocations that can be spilled to disk
+// (see Buffer) are redirected to the temporary files.
+class MemoryBudget final
+{
+public:
+    using FilePtr = std::unique_ptr<FILE, int (*)(FILE*)>;
+
+    // 0 means no limit
+    static void SetLimit(size_t bytes) noexcept;
+    static size_t GetLimit() noexcept;
+
+    // Spill files are created in the system temporary directory by default
+    static void SetSpillDirectory(const std::filesystem::path& path);
+
+    // Accounts the bytes if they fit into the limit
+    static bool TryAcquire(size_t bytes) noexcept;
+    // Accounts the bytes unconditionally
+    static void Acquire(size_t bytes) noexcept;
+    static void Release(size_t bytes) noexcept;
+
+    static size_t GetUsed() noexcept;
+    static size_t GetPeak() noexcept;
+
+    // Creates an anonymous temporary file, that is removed once closed
+    static FilePtr CreateSpillFile();
+};
+
+// Parses sizes like 1048576, 512K, 256M or 2G
+size_t ParseMemorySize(std::string_view size);
@@ -0,0 +1,125 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "PackedSampleBlocks.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "FileUtils.h"
+
+namespace
+{
+constexpr size_t StreamBufferSize = 4 * 1024 * 1024;
+
+PackedIndexHeader MakeHeader(uint64_t entriesCount)
+{
+    PackedIndexHeader header;
+
+    std::memcpy(header.Magic, PackedIndexMagic, sizeof(header.Magic));
+    header.EntrySize = sizeof(PackedIndexEntry);
+    header.EntriesCount = entriesCount;
+
+    return header;
+}
+
+void Write(FILE* file, const void* data, size_t size)
+{
+    if (size != fwrite(data, 1, size, file))
+        throw std::runtime_error("Failed to write packed sample blocks");
+}
+} // namespace
+
+PackedSampleBlocksWriter::PackedSampleBlocksWriter(
+    const std::filesystem::path& dataPath,
+    const std::filesystem::path& indexPath)
+    : mDataFile(OpenFile(dataPath, "wb"), fclose)
+    , mIndexFile(OpenFile(indexPath, "wb"), fclose)
+{
+    if (mDataFile == nullptr)
+        throw std::runtime_error(
+            fmt::format("Failed to open {} for writing", dataPath.u8string()));
+
+    if (mIndexFile == nullptr)
+        throw std::runtime_error(
+            fmt::format("Failed to open {} for writing", indexPath.u8string()));
+
+    setvbuf(mDataFile.get(), nullptr, _IOFBF, StreamBufferSize);
+
+    // The entries count is patched in finalize()
+    const auto header = MakeHeader(0);
+    Write(mIndexFile.get(), &header, sizeof(header));
+}
+
+PackedSampleBlocksWriter::~PackedSampleBlocksWriter()
+{
+}
+
+void PackedSampleBlocksWriter::writeBlock(
+    int64_t blockId, int32_t sampleFormat, const void* data, size_t size,
+    double sumMin, double sumMax, double sumRms)
+{
+    static const std::array<uint8_t, PackedPayloadAlignment> padding {};
+
+    const size_t paddingSize =
+        (PackedPayloadAlignment - mDataOffset % PackedPayloadAlignment) %
+        PackedPayloadAlignment;
+
+    if (paddingSize > 0)
+    {
+        Write(mDataFile.get(), padding.data(), paddingSize);
+        mDataOffset += paddingSize;
+    }
+
+    PackedIndexEntry entry;
+
+    entry.BlockId = blockId;
+    entry.SampleFormat = sampleFormat;
+    entry.Offset = mDataOffset;
+    entry.Length = size;
+    entry.SumMin = sumMin;
+    entry.SumMax = sumMax;
+    entry.SumRms = sumRms;
+
+    if (size > 0)
+        Write(mDataFile.get(), data, size);
+
+    Write(mIndexFile.get(), &entry, sizeof(entry));
+
+    mDataOffset += size;
+    ++mBlocksCount;
+}
+
+void PackedSampleBlocksWriter::finalize()
+{
+    if (mFinalized)
+        return;
+
+    const auto header = MakeHeader(mBlocksCount);
+
+    if (0 != fseek(mIndexFile.get(), 0, SEEK_SET))
+        throw std::runtime_error("Failed to update packed index header");
+
+    Write(mIndexFile.get(), &header, sizeof(header));
+
+    if (0 != fflush(mIndexFile.get()) || 0 != fflush(mDataFile.get()))
+        throw std::runtime_error("Failed to flush packed sample blocks");
+
+    mFinalized = true;
+}
+
+uint64_t PackedSampleBlocksWriter::getBlocksCount() const noexcept
+{
+    return mBlocksCount;
+}
+
+uint64_t PackedSampleBlocksWriter::getDataSize() const noexcept
+{
+    return mDataOffset;
+}
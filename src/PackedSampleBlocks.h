@@ -0,0 +1,77 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+
+// Packed sample blocks container.
+//
+// Block payloads are stored back to back in the data file, exactly as they
+// are stored in the sampleblocks table. Every payload starts at an offset
+// aligned to PackedPayloadAlignment.
+//
+// The index file consists of PackedIndexHeader followed by EntriesCount
+// PackedIndexEntry records in the order of the payloads. All values use the
+// native (little endian) byte order.
+
+constexpr char PackedIndexMagic[8] = { 'A', 'U', 'P', '3', 'P', 'I', 'D', 'X' };
+constexpr uint32_t PackedIndexVersion = 1;
+constexpr uint64_t PackedPayloadAlignment = 16;
+
+struct PackedIndexHeader final
+{
+    char Magic[8];
+    uint32_t Version { PackedIndexVersion };
+    uint32_t EntrySize;
+    uint64_t EntriesCount { 0 };
+};
+
+struct PackedIndexEntry final
+{
+    int64_t BlockId;
+    int32_t SampleFormat;
+    uint32_t Reserved { 0 };
+    uint64_t Offset;
+    uint64_t Length;
+    double SumMin;
+    double SumMax;
+    double SumRms;
+};
+
+static_assert(sizeof(PackedIndexHeader) == 24);
+static_assert(sizeof(PackedIndexEntry) == 56);
+
+class PackedSampleBlocksWriter final
+{
+public:
+    PackedSampleBlocksWriter(
+        const std::filesystem::path& dataPath,
+        const std::filesystem::path& indexPath);
+    ~PackedSampleBlocksWriter();
+
+    void writeBlock(
+        int64_t blockId, int32_t sampleFormat, const void* data, size_t size,
+        double sumMin, double sumMax, double sumRms);
+
+    void finalize();
+
+    uint64_t getBlocksCount() const noexcept;
+    uint64_t getDataSize() const noexcept;
+
+private:
+    using FilePtr = std::unique_ptr<FILE, int (*)(FILE*)>;
+
+    FilePtr mDataFile;
+    FilePtr mIndexFile;
+
+    uint64_t mDataOffset { 0 };
+    uint64_t mBlocksCount { 0 };
+
+    bool mFinalized { false };
+};
@@ -14,12 +14,13 @@ class SQLiteBlob final
 {
 public:
     SQLiteBlob(
-        SQLite::Database& db, const char* table, const char* column)
+        SQLite::Database& db, const char* table, const char* column,
+        bool writable = false)
     {
         const int64_t rowId = db.execAndGet(fmt::format("SELECT ROWID FROM main.{} WHERE id = 1", table)).getInt64();
 
         const int rc = sqlite3_blob_open(
-            db.getHandle(), "main", table, column, rowId, 0, &mBlob);
+            db.getHandle(), "main", table, column, rowId, writable ? 1 : 0, &mBlob);
 
         if (rc != SQLITE_OK)
             throw SQLite::Exception(db.getHandle(), rc);
@@ -57,6 +58,24 @@ public:
         }
     }
 
+    void writeFromBuffer(const Buffer& inputBuffer)
+    {
+        if (inputBuffer.getSize() != mBlobSize)
+            throw std::runtime_error("Blob size mismatch");
+
+        size_t offset = 0;
+
+        for (const auto& chunk : inputBuffer.getChunks())
+        {
+            const int rc = sqlite3_blob_write(mBlob, chunk.Data, chunk.Size, offset);
+
+            if (rc != SQLITE_OK)
+                throw SQLite::Exception("Write failed", rc);
+
+            offset += chunk.Size;
+        }
+    }
+
 private:
     sqlite3_blob* mBlob { nullptr };
 
@@ -80,3 +99,38 @@ ReadProjectBlob(SQLite::Database& db, const std::string& table)
 
     return buffer;
 }
+
+void WriteProjectBlob(
+    SQLite::Database& db, const std::string& table, const Buffer& dict,
+    const Buffer& doc)
+{
+    // The row must not be left with the zero filled blobs. A savepoint also
+    // works inside of the transactions of the callers.
+    db.exec("SAVEPOINT write_blob;");
+
+    try
+    {
+        SQLite::Statement query(
+            db, fmt::format(
+                    R"(INSERT OR REPLACE INTO {}(id, dict, doc) VALUES (1, zeroblob(?1), zeroblob(?2));)",
+                    table));
+
+        query.bind(1, int64_t(dict.getSize()));
+        query.bind(2, int64_t(doc.getSize()));
+        query.exec();
+
+        SQLiteBlob(db, table.c_str(), "dict", true).writeFromBuffer(dict);
+        SQLiteBlob(db, table.c_str(), "doc", true).writeFromBuffer(doc);
+
+        db.exec("RELEASE write_blob;");
+    }
+    catch (...)
+    {
+        // Errors are ignored, the original error is more useful
+        sqlite3_exec(
+            db.getHandle(), "ROLLBACK TO write_blob; RELEASE write_blob;",
+            nullptr, nullptr, nullptr);
+
+        throw;
+    }
+}
@@ -12,3 +12,9 @@
 #include "Buffer.h"
 
 std::unique_ptr<Buffer> ReadProjectBlob(SQLite::Database& db, const std::string& table);
+
+// Stores the serialized project into the table, the blobs are written
+// directly from the buffer chunks.
+void WriteProjectBlob(
+    SQLite::Database& db, const std::string& table, const Buffer& dict,
+    const Buffer& doc);
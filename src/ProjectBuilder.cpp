@@ -0,0 +1,77 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "ProjectBuilder.h"
+
+#include <algorithm>
+
+#include "BinaryXMLConverter.h"
+
+ProjectBuilder::ProjectBuilder(std::string_view rootTagName)
+    : mRoot(std::make_unique<ProjectTreeNode>())
+{
+    mRoot->TagName = cacheName(rootTagName);
+    mRoot->ParentIndex = 0;
+}
+
+ProjectTreeNode& ProjectBuilder::getRoot() noexcept
+{
+    return *mRoot;
+}
+
+const ProjectTreeNode& ProjectBuilder::getRoot() const noexcept
+{
+    return *mRoot;
+}
+
+ProjectTreeNode&
+ProjectBuilder::addNode(ProjectTreeNode& parent, std::string_view tagName)
+{
+    auto node = std::make_unique<ProjectTreeNode>();
+
+    node->TagName = cacheName(tagName);
+    node->ParentIndex = parent.Children.size();
+
+    parent.Children.push_back(std::move(node));
+
+    return *parent.Children.back();
+}
+
+void ProjectBuilder::setAttribute(
+    ProjectTreeNode& node, std::string_view name, AttributeValue value)
+{
+    if (std::holds_alternative<std::string_view>(value))
+        value = cacheString(std::get<std::string_view>(value));
+
+    node.setAttribute(cacheName(name), value);
+}
+
+void ProjectBuilder::setData(ProjectTreeNode& node, std::string_view data)
+{
+    node.Data = std::string(data);
+}
+
+std::pair<std::unique_ptr<Buffer>, std::unique_ptr<Buffer>>
+ProjectBuilder::serialize() const
+{
+    return BinaryXMLConverter::SerializeProject(mNames, *mRoot);
+}
+
+std::string_view ProjectBuilder::cacheName(std::string_view name)
+{
+    auto it = std::find(mNames.begin(), mNames.end(), name);
+
+    if (it != mNames.end())
+        return *it;
+
+    mNames.emplace_back(name);
+    return mNames.back();
+}
+
+std::string_view ProjectBuilder::cacheString(std::string_view value)
+{
+    mStrings.emplace_back(value);
+    return mStrings.back();
+}
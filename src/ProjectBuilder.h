@@ -0,0 +1,45 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "Buffer.h"
+#include "ProjectModel.h"
+
+// Builds a project tree from scratch. Builder owns all the strings
+// referenced by the tree.
+class ProjectBuilder final
+{
+public:
+    explicit ProjectBuilder(std::string_view rootTagName = "project");
+
+    ProjectTreeNode& getRoot() noexcept;
+    const ProjectTreeNode& getRoot() const noexcept;
+
+    ProjectTreeNode& addNode(ProjectTreeNode& parent, std::string_view tagName);
+
+    void setAttribute(
+        ProjectTreeNode& node, std::string_view name, AttributeValue value);
+
+    void setData(ProjectTreeNode& node, std::string_view data);
+
+    std::pair<std::unique_ptr<Buffer>, std::unique_ptr<Buffer>>
+    serialize() const;
+
+private:
+    std::string_view cacheName(std::string_view name);
+    std::string_view cacheString(std::string_view value);
+
+    std::deque<std::string> mNames;
+    std::deque<std::string> mStrings;
+
+    std::unique_ptr<ProjectTreeNode> mRoot;
+};
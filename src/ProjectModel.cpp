@@ -8,17 +8,32 @@
 #include <algorithm>
 #include <fmt/format.h>
 #include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include <sqlite3.h>
 
 #include "ProjectBlobReader.h"
 #include "BinaryXMLConverter.h"
 
 #include "WaveFile.h"
+#include "AsyncFileWriter.h"
+#include "SampleBlock.h"
+#include "Deadline.h"
 
 DeserializedNode::DeserializedNode(ProjectTreeNode* node)
     : mXMLNode(node)
 {
 }
 
+ProjectTreeNode* DeserializedNode::getXMLNode() const noexcept
+{
+    return mXMLNode;
+}
+
 WaveBlock::WaveBlock(ProjectTreeNode* node, Sequence* parent)
     : DeserializedNode(node)
     , mParent(parent)
@@ -83,6 +98,11 @@ int64_t WaveBlock::getLength() const noexcept
         return mParent->mNumSamples - mStart;
 }
 
+size_t WaveBlock::getParentIndex() const noexcept
+{
+    return mParentIndex;
+}
+
 Sequence* WaveBlock::getParent() const noexcept
 {
     return mParent;
@@ -121,6 +141,28 @@ int32_t Sequence::getNumSamples() const noexcept
     return mNumSamples;
 }
 
+void Sequence::setMaxSamples(int64_t maxSamples) noexcept
+{
+    mMaxSamples = maxSamples;
+    mXMLNode->setAttribute("maxsamples", mMaxSamples);
+}
+
+void Sequence::setNumSamples(int64_t numSamples) noexcept
+{
+    mNumSamples = numSamples;
+    mXMLNode->setAttribute("numsamples", mNumSamples);
+}
+
+size_t Sequence::getParentIndex() const noexcept
+{
+    return mParentIndex;
+}
+
+Clip* Sequence::getParent() const noexcept
+{
+    return mParent;
+}
+
 Sequence::Blocks::const_iterator Sequence::begin() const
 {
     return mBlocks.begin();
@@ -225,6 +267,23 @@ bool WaveTrack::isLinked() const
     return mLinked;
 }
 
+void WaveTrack::setLinked(bool linked) noexcept
+{
+    mLinked = linked;
+
+    // Older versions write a bool, newer ones write the link type
+    for (auto& attr : mXMLNode->Attributes)
+    {
+        if (attr.Name == "linked" && !std::holds_alternative<bool>(attr.Value))
+        {
+            attr.Value = int32_t(linked);
+            return;
+        }
+    }
+
+    mXMLNode->setAttribute("linked", mLinked);
+}
+
 size_t WaveTrack::getParentIndex() const
 {
     return mParentIndex;
@@ -264,6 +323,16 @@ AudacityProject::~AudacityProject()
 {
 }
 
+const std::deque<WaveTrack>& AudacityProject::getWaveTracks() const
+{
+    return mWaveTracks;
+}
+
+const ProjectTreeNode& AudacityProject::getProjectTree() const
+{
+    return *mProjectNode;
+}
+
 bool AudacityProject::containsBlock(int64_t blockId) const
 {
     SQLite::Statement query(
@@ -324,12 +393,24 @@ AudacityProject::validateBlock(const WaveBlock& block) const
     return BlockValidationResult::Missing;
 }
 
-std::set<int64_t> AudacityProject::validateBlocks() const
+BlockIdSet AudacityProject::validateBlocks() const
 {
-    std::set<int64_t> missingBlocks;
+    BlockIdSet missingBlocks;
+
+    size_t checkedBlocks = 0;
 
     for (const auto& block : mWaveBlocks)
     {
+        if (Deadline::IsExpired())
+        {
+            Deadline::ReportPartial(fmt::format(
+                "recover_project: {} of {} blocks were validated", checkedBlocks,
+                mWaveBlocks.size()));
+            break;
+        }
+
+        ++checkedBlocks;
+
         if (block.isSilence())
             continue;
 
@@ -350,12 +431,25 @@ std::set<int64_t> AudacityProject::validateBlocks() const
     return missingBlocks;
 }
 
-std::set<int64_t> AudacityProject::recoverProject()
+BlockIdSet AudacityProject::recoverProject()
 {
     auto missingBlocks = validateBlocks();
 
+    size_t checkedSequences = 0;
+
     for (auto& sequence : mSequences)
     {
+        // Block lengths are only known for the validated blocks
+        if (Deadline::IsExpired())
+        {
+            Deadline::ReportPartial(fmt::format(
+                "recover_project: block starts were checked in {} of {} sequences",
+                checkedSequences, mSequences.size()));
+            break;
+        }
+
+        ++checkedSequences;
+
         int nextBlockStart = 0;
 
         bool firstBlock = true;
@@ -452,285 +546,1915 @@ void AudacityProject::saveProject()
 {
     mDb.reopenReadonlyAsWritable();
 
-    auto result = BinaryXMLConverter::SerializeProject(mReusableStringsCache, *mProjectNode);
-
-    SQLite::Statement query(
-        mDb.DB(),
-        fmt::format(
-            R"(INSERT OR REPLACE INTO {}(id, dict, doc) VALUES (1, ?1, ?2);)",
-            mFromAutosave ? "autosave" : "project"));
-
-    const auto dict = result.first->getLinearRepresentation();
-    const auto doc = result.second->getLinearRepresentation();
+    writeProjectDocument(
+        mDb.DB(), mFromAutosave ? "autosave" : "project", *mProjectNode);
+}
 
-    query.bind(1, dict.data(), dict.size());
-    query.bind(2, doc.data(), doc.size());
+void AudacityProject::writeProjectDocument(
+    SQLite::Database& db, const std::string& table,
+    const ProjectTreeNode& root) const
+{
+    auto result = BinaryXMLConverter::SerializeProject(mReusableStringsCache, root);
 
-    query.exec();
+    WriteProjectBlob(db, table, *result.first, *result.second);
 }
 
-void AudacityProject::removeUnusedBlocks()
+void AudacityProject::compactDocument()
 {
-    // Read all the available blocks from the DB first
+    const std::string table = mFromAutosave ? "autosave" : "project";
 
-    SQLite::Statement readBlocksList(
-        mDb.DB(), R"(SELECT blockid FROM sampleblocks)");
+    const int64_t oldSize =
+        mDb.DB()
+            .execAndGet(fmt::format(
+                "SELECT length(dict) + length(doc) FROM {} WHERE id = 1;", table))
+            .getInt64();
 
-    std::set<int64_t> availableBlocks;
-
-    while (readBlocksList.executeStep())
-        availableBlocks.emplace(readBlocksList.getColumn(0).getInt64());
+    auto result = BinaryXMLConverter::SerializeCompactProject(*mProjectNode);
 
-    readBlocksList.reset();
+    BinaryXMLConverter::VerifyProject(*result.first, *result.second, *mProjectNode);
 
-    std::set<int64_t> orphanedBlocks;
+    const int64_t newSize = result.first->getSize() + result.second->getSize();
 
-    for (const auto block : mWaveBlocks)
+    if (newSize >= oldSize)
     {
-        if (block.isSilence())
-            continue;
-
-        if (availableBlocks.count(block.getBlockId()) == 0)
-            orphanedBlocks.emplace(block.getBlockId());
+        fmt::print("Project document is already compact: {} bytes\n", oldSize);
+        return;
     }
 
     mDb.reopenReadonlyAsWritable();
 
-    if (!orphanedBlocks.empty())
-    {
-        mDb.DB().exec("BEGIN;");
-
-        for (auto blockId : orphanedBlocks)
-        {
-            mDb.DB().exec(fmt::format(
-                "DELETE FROM sampleblocks WHERE blockid = {};", blockId));
-        }
-
-        mDb.DB().exec("COMMIT;");
-
-        fmt::print("Removed {} orphaned blocks\n", orphanedBlocks.size());
-    }
+    WriteProjectBlob(mDb.DB(), table, *result.first, *result.second);
 
-    mDb.DB().exec("VACUUM;");
+    fmt::print(
+        "Project document was compacted from {} to {} bytes ({:.1f}% smaller)\n",
+        oldSize, newSize, 100.0 * (oldSize - newSize) / oldSize);
 }
 
-void AudacityProject::extractClips() const
+namespace
 {
-    const auto directory = mDb.getDataPath() / "clips";
+// Samples read on every side of a block boundary
+constexpr size_t BoundaryWindowSize = 32;
+constexpr size_t BoundaryJoinSize = 2 * BoundaryWindowSize;
+// A jump across the boundary is a click, if it is this many times larger
+// than the average change inside the windows...
+constexpr float BoundaryJumpRatio = 8.0f;
+// ... and is audible at all
+constexpr float BoundaryMinJump = 0.02f;
+// Length of the fades, written at the repaired boundaries
+constexpr size_t BoundaryFadeLength = 64;
+
+// Reads the parts of the sample blocks without reading the whole blobs
+class BlockSamplesReader final
+{
+public:
+    explicit BlockSamplesReader(SQLite::Database& db)
+        : mDb(db)
+    {
+    }
 
-    if (!std::filesystem::exists(directory))
-        std::filesystem::create_directories(directory);
+    ~BlockSamplesReader()
+    {
+        if (mBlob != nullptr)
+            sqlite3_blob_close(mBlob);
+    }
 
-    for (const auto& clip : mClips)
+    // Returns the number of samples stored in the block
+    // or 0 if the block is missing
+    int64_t open(int64_t blockId, SampleFormat format)
     {
-        const auto& track = *clip.getParent();
+        const int rc =
+            mBlob != nullptr ?
+                sqlite3_blob_reopen(mBlob, blockId) :
+                sqlite3_blob_open(
+                    mDb.getHandle(), "main", "sampleblocks", "samples",
+                    blockId, 0, &mBlob);
+
+        if (rc != SQLITE_OK)
+        {
+            // The handle can't be reused after a failed reopen
+            if (mBlob != nullptr)
+                sqlite3_blob_close(mBlob);
 
-        const auto clipPath =
-            directory /
-            std::filesystem::u8path(fmt::format(
-                "{}_{}_{}_{}.wav", track.getParentIndex(), track.getTrackName(),
-                clip.getParentIndex(), clip.getName()));
+            mBlob = nullptr;
+            return 0;
+        }
 
-        const auto format = SampleFormat(track.getSampleFormat());
+        mFormat = format;
+        mBytesPerSample = DiskBytesPerSample(format);
 
-        WaveFile waveFile(
-            clipPath, format, track.getSampleRate(),
-            1);
+        return sqlite3_blob_bytes(mBlob) / mBytesPerSample;
+    }
 
-        const uint16_t bytesPerSample = BytesPerSample(format);
+    void read(int64_t offset, size_t count, float* output)
+    {
+        mBuffer.resize(count * mBytesPerSample);
 
-        std::vector<uint8_t> silence;
+        const int rc = sqlite3_blob_read(
+            mBlob, mBuffer.data(), int(mBuffer.size()),
+            int(offset * mBytesPerSample));
 
-        for (auto sequence : clip)
-        {
-            silence.resize(sequence->getMaxSamples() * bytesPerSample);
-            std::uninitialized_fill(silence.begin(), silence.end(), 0);
+        if (rc != SQLITE_OK)
+            throw SQLite::Exception(mDb.getHandle(), rc);
 
-            const auto firstSample =
-                llrint(clip.getTrimLeft() * track.getSampleRate());
+        ConvertToFloat(mFormat, mBuffer.data(), count, output);
+    }
 
-            const auto lastSample =
-                sequence->getNumSamples() - llrint(clip.getTrimRight() * track.getSampleRate());
+private:
+    SQLite::Database& mDb;
+    sqlite3_blob* mBlob { nullptr };
 
-            for (auto block : *sequence)
-            {
-                auto blockStart = block->getStart();
-                auto blockLength = block->getLength();
-                auto blockEnd = blockStart + blockLength;
+    SampleFormat mFormat { SampleFormat::Float32 };
+    uint32_t mBytesPerSample { 4 };
 
-                if (blockEnd <= firstSample || blockStart >= lastSample)
-                    continue;
+    std::vector<uint8_t> mBuffer;
+};
 
-                blockStart = std::max<decltype(blockStart)>(blockStart, firstSample);
-                blockEnd = std::min<decltype(blockEnd)>(blockEnd, lastSample);
-                blockLength = blockEnd - blockStart;
+struct BlockJoin final
+{
+    const Clip* Parent;
+    WaveBlock* Previous;
+    WaveBlock* Next;
+};
 
-                if (blockLength <= 0)
-                    continue;
+struct BlockFix final
+{
+    bool FadeIn { false };
+    bool FadeOut { false };
+    // Value the block is faded in from
+    float FadeInFrom { 0.0f };
+};
 
-                const auto blockId = block->getBlockId();
+float MeanAbs(const float* data, size_t count)
+{
+    float sum = 0.0f;
 
-                if (blockId < 0)
-                {
-                    waveFile.writeBlock(
-                        silence.data(), blockLength * bytesPerSample, 0);
-                }
-                else
-                {
-                    SQLite::Statement stmt(mDb.DB(), R"(SELECT samples FROM sampleblocks WHERE blockid = ?1;)");
+    for (size_t i = 0; i < count; ++i)
+        sum += std::abs(data[i]);
 
-                    stmt.bind(1, blockId);
+    return sum / count;
+}
 
-                    while (stmt.executeStep())
-                    {
-                        const void* blobData = stmt.getColumn(0).getBlob();
-                        const int64_t blobSize = stmt.getColumn(0).getBytes();
+// Windows are BoundaryJoinSize samples long, the boundary is in the middle.
+// Returns the jump in value (first difference) and in slope
+// (second difference) across every boundary, relative to the average change
+// inside its window. Joins are processed in a batch, so the fixed size loops
+// are vectorized.
+void MeasureBoundaryJumps(
+    const std::vector<float>& windows, std::vector<float>& valueJumps,
+    std::vector<float>& slopeJumps, std::vector<float>& ratios)
+{
+    constexpr size_t b = BoundaryWindowSize;
 
-                        if (blobSize < blockLength * bytesPerSample)
-                            throw std::runtime_error(
-                                fmt::format("Unexpected blob size for sample block {}",
-                                blockId));
+    const size_t joinsCount = windows.size() / BoundaryJoinSize;
 
-                        auto data = static_cast<const uint8_t*>(blobData) + (blockStart - block->getStart()) * bytesPerSample;
+    valueJumps.resize(joinsCount);
+    slopeJumps.resize(joinsCount);
+    ratios.resize(joinsCount);
 
-                        waveFile.writeBlock(
-                            data, blockLength * bytesPerSample, 0);
-                    }
-                }
-            }
-        }
+    float d1[BoundaryJoinSize - 1];
+    float d2[BoundaryJoinSize - 2];
 
-        waveFile.writeFile();
+    for (size_t join = 0; join < joinsCount; ++join)
+    {
+        const float* x = windows.data() + join * BoundaryJoinSize;
+
+        for (size_t i = 0; i < BoundaryJoinSize - 1; ++i)
+            d1[i] = x[i + 1] - x[i];
+
+        for (size_t i = 0; i < BoundaryJoinSize - 2; ++i)
+            d2[i] = d1[i + 1] - d1[i];
+
+        const float valueJump = std::abs(d1[b - 1]);
+        const float slopeJump = std::max(std::abs(d2[b - 2]), std::abs(d2[b - 1]));
+
+        // The boundary differences are excluded from the average
+        const float meanD1 =
+            (MeanAbs(d1, BoundaryJoinSize - 1) * (BoundaryJoinSize - 1) -
+             valueJump) / (BoundaryJoinSize - 2);
+        const float meanD2 =
+            (MeanAbs(d2, BoundaryJoinSize - 2) * (BoundaryJoinSize - 2) -
+             std::abs(d2[b - 2]) - std::abs(d2[b - 1])) / (BoundaryJoinSize - 4);
+
+        valueJumps[join] = valueJump;
+        slopeJumps[join] = slopeJump;
+        ratios[join] = std::max(
+            valueJump / std::max(meanD1, 1e-6f),
+            slopeJump / std::max(meanD2, 1e-6f));
     }
 }
 
-namespace
-{
-std::string FormatTime(double seconds)
+// Fades the first samples of the block in and the last visible ones out
+void ApplyBoundaryFades(
+    std::vector<float>& samples, size_t visibleLength, const BlockFix& fix)
 {
-    if (seconds < 0)
-        return fmt::format("{}", seconds);
+    const size_t length = std::min(BoundaryFadeLength, visibleLength / 2);
+    const double pi = std::acos(-1.0);
 
-    if (seconds > 60 * 60)
-        return fmt::format(
-            "{:02}:{:02}:{:02}.{:03}", (int)seconds / 3600, (int)seconds / 60 % 60,
-            (int)seconds % 60, (int)(seconds * 1000) % 1000);
-    else if (seconds > 60)
-        return fmt::format(
-            "{:02}:{:02}.{:03}", (int)seconds / 60, (int)seconds % 60,
-            (int)(seconds * 1000) % 1000);
-    else
-        return fmt::format(
-            "{:02}.{:03}", (int)seconds, (int)(seconds * 1000) % 1000);
-}
+    for (size_t i = 0; i < length; ++i)
+    {
+        // Raised cosine, going from 0 to 1
+        const float weight =
+            float(0.5 - 0.5 * std::cos(pi * (i + 1) / (length + 1)));
 
-struct BlockStatistics final
-{
-    size_t totalUsageCount {};
-    size_t audibleUsageCount {};
-};
+        if (fix.FadeIn)
+            samples[i] = weight * samples[i] + (1.0f - weight) * fix.FadeInFrom;
+
+        if (fix.FadeOut)
+            samples[visibleLength - 1 - i] *= weight;
+    }
 }
+} // namespace
 
-void AudacityProject::printProjectStatistics() const
+size_t AudacityProject::checkBlockBoundaries(bool repair)
 {
-    std::unordered_map<int64_t, BlockStatistics> blocksStatistics;
+    std::vector<BlockJoin> joins;
+    std::vector<float> windows;
 
-    for (const auto& track : mWaveTracks)
-    {
-        fmt::print(
-            "Track {}: {}\n", track.getParentIndex(), track.getTrackName());
+    // The reader must be closed before the database is reopened as writable
+    auto reader = std::make_unique<BlockSamplesReader>(mDb.DB());
 
-        for (auto clip : track.getClips())
+    // Returns false if the block is missing or too short
+    auto readWindow = [&reader = *reader](const WaveBlock& block, bool tail, float* output)
+    {
+        if (block.isSilence())
         {
-            const int64_t firstSample =
-                int64_t((clip->getTrimLeft()) * track.getSampleRate());
+            std::fill(output, output + BoundaryWindowSize, 0.0f);
+            return true;
+        }
 
-            const int64_t lastSampleOffset =
-                int64_t(clip->getTrimRight() * track.getSampleRate());
+        const auto format =
+            static_cast<SampleFormat>(block.getParent()->getFormat());
 
-            size_t numSamples = 0;
+        const int64_t length =
+            std::min(reader.open(block.getBlockId(), format), block.getLength());
 
-            for (auto sequence : *clip)
-            {
-                numSamples += sequence->getNumSamples();
+        if (length < int64_t(BoundaryWindowSize))
+            return false;
 
-                const int64_t lastSample = sequence->getNumSamples() - lastSampleOffset;
+        reader.read(tail ? length - BoundaryWindowSize : 0, BoundaryWindowSize, output);
 
-                for (const auto& block : *sequence)
-                {
-                    auto& blockStats = blocksStatistics[block->getBlockId()];
+        return true;
+    };
 
-                    ++blockStats.totalUsageCount;
+    size_t checkedSequences = 0;
 
-                    if ((block->getStart() + block->getLength()) >= firstSample &&
-                        block->getStart() < lastSample)
-                        ++blockStats.audibleUsageCount;
-                }
-            }
+    for (const auto& sequence : mSequences)
+    {
+        if (Deadline::IsExpired())
+        {
+            Deadline::ReportPartial(fmt::format(
+                "check_boundaries: {} of {} sequences were checked",
+                checkedSequences, mSequences.size()));
+            break;
+        }
 
-            const double totalClipTime =
-                double(numSamples) / track.getSampleRate();
+        ++checkedSequences;
 
-            const double trimmedClipTime =
-                totalClipTime - clip->getTrimLeft() - clip->getTrimRight();
-            
-            fmt::print(
-                "\tClip {}: '{}'.\n\t\tTotal samples {}\n\t\tTotal time: {}\n\t\tTrimmed time: {}\n\t\tTrimmed / Total: {:.4f}%\n",
-                clip->getParentIndex(), clip->getName(), numSamples,
-                FormatTime(totalClipTime), FormatTime(trimmedClipTime),
-                trimmedClipTime / totalClipTime * 100.0);
+        WaveBlock* previous = nullptr;
+
+        for (auto block : sequence)
+        {
+            if (previous != nullptr && !(previous->isSilence() && block->isSilence()))
+            {
+                const size_t offset = windows.size();
+                windows.resize(offset + BoundaryJoinSize);
+
+                if (readWindow(*previous, true, windows.data() + offset) &&
+                    readWindow(*block, false, windows.data() + offset + BoundaryWindowSize))
+                    joins.push_back({ sequence.getParent(), previous, block });
+                else
+                    windows.resize(offset);
+            }
+
+            previous = block;
         }
     }
 
-    const auto silentBlocksCount = std::count_if(
-        blocksStatistics.begin(), blocksStatistics.end(),
-        [](const auto& p) { return p.second.audibleUsageCount == 0; });
+    reader.reset();
 
-    const auto unsharedBlocksCount = std::count_if(
-        blocksStatistics.begin(), blocksStatistics.end(),
-        [](const auto& p) { return p.second.totalUsageCount == 1; });
+    std::vector<float> valueJumps;
+    std::vector<float> slopeJumps;
+    std::vector<float> ratios;
 
-    const auto unsharedSilentBlocks = std::count_if(
-        blocksStatistics.begin(), blocksStatistics.end(),
-        [](const auto& p) {
-            return p.second.audibleUsageCount == 0 &&
-                   p.second.totalUsageCount == 1;
-        });
+    MeasureBoundaryJumps(windows, valueJumps, slopeJumps, ratios);
 
-    fmt::print(
-        "Total blocks in project: {}\n\tSilent blocks count: {} ({:02.5}%)\nNot shared blocks count: {} ({:02.5}%)\n\tSilent blocks count: {} ({:02.5}%)\n",
-        blocksStatistics.size(), silentBlocksCount,
-        double(silentBlocksCount) / blocksStatistics.size() * 100.0,
-        unsharedBlocksCount,
-        double(unsharedBlocksCount) / blocksStatistics.size() * 100.0,
-        unsharedSilentBlocks,
-        double(unsharedSilentBlocks) / unsharedBlocksCount * 100.0);
-}
+    // Fixes of the same block come from the adjacent joins
+    std::vector<std::pair<WaveBlock*, BlockFix>> fixes;
+    size_t flaggedJoins = 0;
 
-std::string_view AudacityProject::CacheString(std::string_view view, bool reuse)
-{
-    if (reuse)
+    auto getFix = [&fixes](WaveBlock* block) -> BlockFix&
     {
-        auto it = std::find(mReusableStringsCache.begin(), mReusableStringsCache.end(), view);
+        if (fixes.empty() || fixes.back().first != block)
+            fixes.emplace_back(block, BlockFix {});
 
-        if (it != mReusableStringsCache.end())
-            return *it;
+        return fixes.back().second;
+    };
 
-        mReusableStringsCache.emplace_back(view);
-        return mReusableStringsCache.back();
-    }
-    else
+    for (size_t index = 0; index < joins.size(); ++index)
     {
-        mStringCache.emplace_back(view);
-        return mStringCache.back();
-    }
-}
+        const float jump = std::max(valueJumps[index], slopeJumps[index]);
 
-using DeserializedNodeStackElement = std::variant<std::monostate, WaveBlock*, Sequence*, Clip*, WaveTrack*>;
+        if (ratios[index] < BoundaryJumpRatio || jump < BoundaryMinJump)
+            continue;
 
-struct AudacityProject::ParserState
-{
-    std::vector<ProjectTreeNode*> NodesStack;
+        ++flaggedJoins;
+
+        const auto& join = joins[index];
+        const auto clip = join.Parent;
+        const auto track = clip->getParent();
+
+        fmt::print(
+            "Discontinuity in track {} ({}), clip {} at {:.3f}s between blocks {} and {}: value jump {:.3f}, slope jump {:.3f}\n",
+            track->getParentIndex(), track->getTrackName(),
+            clip->getParentIndex(),
+            clip->getOffset() + double(join.Next->getStart()) / track->getSampleRate(),
+            join.Previous->getBlockId(), join.Next->getBlockId(),
+            valueJumps[index], slopeJumps[index]);
+
+        // Audio is faded in from the last value of the previous block.
+        // Audio followed by silence is faded out.
+        if (!join.Next->isSilence())
+        {
+            auto& fix = getFix(join.Next);
+            fix.FadeIn = true;
+            fix.FadeInFrom =
+                windows[index * BoundaryJoinSize + BoundaryWindowSize - 1];
+        }
+        else
+        {
+            getFix(join.Previous).FadeOut = true;
+        }
+    }
+
+    fmt::print(
+        "{} block boundaries were checked, {} discontinuities were found\n",
+        joins.size(), flaggedJoins);
+
+    if (!repair || fixes.empty())
+        return flaggedJoins;
+
+    mDb.reopenReadonlyAsWritable();
+
+    reader = std::make_unique<BlockSamplesReader>(mDb.DB());
+
+    std::vector<float> samples;
+    std::vector<uint8_t> data;
+
+    for (auto& [block, fix] : fixes)
+    {
+        const auto format =
+            static_cast<SampleFormat>(block->getParent()->getFormat());
+
+        const int64_t length = reader->open(block->getBlockId(), format);
+
+        samples.resize(length);
+        reader->read(0, length, samples.data());
+
+        ApplyBoundaryFades(
+            samples, size_t(std::min(length, block->getLength())), fix);
+
+        data.resize(length * DiskBytesPerSample(format));
+        ConvertFromFloat(format, samples.data(), length, data.data());
+
+        const int64_t blockId =
+            InsertSampleBlock(mDb.DB(), format, data.data(), length);
+
+        fmt::print(
+            "Block {} was replaced with the faded block {}\n",
+            block->getBlockId(), blockId);
+
+        block->setBlockId(blockId);
+    }
+
+    reader.reset();
+
+    CacheString("badblock", true);
+
+    saveProject();
+
+    return flaggedJoins;
+}
+
+namespace
+{
+// Block metadata from the sampleblocks table
+struct CatalogBlock final
+{
+    int64_t BlockId;
+    int32_t Format;
+    int64_t Bytes;
+};
+
+enum class IssueSeverity
+{
+    Warning,
+    Error
+};
+
+class ValidationReport final
+{
+public:
+    void add(
+        IssueSeverity severity, std::string_view location,
+        std::string_view message, bool fixed)
+    {
+        fmt::print(
+            "[{}] {}: {}{}\n",
+            severity == IssueSeverity::Error ? "error" : "warning", location,
+            message, fixed ? " (fixed)" : "");
+
+        if (severity == IssueSeverity::Error)
+            ++mErrors;
+        else
+            ++mWarnings;
+
+        if (fixed)
+            ++mFixed;
+    }
+
+    size_t getErrors() const noexcept
+    {
+        return mErrors;
+    }
+
+    size_t getWarnings() const noexcept
+    {
+        return mWarnings;
+    }
+
+    size_t getFixed() const noexcept
+    {
+        return mFixed;
+    }
+
+private:
+    size_t mErrors { 0 };
+    size_t mWarnings { 0 };
+    size_t mFixed { 0 };
+};
+
+struct ClipRange final
+{
+    double Start;
+    double End;
+    const Clip* Parent;
+};
+} // namespace
+
+size_t AudacityProject::validateProject(bool repair)
+{
+    // Block ids are the rowids, so the catalog is read in the b-tree order
+    std::vector<CatalogBlock> catalog;
+
+    SQLite::Statement stmt(
+        mDb.DB(),
+        "SELECT blockid, sampleformat, length(samples) FROM sampleblocks ORDER BY blockid;");
+
+    while (stmt.executeStep())
+    {
+        catalog.push_back(
+            { stmt.getColumn(0).getInt64(), stmt.getColumn(1).getInt(),
+              stmt.getColumn(2).getInt64() });
+    }
+
+    auto findBlock = [&catalog](int64_t blockId) -> const CatalogBlock*
+    {
+        auto it = std::lower_bound(
+            catalog.begin(), catalog.end(), blockId,
+            [](const auto& block, int64_t id) { return block.BlockId < id; });
+
+        return it != catalog.end() && it->BlockId == blockId ? &*it : nullptr;
+    };
+
+    ValidationReport report;
+
+    std::vector<int64_t> lengths;
+    std::vector<WaveBlock*> lostBlocks;
+    std::vector<ClipRange> clips;
+    std::vector<double> trackEnds;
+
+    for (auto& track : mWaveTracks)
+    {
+        if (Deadline::IsExpired())
+        {
+            Deadline::ReportPartial(fmt::format(
+                "validate_project: {} of {} tracks were validated",
+                trackEnds.size(), mWaveTracks.size()));
+            break;
+        }
+
+        const double rate = track.getSampleRate();
+
+        clips.clear();
+
+        for (auto clip : track.getClips())
+        {
+            const auto location = fmt::format(
+                "track {} ({}), clip {} ({})", track.getParentIndex(),
+                track.getTrackName(), clip->getParentIndex(), clip->getName());
+
+            int64_t clipSamples = 0;
+
+            for (auto sequence : *clip)
+            {
+                const auto format = sequence->getFormat();
+
+                // Lengths are taken before any block is moved
+                lengths.clear();
+                lostBlocks.clear();
+
+                for (auto block : *sequence)
+                {
+                    if (block->isSilence())
+                    {
+                        lengths.push_back(-block->getBlockId());
+                        continue;
+                    }
+
+                    auto catalogBlock = findBlock(block->getBlockId());
+
+                    if (catalogBlock == nullptr || catalogBlock->Format != format)
+                    {
+                        report.add(
+                            IssueSeverity::Error, location,
+                            catalogBlock == nullptr ?
+                                fmt::format(
+                                    "block {} is missing", block->getBlockId()) :
+                                fmt::format(
+                                    "block {} has unexpected sample format",
+                                    block->getBlockId()),
+                            repair);
+
+                        lengths.push_back(block->getLength());
+                        lostBlocks.push_back(block);
+                        continue;
+                    }
+
+                    lengths.push_back(
+                        catalogBlock->Bytes /
+                        DiskBytesPerSample(static_cast<SampleFormat>(format)));
+                }
+
+                int64_t nextBlockStart = 0;
+                int64_t longestBlock = 0;
+                size_t blockIndex = 0;
+
+                for (auto block : *sequence)
+                {
+                    const int64_t length = lengths[blockIndex++];
+
+                    if (block->getStart() != nextBlockStart)
+                    {
+                        report.add(
+                            IssueSeverity::Error, location,
+                            fmt::format(
+                                "block {} starts at {}, expected {}",
+                                block->getBlockId(), block->getStart(),
+                                nextBlockStart),
+                            repair);
+
+                        if (repair)
+                            block->setStart(nextBlockStart);
+                    }
+
+                    nextBlockStart += length;
+                    longestBlock = std::max(longestBlock, length);
+                }
+
+                if (longestBlock > sequence->getMaxSamples())
+                {
+                    report.add(
+                        IssueSeverity::Error, location,
+                        fmt::format(
+                            "block of {} samples exceeds maxsamples {}",
+                            longestBlock, sequence->getMaxSamples()),
+                        repair);
+
+                    if (repair)
+                        sequence->setMaxSamples(longestBlock);
+                }
+
+                if (sequence->getNumSamples() != nextBlockStart)
+                {
+                    report.add(
+                        IssueSeverity::Error, location,
+                        fmt::format(
+                            "numsamples is {}, blocks contain {} samples",
+                            sequence->getNumSamples(), nextBlockStart),
+                        repair);
+
+                    if (repair)
+                        sequence->setNumSamples(nextBlockStart);
+                }
+
+                // Block lengths are consistent with the starts now
+                if (repair)
+                {
+                    for (auto block : lostBlocks)
+                        block->convertToSilence();
+                }
+
+                clipSamples = std::max(clipSamples, nextBlockStart);
+            }
+
+            const double start = clip->getOffset() + clip->getTrimLeft();
+            const double end = clip->getOffset() + clipSamples / rate -
+                               clip->getTrimRight();
+
+            if (end < start)
+            {
+                report.add(
+                    IssueSeverity::Error, location,
+                    "clip is trimmed beyond its length", false);
+            }
+
+            clips.push_back({ start, end, clip });
+        }
+
+        std::sort(
+            clips.begin(), clips.end(),
+            [](const auto& lhs, const auto& rhs) { return lhs.Start < rhs.Start; });
+
+        // A clip can overlap any earlier clip, so it is compared with
+        // the one ending last. Overlaps shorter than a sample come from
+        // the rounding.
+        for (size_t index = 1, lastEnding = 0; index < clips.size(); ++index)
+        {
+            const auto& previous = clips[lastEnding];
+            const auto& clip = clips[index];
+
+            const double overlap =
+                std::min(previous.End, clip.End) - clip.Start;
+
+            if (overlap > 1.0 / rate)
+            {
+                report.add(
+                    IssueSeverity::Warning,
+                    fmt::format(
+                        "track {} ({})", track.getParentIndex(),
+                        track.getTrackName()),
+                    fmt::format(
+                        "clips {} and {} overlap by {:.6f}s",
+                        previous.Parent->getParentIndex(),
+                        clip.Parent->getParentIndex(), overlap),
+                    false);
+            }
+
+            if (clip.End > previous.End)
+                lastEnding = index;
+        }
+
+        trackEnds.push_back(clips.empty() ? 0.0 : std::max_element(
+            clips.begin(), clips.end(),
+            [](const auto& lhs, const auto& rhs) { return lhs.End < rhs.End; })->End);
+    }
+
+    for (size_t index = 0; index < trackEnds.size(); ++index)
+    {
+        auto& track = mWaveTracks[index];
+
+        if (!track.isLinked())
+            continue;
+
+        const auto location = fmt::format(
+            "track {} ({})", track.getParentIndex(), track.getTrackName());
+
+        if (index + 1 >= mWaveTracks.size())
+        {
+            report.add(
+                IssueSeverity::Error, location,
+                "track is linked, but has no right channel", repair);
+
+            if (repair)
+                track.setLinked(false);
+
+            continue;
+        }
+
+        const auto& pair = mWaveTracks[++index];
+
+        if (pair.getSampleRate() != track.getSampleRate())
+        {
+            report.add(
+                IssueSeverity::Warning, location,
+                fmt::format(
+                    "stereo channels have different rates: {} and {}",
+                    track.getSampleRate(), pair.getSampleRate()),
+                false);
+        }
+        else if (
+            index < trackEnds.size() &&
+            std::abs(trackEnds[index] - trackEnds[index - 1]) >
+                1.0 / track.getSampleRate())
+        {
+            report.add(
+                IssueSeverity::Warning, location,
+                fmt::format(
+                    "stereo channels have different lengths: {:.6f}s and {:.6f}s",
+                    trackEnds[index - 1], trackEnds[index]),
+                false);
+        }
+    }
+
+    fmt::print(
+        "Validation has found {} errors and {} warnings, {} were fixed\n",
+        report.getErrors(), report.getWarnings(), report.getFixed());
+
+    if (report.getFixed() > 0)
+    {
+        CacheString("badblock", true);
+
+        saveProject();
+    }
+
+    // Only the errors are repaired
+    return report.getErrors() - report.getFixed();
+}
+
+void AudacityProject::removeUnusedBlocks()
+{
+    // Read all the available blocks from the DB first
+
+    SQLite::Statement readBlocksList(
+        mDb.DB(), R"(SELECT blockid FROM sampleblocks)");
+
+    BlockIdSet availableBlocks;
+
+    while (readBlocksList.executeStep())
+        availableBlocks.emplace(readBlocksList.getColumn(0).getInt64());
+
+    readBlocksList.reset();
+
+    BlockIdSet orphanedBlocks;
+
+    for (const auto block : mWaveBlocks)
+    {
+        if (block.isSilence())
+            continue;
+
+        if (availableBlocks.count(block.getBlockId()) == 0)
+            orphanedBlocks.emplace(block.getBlockId());
+    }
+
+    mDb.reopenReadonlyAsWritable();
+
+    if (!orphanedBlocks.empty())
+    {
+        mDb.DB().exec("BEGIN;");
+
+        for (auto blockId : orphanedBlocks)
+        {
+            mDb.DB().exec(fmt::format(
+                "DELETE FROM sampleblocks WHERE blockid = {};", blockId));
+        }
+
+        mDb.DB().exec("COMMIT;");
+
+        fmt::print("Removed {} orphaned blocks\n", orphanedBlocks.size());
+    }
+
+    mDb.DB().exec("VACUUM;");
+}
+
+namespace
+{
+// Part of a clip: a range of a sample block or silence
+struct ClipRead final
+{
+    int64_t BlockId;
+    size_t Offset;
+    size_t Size;
+    size_t BlockSize;
+};
+
+// Blocks are read in the block id order within the window
+constexpr size_t ReorderWindowSize = 64 * 1024 * 1024;
+} // namespace
+
+void AudacityProject::extractClips() const
+{
+    const auto directory = mDb.getDataPath() / "clips";
+
+    if (!std::filesystem::exists(directory))
+        std::filesystem::create_directories(directory);
+
+    // Collect the reads in the timeline order first
+    std::vector<ClipRead> reads;
+    std::vector<size_t> clipFirstRead;
+
+    size_t maxSilenceSize = 0;
+
+    for (const auto& clip : mClips)
+    {
+        clipFirstRead.push_back(reads.size());
+
+        const auto& track = *clip.getParent();
+
+        const uint16_t bytesPerSample =
+            BytesPerSample(SampleFormat(track.getSampleFormat()));
+
+        for (auto sequence : clip)
+        {
+            const auto firstSample =
+                llrint(clip.getTrimLeft() * track.getSampleRate());
+
+            const auto lastSample =
+                sequence->getNumSamples() - llrint(clip.getTrimRight() * track.getSampleRate());
+
+            for (auto block : *sequence)
+            {
+                auto blockStart = block->getStart();
+                auto blockLength = block->getLength();
+                auto blockEnd = blockStart + blockLength;
+
+                if (blockEnd <= firstSample || blockStart >= lastSample)
+                    continue;
+
+                blockStart = std::max<decltype(blockStart)>(blockStart, firstSample);
+                blockEnd = std::min<decltype(blockEnd)>(blockEnd, lastSample);
+                blockLength = blockEnd - blockStart;
+
+                if (blockLength <= 0)
+                    continue;
+
+                const size_t size = blockLength * bytesPerSample;
+
+                if (block->getBlockId() < 0)
+                    maxSilenceSize = std::max(maxSilenceSize, size);
+
+                reads.push_back(
+                    { block->getBlockId(),
+                      size_t(blockStart - block->getStart()) * bytesPerSample,
+                      size, size_t(block->getLength()) * bytesPerSample });
+            }
+        }
+    }
+
+    clipFirstRead.push_back(reads.size());
+
+    const std::vector<uint8_t> silence(maxSilenceSize);
+
+    AsyncFileWriter writer;
+
+    std::unique_ptr<WaveFile> waveFile;
+    size_t clipIndex = 0;
+
+    auto openNextClip = [&]()
+    {
+        if (waveFile != nullptr)
+            waveFile->writeFile(writer);
+
+        const auto& clip = mClips[clipIndex++];
+        const auto& track = *clip.getParent();
+
+        const auto clipPath =
+            directory /
+            std::filesystem::u8path(fmt::format(
+                "{}_{}_{}_{}.wav", track.getParentIndex(), track.getTrackName(),
+                clip.getParentIndex(), clip.getName()));
+
+        waveFile = std::make_unique<WaveFile>(
+            clipPath, SampleFormat(track.getSampleFormat()),
+            track.getSampleRate(), 1);
+    };
+
+    SQLite::Statement stmt(
+        mDb.DB(), R"(SELECT samples FROM sampleblocks WHERE blockid = ?1;)");
+
+    std::unordered_map<int64_t, std::vector<uint8_t>> payloads;
+    std::vector<int64_t> windowBlocks;
+
+    size_t windowStart = 0;
+    bool interrupted = false;
+
+    while (windowStart < reads.size())
+    {
+        if (Deadline::IsExpired())
+        {
+            // The clip, that is open now, has all the reads before windowStart
+            const bool lastClipComplete =
+                clipIndex == 0 || clipFirstRead[clipIndex] <= windowStart;
+
+            Deadline::ReportPartial(fmt::format(
+                "extract_clips: {} of {} clips were extracted{}",
+                lastClipComplete ? clipIndex : clipIndex - 1, mClips.size(),
+                lastClipComplete ? "" : ", the last clip is incomplete"));
+
+            interrupted = true;
+            break;
+        }
+
+        size_t windowEnd = windowStart;
+        size_t windowSize = 0;
+
+        BlockIdSet requestedBlocks;
+
+        for (; windowEnd < reads.size(); ++windowEnd)
+        {
+            const auto& read = reads[windowEnd];
+
+            if (read.BlockId < 0 || requestedBlocks.count(read.BlockId))
+                continue;
+
+            if (windowSize + read.BlockSize > ReorderWindowSize && windowEnd > windowStart)
+                break;
+
+            requestedBlocks.emplace(read.BlockId);
+            windowSize += read.BlockSize;
+        }
+
+        // Block id is the rowid, so ascending ids follow the b-tree order
+        for (auto blockId : requestedBlocks)
+        {
+            stmt.bind(1, blockId);
+
+            if (stmt.executeStep())
+            {
+                const auto column = stmt.getColumn(0);
+                const auto data = static_cast<const uint8_t*>(column.getBlob());
+
+                payloads[blockId].assign(data, data + column.getBytes());
+            }
+
+            stmt.reset();
+        }
+
+        for (size_t readIndex = windowStart; readIndex < windowEnd; ++readIndex)
+        {
+            while (clipFirstRead[clipIndex] <= readIndex)
+                openNextClip();
+
+            const auto& read = reads[readIndex];
+
+            if (read.BlockId < 0)
+            {
+                waveFile->writeBlock(silence.data(), read.Size, 0);
+                continue;
+            }
+
+            auto it = payloads.find(read.BlockId);
+
+            if (it == payloads.end())
+                continue;
+
+            if (it->second.size() < read.Offset + read.Size)
+                throw std::runtime_error(fmt::format(
+                    "Unexpected blob size for sample block {}", read.BlockId));
+
+            waveFile->writeBlock(it->second.data() + read.Offset, read.Size, 0);
+        }
+
+        payloads.clear();
+        windowStart = windowEnd;
+    }
+
+    while (!interrupted && clipIndex < mClips.size())
+        openNextClip();
+
+    if (waveFile != nullptr)
+        waveFile->writeFile(writer);
+
+    writer.wait();
+}
+
+namespace
+{
+// Part of a track timeline: a range of a sample block or silence
+struct StemRead final
+{
+    size_t Track;
+    int64_t Position;
+    int64_t BlockId;
+    SampleFormat Format;
+    size_t Offset;
+    size_t Length;
+};
+
+struct StemTrack final
+{
+    // Samples converted, but not yet passed to the writer
+    std::vector<float> Pending;
+    // Timeline position after the last pending sample
+    int64_t End { 0 };
+
+    void appendSilence(int64_t position)
+    {
+        if (position > End)
+        {
+            Pending.resize(Pending.size() + (position - End), 0.0f);
+            End = position;
+        }
+    }
+};
+
+struct StemOutput final
+{
+    std::unique_ptr<WaveFileStream> Stream;
+    std::vector<size_t> Tracks;
+};
+
+// Passes the frames, available in all the channels of the output, to the writer
+void FlushStem(StemOutput& output, std::vector<StemTrack>& tracks)
+{
+    size_t framesCount = std::numeric_limits<size_t>::max();
+
+    for (auto track : output.Tracks)
+        framesCount = std::min(framesCount, tracks[track].Pending.size());
+
+    if (framesCount == 0)
+        return;
+
+    const size_t channelsCount = output.Tracks.size();
+
+    std::vector<float> frames(framesCount * channelsCount);
+
+    for (size_t channel = 0; channel < channelsCount; ++channel)
+    {
+        auto& pending = tracks[output.Tracks[channel]].Pending;
+
+        for (size_t frame = 0; frame < framesCount; ++frame)
+            frames[frame * channelsCount + channel] = pending[frame];
+
+        pending.erase(pending.begin(), pending.begin() + framesCount);
+    }
+
+    output.Stream->write(std::move(frames));
+}
+} // namespace
+
+void AudacityProject::exportStems(SampleFormat format, bool multichannel) const
+{
+    if (mWaveTracks.empty())
+    {
+        fmt::print("Project has no wave tracks\n");
+        return;
+    }
+
+    const auto directory = mDb.getDataPath() / "stems";
+
+    if (!std::filesystem::exists(directory))
+        std::filesystem::create_directories(directory);
+
+    std::vector<StemOutput> outputs;
+
+    if (multichannel)
+    {
+        const auto sampleRate = mWaveTracks.front().getSampleRate();
+
+        for (const auto& track : mWaveTracks)
+        {
+            if (track.getSampleRate() != sampleRate)
+                throw std::runtime_error(
+                    "Tracks with different sample rates can't be exported into a single file");
+        }
+
+        outputs.emplace_back();
+        outputs.back().Stream = std::make_unique<WaveFileStream>(
+            directory / "stems.wav", format, sampleRate,
+            uint16_t(mWaveTracks.size()));
+
+        for (size_t index = 0; index < mWaveTracks.size(); ++index)
+            outputs.back().Tracks.push_back(index);
+    }
+    else
+    {
+        // Stereo pairs are written into the same file
+        for (size_t index = 0; index < mWaveTracks.size(); ++index)
+        {
+            const auto& track = mWaveTracks[index];
+
+            std::vector<size_t> channels { index };
+
+            if (
+                track.isLinked() && index + 1 < mWaveTracks.size() &&
+                mWaveTracks[index + 1].getSampleRate() == track.getSampleRate())
+                channels.push_back(++index);
+
+            const auto path =
+                directory / std::filesystem::u8path(fmt::format(
+                                "{}_{}.wav", track.getParentIndex(),
+                                track.getTrackName()));
+
+            outputs.push_back(
+                { std::make_unique<WaveFileStream>(
+                      path, format, track.getSampleRate(),
+                      uint16_t(channels.size())),
+                  std::move(channels) });
+        }
+    }
+
+    // Collect the reads of all the tracks and sweep the timeline once
+    std::vector<StemRead> reads;
+    int64_t timelineEnd = 0;
+
+    for (size_t trackIndex = 0; trackIndex < mWaveTracks.size(); ++trackIndex)
+    {
+        const auto& track = mWaveTracks[trackIndex];
+        const auto rate = track.getSampleRate();
+        const auto trackFormat = SampleFormat(track.getSampleFormat());
+
+        for (auto clip : track.getClips())
+        {
+            const auto firstSample = llrint(clip->getTrimLeft() * rate);
+            const auto clipStart =
+                llrint((clip->getOffset() + clip->getTrimLeft()) * rate);
+
+            for (auto sequence : *clip)
+            {
+                const auto lastSample =
+                    sequence->getNumSamples() - llrint(clip->getTrimRight() * rate);
+
+                for (auto block : *sequence)
+                {
+                    // Samples before the project start are dropped
+                    const int64_t blockStart = std::max<int64_t>(
+                        { block->getStart(), firstSample,
+                          firstSample - clipStart });
+                    const int64_t blockEnd = std::min<int64_t>(
+                        block->getStart() + block->getLength(), lastSample);
+
+                    if (blockEnd <= blockStart)
+                        continue;
+
+                    const int64_t position = clipStart + blockStart - firstSample;
+
+                    reads.push_back(
+                        { trackIndex, position, block->getBlockId(), trackFormat,
+                          size_t(blockStart - block->getStart()),
+                          size_t(blockEnd - blockStart) });
+
+                    timelineEnd = std::max<int64_t>(
+                        timelineEnd, position + blockEnd - blockStart);
+                }
+            }
+        }
+    }
+
+    std::stable_sort(
+        reads.begin(), reads.end(),
+        [](const auto& lhs, const auto& rhs)
+        { return lhs.Position < rhs.Position; });
+
+    std::vector<StemTrack> tracks(mWaveTracks.size());
+
+    SQLite::Statement stmt(
+        mDb.DB(), R"(SELECT samples FROM sampleblocks WHERE blockid = ?1;)");
+
+    std::unordered_map<int64_t, std::vector<uint8_t>> payloads;
+
+    size_t windowStart = 0;
+
+    while (windowStart < reads.size())
+    {
+        if (Deadline::IsExpired())
+        {
+            const auto position = reads[windowStart].Position;
+
+            Deadline::ReportPartial(fmt::format(
+                "export_stems: {} of {} samples were exported", position,
+                timelineEnd));
+
+            timelineEnd = position;
+            break;
+        }
+
+        size_t windowEnd = windowStart;
+        size_t windowSize = 0;
+
+        BlockIdSet requestedBlocks;
+
+        for (; windowEnd < reads.size(); ++windowEnd)
+        {
+            const auto& read = reads[windowEnd];
+
+            if (read.BlockId < 0 || requestedBlocks.count(read.BlockId))
+                continue;
+
+            const size_t blockSize =
+                (read.Offset + read.Length) * DiskBytesPerSample(read.Format);
+
+            if (windowSize + blockSize > ReorderWindowSize && windowEnd > windowStart)
+                break;
+
+            requestedBlocks.emplace(read.BlockId);
+            windowSize += blockSize;
+        }
+
+        // Blocks shared between the tracks are read once
+        for (auto blockId : requestedBlocks)
+        {
+            stmt.bind(1, blockId);
+
+            if (stmt.executeStep())
+            {
+                const auto column = stmt.getColumn(0);
+                const auto data = static_cast<const uint8_t*>(column.getBlob());
+
+                payloads[blockId].assign(data, data + column.getBytes());
+            }
+
+            stmt.reset();
+        }
+
+        for (size_t readIndex = windowStart; readIndex < windowEnd; ++readIndex)
+        {
+            const auto& read = reads[readIndex];
+            auto& track = tracks[read.Track];
+
+            track.appendSilence(read.Position);
+
+            // Overlapping clips: the earlier clip wins
+            const size_t skipped =
+                size_t(std::min<int64_t>(track.End - read.Position, read.Length));
+            const size_t length = read.Length - skipped;
+
+            if (length == 0)
+                continue;
+
+            const size_t pendingSize = track.Pending.size();
+            track.Pending.resize(pendingSize + length, 0.0f);
+            track.End += length;
+
+            // Silence and missing blocks are left as zeros
+            if (read.BlockId < 0)
+                continue;
+
+            auto it = payloads.find(read.BlockId);
+
+            if (it == payloads.end())
+                continue;
+
+            const size_t bytesPerSample = DiskBytesPerSample(read.Format);
+            const size_t offset = (read.Offset + skipped) * bytesPerSample;
+
+            if (it->second.size() < offset + length * bytesPerSample)
+                throw std::runtime_error(fmt::format(
+                    "Unexpected blob size for sample block {}", read.BlockId));
+
+            ConvertToFloat(
+                read.Format, it->second.data() + offset, length,
+                track.Pending.data() + pendingSize);
+        }
+
+        payloads.clear();
+        windowStart = windowEnd;
+
+        // No track has samples before the next read, so the gaps are silent
+        // and every output can be flushed up to it
+        if (windowStart < reads.size())
+        {
+            for (auto& track : tracks)
+                track.appendSilence(reads[windowStart].Position);
+        }
+
+        for (auto& output : outputs)
+            FlushStem(output, tracks);
+    }
+
+    // Stems are padded to the same length
+    for (auto& track : tracks)
+        track.appendSilence(timelineEnd);
+
+    for (auto& output : outputs)
+    {
+        FlushStem(output, tracks);
+        output.Stream->finish();
+    }
+
+    fmt::print(
+        "{} stems were written to {}\n", outputs.size(), directory.u8string());
+}
+
+namespace
+{
+std::string FormatTime(double seconds)
+{
+    if (seconds < 0)
+        return fmt::format("{}", seconds);
+
+    if (seconds > 60 * 60)
+        return fmt::format(
+            "{:02}:{:02}:{:02}.{:03}", (int)seconds / 3600, (int)seconds / 60 % 60,
+            (int)seconds % 60, (int)(seconds * 1000) % 1000);
+    else if (seconds > 60)
+        return fmt::format(
+            "{:02}:{:02}.{:03}", (int)seconds / 60, (int)seconds % 60,
+            (int)(seconds * 1000) % 1000);
+    else
+        return fmt::format(
+            "{:02}.{:03}", (int)seconds, (int)(seconds * 1000) % 1000);
+}
+
+struct BlockStatistics final
+{
+    size_t totalUsageCount {};
+    size_t audibleUsageCount {};
+};
+}
+
+void AudacityProject::printProjectStatistics() const
+{
+    std::unordered_map<int64_t, BlockStatistics> blocksStatistics;
+
+    for (const auto& track : mWaveTracks)
+    {
+        fmt::print(
+            "Track {}: {}\n", track.getParentIndex(), track.getTrackName());
+
+        for (auto clip : track.getClips())
+        {
+            const int64_t firstSample =
+                int64_t((clip->getTrimLeft()) * track.getSampleRate());
+
+            const int64_t lastSampleOffset =
+                int64_t(clip->getTrimRight() * track.getSampleRate());
+
+            size_t numSamples = 0;
+
+            for (auto sequence : *clip)
+            {
+                numSamples += sequence->getNumSamples();
+
+                const int64_t lastSample = sequence->getNumSamples() - lastSampleOffset;
+
+                for (const auto& block : *sequence)
+                {
+                    auto& blockStats = blocksStatistics[block->getBlockId()];
+
+                    ++blockStats.totalUsageCount;
+
+                    if ((block->getStart() + block->getLength()) >= firstSample &&
+                        block->getStart() < lastSample)
+                        ++blockStats.audibleUsageCount;
+                }
+            }
+
+            const double totalClipTime =
+                double(numSamples) / track.getSampleRate();
+
+            const double trimmedClipTime =
+                totalClipTime - clip->getTrimLeft() - clip->getTrimRight();
+            
+            fmt::print(
+                "\tClip {}: '{}'.\n\t\tTotal samples {}\n\t\tTotal time: {}\n\t\tTrimmed time: {}\n\t\tTrimmed / Total: {:.4f}%\n",
+                clip->getParentIndex(), clip->getName(), numSamples,
+                FormatTime(totalClipTime), FormatTime(trimmedClipTime),
+                trimmedClipTime / totalClipTime * 100.0);
+        }
+    }
+
+    const auto silentBlocksCount = std::count_if(
+        blocksStatistics.begin(), blocksStatistics.end(),
+        [](const auto& p) { return p.second.audibleUsageCount == 0; });
+
+    const auto unsharedBlocksCount = std::count_if(
+        blocksStatistics.begin(), blocksStatistics.end(),
+        [](const auto& p) { return p.second.totalUsageCount == 1; });
+
+    const auto unsharedSilentBlocks = std::count_if(
+        blocksStatistics.begin(), blocksStatistics.end(),
+        [](const auto& p) {
+            return p.second.audibleUsageCount == 0 &&
+                   p.second.totalUsageCount == 1;
+        });
+
+    fmt::print(
+        "Total blocks in project: {}\n\tSilent blocks count: {} ({:02.5}%)\nNot shared blocks count: {} ({:02.5}%)\n\tSilent blocks count: {} ({:02.5}%)\n",
+        blocksStatistics.size(), silentBlocksCount,
+        double(silentBlocksCount) / blocksStatistics.size() * 100.0,
+        unsharedBlocksCount,
+        double(unsharedBlocksCount) / blocksStatistics.size() * 100.0,
+        unsharedSilentBlocks,
+        double(unsharedSilentBlocks) / unsharedBlocksCount * 100.0);
+}
+
+namespace
+{
+std::unique_ptr<ProjectTreeNode> CloneNodeShallow(const ProjectTreeNode& node)
+{
+    auto result = std::make_unique<ProjectTreeNode>();
+
+    result->TagName = node.TagName;
+    result->Attributes = node.Attributes;
+    result->ParentIndex = node.ParentIndex;
+    result->Data = node.Data;
+
+    return result;
+}
+
+void AppendChild(ProjectTreeNode& parent, std::unique_ptr<ProjectTreeNode> child)
+{
+    child->ParentIndex = parent.Children.size();
+    parent.Children.push_back(std::move(child));
+}
+
+template<typename T>
+T GetNodeAttribute(
+    const ProjectTreeNode& node, std::string_view name, T defaultValue)
+{
+    for (const auto& attr : node.Attributes)
+    {
+        if (attr.Name == name)
+            return GetAttributeValue<T>(attr.Value);
+    }
+
+    return defaultValue;
+}
+
+// Updates the attribute, preserving the original numeric type if possible
+template<typename T>
+void UpdateAttribute(ProjectTreeNode& node, std::string_view name, T value)
+{
+    for (auto& attr : node.Attributes)
+    {
+        if (attr.Name != name)
+            continue;
+
+        std::visit(
+            [&attr, value](auto&& oldValue)
+            {
+                using U = std::decay_t<decltype(oldValue)>;
+
+                if constexpr (std::is_arithmetic_v<U>)
+                    attr.Value = static_cast<U>(value);
+                else
+                    attr.Value = value;
+            },
+            attr.Value);
+
+        return;
+    }
+
+    node.Attributes.emplace_back(name, value);
+}
+
+struct CroppedBlock final
+{
+    ProjectTreeNode* Node;
+    SampleFormat Format;
+    std::vector<uint8_t> Data;
+};
+
+std::unique_ptr<ProjectTreeNode> CropEnvelope(
+    const ProjectTreeNode& envelope, double shift, double duration)
+{
+    auto result = CloneNodeShallow(envelope);
+
+    int64_t pointsCount = 0;
+
+    for (const auto& child : envelope.Children)
+    {
+        if (child->TagName != "controlpoint")
+        {
+            AppendChild(*result, child->clone());
+            continue;
+        }
+
+        const double time = GetNodeAttribute(*child, "t", 0.0) - shift;
+
+        if (time < 0.0 || time > duration)
+            continue;
+
+        auto point = child->clone();
+        UpdateAttribute(*point, "t", time);
+
+        AppendChild(*result, std::move(point));
+        ++pointsCount;
+    }
+
+    UpdateAttribute(*result, "numpoints", pointsCount);
+
+    return result;
+}
+
+std::unique_ptr<ProjectTreeNode>
+CropLabelTrack(const ProjectTreeNode& track, double start, double end)
+{
+    auto result = CloneNodeShallow(track);
+
+    int64_t labelsCount = 0;
+
+    for (const auto& child : track.Children)
+    {
+        if (child->TagName != "label")
+        {
+            AppendChild(*result, child->clone());
+            continue;
+        }
+
+        const double labelStart = GetNodeAttribute(*child, "t", 0.0);
+        const double labelEnd = GetNodeAttribute(*child, "t1", labelStart);
+
+        if (labelEnd < start || labelStart > end)
+            continue;
+
+        auto label = child->clone();
+
+        UpdateAttribute(*label, "t", std::max(labelStart, start) - start);
+        UpdateAttribute(*label, "t1", std::min(labelEnd, end) - start);
+
+        AppendChild(*result, std::move(label));
+        ++labelsCount;
+    }
+
+    UpdateAttribute(*result, "numlabels", labelsCount);
+
+    return result;
+}
+
+std::unique_ptr<ProjectTreeNode> CropSequence(
+    SQLite::Database& db, const Sequence& sequence, int64_t firstSample,
+    int64_t lastSample, BlockIdSet& copiedBlocks,
+    std::vector<CroppedBlock>& croppedBlocks)
+{
+    auto result = CloneNodeShallow(*sequence.getXMLNode());
+
+    UpdateAttribute(*result, "numsamples", lastSample - firstSample);
+
+    const auto format = SampleFormat(sequence.getFormat());
+    const auto bytesPerSample = DiskBytesPerSample(format);
+
+    for (auto block : sequence)
+    {
+        const int64_t blockStart = block->getStart();
+        const int64_t blockEnd = blockStart + block->getLength();
+
+        if (blockEnd <= firstSample || blockStart >= lastSample)
+            continue;
+
+        const int64_t cutStart = std::max(blockStart, firstSample);
+        const int64_t cutEnd = std::min(blockEnd, lastSample);
+
+        auto blockNode = CloneNodeShallow(*block->getXMLNode());
+
+        UpdateAttribute(*blockNode, "start", cutStart - firstSample);
+
+        if (block->isSilence())
+        {
+            UpdateAttribute(*blockNode, "blockid", -(cutEnd - cutStart));
+        }
+        else if (cutStart == blockStart && cutEnd == blockEnd)
+        {
+            copiedBlocks.emplace(block->getBlockId());
+        }
+        else
+        {
+            SQLite::Statement stmt(
+                db, R"(SELECT samples FROM sampleblocks WHERE blockid = ?1;)");
+
+            stmt.bind(1, block->getBlockId());
+
+            if (!stmt.executeStep())
+                throw std::runtime_error(fmt::format(
+                    "Block {} not found in the database", block->getBlockId()));
+
+            const auto blobData =
+                static_cast<const uint8_t*>(stmt.getColumn(0).getBlob());
+            const int64_t blobSize = stmt.getColumn(0).getBytes();
+
+            if (blobSize < (cutEnd - blockStart) * bytesPerSample)
+                throw std::runtime_error(fmt::format(
+                    "Unexpected blob size for sample block {}",
+                    block->getBlockId()));
+
+            croppedBlocks.push_back(
+                { blockNode.get(), format,
+                  std::vector<uint8_t>(
+                      blobData + (cutStart - blockStart) * bytesPerSample,
+                      blobData + (cutEnd - blockStart) * bytesPerSample) });
+        }
+
+        AppendChild(*result, std::move(blockNode));
+    }
+
+    return result;
+}
+
+std::unique_ptr<ProjectTreeNode> CropClip(
+    SQLite::Database& db, const Clip& clip, double start, double end,
+    BlockIdSet& copiedBlocks, std::vector<CroppedBlock>& croppedBlocks)
+{
+    const double rate = clip.getParent()->getSampleRate();
+
+    if (clip.begin() == clip.end())
+        return {};
+
+    // Audacity clips contain exactly one sequence
+    const Sequence& sequence = **clip.begin();
+
+    const int64_t firstSample = std::max<int64_t>(
+        llrint(clip.getTrimLeft() * rate),
+        llrint((start - clip.getOffset()) * rate));
+
+    const int64_t lastSample = std::min<int64_t>(
+        sequence.getNumSamples() - llrint(clip.getTrimRight() * rate),
+        llrint((end - clip.getOffset()) * rate));
+
+    if (lastSample <= firstSample)
+        return {};
+
+    auto result = CloneNodeShallow(*clip.getXMLNode());
+
+    UpdateAttribute(
+        *result, "offset", clip.getOffset() + firstSample / rate - start);
+    UpdateAttribute(*result, "trimLeft", 0.0);
+    UpdateAttribute(*result, "trimRight", 0.0);
+
+    for (const auto& child : clip.getXMLNode()->Children)
+    {
+        if (child->TagName == "sequence")
+        {
+            AppendChild(
+                *result, CropSequence(
+                             db, sequence, firstSample, lastSample,
+                             copiedBlocks, croppedBlocks));
+        }
+        else if (child->TagName == "envelope")
+        {
+            AppendChild(
+                *result, CropEnvelope(
+                             *child, firstSample / rate,
+                             (lastSample - firstSample) / rate));
+        }
+        else if (child->TagName != "waveclip")
+        {
+            // Cut lines refer to the audio outside of the range and are dropped
+            AppendChild(*result, child->clone());
+        }
+    }
+
+    return result;
+}
+} // namespace
+
+void AudacityProject::cropProject(double start, double end)
+{
+    if (start < 0.0 || !(end > start))
+        throw std::runtime_error(
+            fmt::format("Invalid crop range {}:{}", start, end));
+
+    // Make sure that all the names possibly added are in the dictionary
+    for (auto name :
+         { "offset", "trimLeft", "trimRight", "numsamples", "start", "blockid",
+           "t", "t1", "numpoints", "numlabels" })
+        CacheString(name, true);
+
+    std::unordered_map<const ProjectTreeNode*, const Clip*> clipsByNode;
+
+    for (const auto& clip : mClips)
+        clipsByNode.emplace(clip.getXMLNode(), &clip);
+
+    BlockIdSet copiedBlocks;
+    std::vector<CroppedBlock> croppedBlocks;
+
+    auto root = CloneNodeShallow(*mProjectNode);
+
+    for (const auto& child : mProjectNode->Children)
+    {
+        if (child->TagName == "wavetrack")
+        {
+            auto track = CloneNodeShallow(*child);
+
+            for (const auto& trackChild : child->Children)
+            {
+                auto it = clipsByNode.find(trackChild.get());
+
+                if (it == clipsByNode.end())
+                {
+                    AppendChild(*track, trackChild->clone());
+                    continue;
+                }
+
+                auto clip = CropClip(
+                    mDb.DB(), *it->second, start, end, copiedBlocks,
+                    croppedBlocks);
+
+                if (clip != nullptr)
+                    AppendChild(*track, std::move(clip));
+            }
+
+            AppendChild(*root, std::move(track));
+        }
+        else if (child->TagName == "labeltrack")
+        {
+            AppendChild(*root, CropLabelTrack(*child, start, end));
+        }
+        else
+        {
+            AppendChild(*root, child->clone());
+        }
+    }
+
+    auto croppedPath = mDb.getProjectPath();
+    croppedPath.replace_extension("cropped.aup3");
+
+    fmt::print(
+        "Writing {}:{} to {}\n", FormatTime(start), FormatTime(end),
+        croppedPath.u8string());
+
+    auto db = mDb.createProjectDatabase(croppedPath);
+
+    // Blocks are copied from the file
+    mDb.saveInMemoryDatabase();
+
+    const auto copiedCount = mDb.copySampleBlocks(
+        *db, std::vector<int64_t>(copiedBlocks.begin(), copiedBlocks.end()));
+
+    if (copiedCount != copiedBlocks.size())
+        fmt::print(
+            "{} blocks are missing in the source project\n",
+            copiedBlocks.size() - copiedCount);
+
+    db->exec("BEGIN;");
+
+    for (auto& block : croppedBlocks)
+    {
+        const auto blockId = InsertSampleBlock(
+            *db, block.Format, block.Data.data(),
+            block.Data.size() / DiskBytesPerSample(block.Format));
+
+        UpdateAttribute(*block.Node, "blockid", blockId);
+    }
+
+    writeProjectDocument(*db, "project", *root);
+
+    db->exec("COMMIT;");
+
+    fmt::print(
+        "Copied {} blocks, re-cut {} boundary blocks\n", copiedCount,
+        croppedBlocks.size());
+}
+
+namespace
+{
+struct SplitProject final
+{
+    std::filesystem::path Path;
+    std::unique_ptr<ProjectTreeNode> Root;
+    std::vector<int64_t> Blocks;
+};
+} // namespace
+
+void AudacityProject::splitTracks(size_t threadsCount) const
+{
+    std::vector<SplitProject> projects;
+
+    for (size_t trackIndex = 0; trackIndex < mWaveTracks.size(); ++trackIndex)
+    {
+        std::vector<const WaveTrack*> tracks { &mWaveTracks[trackIndex] };
+
+        if (mWaveTracks[trackIndex].isLinked() &&
+            trackIndex + 1 < mWaveTracks.size())
+            tracks.push_back(&mWaveTracks[++trackIndex]);
+
+        SplitProject project;
+
+        project.Path = mDb.getProjectPath();
+        project.Path.replace_extension(
+            fmt::format("track{:02}.aup3", projects.size() + 1));
+
+        // Label, note and time tracks reference no blocks, so they are kept
+        // in every project along with the other nodes
+        project.Root = CloneNodeShallow(*mProjectNode);
+
+        for (const auto& child : mProjectNode->Children)
+        {
+            const bool selected = std::any_of(
+                tracks.begin(), tracks.end(), [node = child.get()](auto track)
+                { return track->getXMLNode() == node; });
+
+            if (selected || child->TagName != "wavetrack")
+                AppendChild(*project.Root, child->clone());
+        }
+
+        BlockIdSet blocks;
+
+        for (auto track : tracks)
+        {
+            for (auto clip : track->getClips())
+            {
+                for (auto sequence : *clip)
+                {
+                    for (auto block : *sequence)
+                    {
+                        if (!block->isSilence())
+                            blocks.emplace(block->getBlockId());
+                    }
+                }
+            }
+        }
+
+        project.Blocks.assign(blocks.begin(), blocks.end());
+
+        projects.push_back(std::move(project));
+    }
+
+    if (projects.empty())
+    {
+        fmt::print("Project has no wave tracks\n");
+        return;
+    }
+
+    // Blocks are copied from the file
+    mDb.saveInMemoryDatabase();
+
+    // Writing is bound by the disk, so only a few projects are written at once
+    std::atomic<size_t> nextProject { 0 };
+    std::atomic<size_t> writtenProjects { 0 };
+    std::mutex errorMutex;
+    std::exception_ptr error;
+
+    auto worker = [&]()
+    {
+        while (true)
+        {
+            if (Deadline::IsExpired())
+                return;
+
+            const size_t index = nextProject++;
+
+            if (index >= projects.size())
+                return;
+
+            const auto& project = projects[index];
+
+            try
+            {
+                auto db = mDb.createProjectDatabase(project.Path);
+
+                const auto copiedCount =
+                    mDb.copySampleBlocks(*db, project.Blocks);
+
+                writeProjectDocument(*db, "project", *project.Root);
+
+                fmt::print(
+                    "Written {}: {} blocks{}\n", project.Path.u8string(),
+                    copiedCount,
+                    copiedCount != project.Blocks.size() ?
+                        fmt::format(
+                            ", {} are missing",
+                            project.Blocks.size() - copiedCount) :
+                        std::string());
+
+                ++writtenProjects;
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+
+                if (!error)
+                    error = std::current_exception();
+
+                // Stop picking up the new projects
+                nextProject = projects.size();
+            }
+        }
+    };
+
+    threadsCount = std::clamp<size_t>(threadsCount, 1, projects.size());
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadsCount);
+
+    for (size_t i = 0; i < threadsCount; ++i)
+        threads.emplace_back(worker);
+
+    for (auto& thread : threads)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+
+    if (writtenProjects < projects.size())
+        Deadline::ReportPartial(fmt::format(
+            "split_tracks: {} of {} projects were written", writtenProjects,
+            projects.size()));
+}
+
+std::string_view AudacityProject::CacheString(std::string_view view, bool reuse)
+{
+    if (reuse)
+    {
+        auto it = std::find(mReusableStringsCache.begin(), mReusableStringsCache.end(), view);
+
+        if (it != mReusableStringsCache.end())
+            return *it;
+
+        mReusableStringsCache.emplace_back(view);
+        return mReusableStringsCache.back();
+    }
+    else
+    {
+        mStringCache.emplace_back(view);
+        return mStringCache.back();
+    }
+}
+
+using DeserializedNodeStackElement = std::variant<std::monostate, WaveBlock*, Sequence*, Clip*, WaveTrack*>;
+
+struct AudacityProject::ParserState
+{
+    std::vector<ProjectTreeNode*> NodesStack;
     std::vector<DeserializedNodeStackElement> DeserializedNodeStack;
 };
 
@@ -817,6 +2541,103 @@ void AudacityProject::HandleCharData(std::string_view data)
     mParserState->NodesStack.back()->Data = std::string(data);
 }
 
+void AudacityProject::mergeProject(const AudacityProject& other)
+{
+    mDb.reopenReadonlyAsWritable();
+
+    // Ids are never reused by Audacity, so the sequence is respected as well
+    const int64_t blockIdOffset = mDb.DB()
+                                      .execAndGet(R"(
+        SELECT MAX(
+            IFNULL((SELECT MAX(blockid) FROM sampleblocks), 0),
+            IFNULL((SELECT seq FROM sqlite_sequence WHERE name = 'sampleblocks'), 0));)")
+                                      .getInt64();
+
+    BlockIdSet blocks;
+
+    for (const auto& block : other.mWaveBlocks)
+    {
+        if (!block.isSilence())
+            blocks.emplace(block.getBlockId());
+    }
+
+    // Blocks are copied from the file
+    other.mDb.saveInMemoryDatabase();
+
+    const auto copiedCount = other.mDb.copySampleBlocks(
+        mDb.DB(), std::vector<int64_t>(blocks.begin(), blocks.end()),
+        blockIdOffset);
+
+    if (copiedCount != blocks.size())
+        fmt::print(
+            "{} blocks are missing in {}\n", blocks.size() - copiedCount,
+            other.mDb.getProjectPath().u8string());
+
+    // Tracks are replayed through the parser, so the strings are cached
+    // and the model is updated
+    mParserState = std::make_unique<ParserState>();
+    mParserState->NodesStack.push_back(mProjectNode.get());
+    mParserState->DeserializedNodeStack.emplace_back();
+
+    for (const auto& child : other.mProjectNode->Children)
+    {
+        if (child->TagName == "wavetrack")
+            graftNode(*child, blockIdOffset);
+    }
+
+    mParserState = {};
+
+    fmt::print(
+        "Merged {} tracks, {} blocks were copied\n",
+        other.mWaveTracks.size(), copiedCount);
+
+    saveProject();
+}
+
+void AudacityProject::graftNode(
+    const ProjectTreeNode& node, int64_t blockIdOffset)
+{
+    if (node.TagName == "waveblock")
+    {
+        auto attributes = node.Attributes;
+
+        for (auto& attr : attributes)
+        {
+            if (attr.Name != "blockid")
+                continue;
+
+            const auto blockId = GetAttributeValue<int64_t>(attr.Value);
+
+            if (blockId > 0)
+                attr.Value = blockId + blockIdOffset;
+        }
+
+        HandleTagStart(node.TagName, attributes);
+    }
+    else
+    {
+        HandleTagStart(node.TagName, node.Attributes);
+    }
+
+    if (!node.Data.empty())
+        HandleCharData(node.Data);
+
+    for (const auto& child : node.Children)
+        graftNode(*child, blockIdOffset);
+
+    HandleTagEnd(node.TagName);
+}
+
+std::unique_ptr<ProjectTreeNode> ProjectTreeNode::clone() const
+{
+    auto result = CloneNodeShallow(*this);
+
+    for (const auto& child : Children)
+        result->Children.push_back(child->clone());
+
+    return result;
+}
+
 void ProjectTreeNode::setAttribute(std::string_view name, AttributeValue value)
 {
     for (auto& attr : Attributes)
@@ -11,9 +11,10 @@
 #include <string>
 #include <string_view>
 #include <utility>
-#include <set>
 
 #include "AudacityDatabase.h"
+#include "BlockIdSet.h"
+#include "SampleFormat.h"
 #include "XMLHandler.h"
 
 struct ProjectTreeNode final
@@ -28,6 +29,8 @@ struct ProjectTreeNode final
     std::string Data;
 
     void setAttribute(std::string_view name, AttributeValue value);
+
+    std::unique_ptr<ProjectTreeNode> clone() const;
 };
 
 class WaveBlock;
@@ -40,6 +43,8 @@ class DeserializedNode
 public:
     virtual ~DeserializedNode() = default;
 
+    ProjectTreeNode* getXMLNode() const noexcept;
+
 protected:
     explicit DeserializedNode(ProjectTreeNode* node);
 
@@ -61,6 +66,7 @@ public:
     int64_t getStart() const noexcept;
     int64_t getLength() const noexcept;
 
+    size_t getParentIndex() const noexcept;
     Sequence* getParent() const noexcept;
 
 private:
@@ -83,6 +89,12 @@ public:
     int32_t getMaxSamples() const noexcept;
     int32_t getNumSamples() const noexcept;
 
+    void setMaxSamples(int64_t maxSamples) noexcept;
+    void setNumSamples(int64_t numSamples) noexcept;
+
+    size_t getParentIndex() const noexcept;
+    Clip* getParent() const noexcept;
+
     Blocks::const_iterator begin() const;
     Blocks::const_iterator end() const;
 
@@ -141,6 +153,7 @@ public:
     std::string_view getTrackName() const;
     int getChannel() const;
     bool isLinked() const;
+    void setLinked(bool linked) noexcept;
 
     size_t getParentIndex() const;
 
@@ -170,6 +183,9 @@ public:
     AudacityProject(AudacityDatabase& db);
     ~AudacityProject();
 
+    const std::deque<WaveTrack>& getWaveTracks() const;
+    const ProjectTreeNode& getProjectTree() const;
+
     bool containsBlock(int64_t blockId) const;
 
     enum class BlockValidationResult
@@ -183,21 +199,59 @@ public:
 
     BlockValidationResult validateBlock(const WaveBlock& block) const;
 
-    std::set<int64_t> validateBlocks() const;
+    BlockIdSet validateBlocks() const;
+
+    BlockIdSet recoverProject();
+
+    // Looks for the clicks at the block boundaries, reading only the samples
+    // around them. If repair is set, the flagged boundaries are smoothed with
+    // short fades, written into new blocks, and the project is saved.
+    // Returns the number of flagged boundaries.
+    size_t checkBlockBoundaries(bool repair);
 
-    std::set<int64_t> recoverProject();
+    // Checks that block starts, block lengths, sequence lengths, clip
+    // positions and stereo pairs are consistent, using the sampleblocks table
+    // for the real block lengths. If repair is set, the fixable problems are
+    // fixed and the project is saved. Returns the number of errors left.
+    size_t validateProject(bool repair);
 
     void saveProject();
 
+    // Rewrites the project document with the unused names dropped and
+    // the smaller field types, keeping the parsed tree the same
+    void compactDocument();
+
     void removeUnusedBlocks();
 
     void extractClips() const;
 
+    // Writes every wave track (or a stereo pair) into a WAV file, aligned to
+    // the project start. If multichannel is set, a single WAV file with
+    // a channel per track is written instead. Tracks are read in one sweep.
+    void exportStems(SampleFormat format, bool multichannel) const;
+
+    // Writes a new project containing only the [start, end) time range
+    void cropProject(double start, double end);
+
+    // Writes every wave track (or a stereo pair) into a separate project.
+    // Up to threadsCount projects are written at once.
+    void splitTracks(size_t threadsCount) const;
+
+    // Appends the wave tracks of another project and copies the referenced
+    // sample blocks, assigning them new block ids. Project is saved afterwards.
+    void mergeProject(const AudacityProject& other);
+
     void printProjectStatistics() const;
 
 private:
     std::string_view CacheString(std::string_view view, bool reuse);
 
+    void writeProjectDocument(
+        SQLite::Database& db, const std::string& table,
+        const ProjectTreeNode& root) const;
+
+    void graftNode(const ProjectTreeNode& node, int64_t blockIdOffset);
+
     void HandleTagStart(std::string_view name, const AttributeList& attributes) override;
     void HandleTagEnd(std::string_view name) override;
     void HandleCharData(std::string_view data) override;
@@ -0,0 +1,397 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "ProjectTables.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <variant>
+#include <vector>
+
+#include <fmt/format.h>
+#include <sqlite3.h>
+
+#include "ProjectModel.h"
+
+namespace
+{
+using Value = std::variant<int64_t, double, std::string>;
+using Row = std::vector<Value>;
+
+// Rows are sorted by the first column, which is always track_index
+struct TableData final
+{
+    std::string Schema;
+    std::vector<Row> Rows;
+};
+
+struct Table final : sqlite3_vtab
+{
+    const TableData* Data;
+};
+
+struct Cursor final : sqlite3_vtab_cursor
+{
+    size_t Current;
+    size_t End;
+};
+
+enum IndexPlan
+{
+    FullScan,
+    TrackIndexLookup,
+};
+
+const TableData& GetTableData(sqlite3_vtab_cursor* cursor)
+{
+    return *static_cast<Table*>(cursor->pVtab)->Data;
+}
+
+int Connect(
+    sqlite3* db, void* aux, int, const char* const*, sqlite3_vtab** vtab,
+    char**)
+{
+    const auto data = static_cast<const TableData*>(aux);
+
+    const int rc = sqlite3_declare_vtab(db, data->Schema.c_str());
+
+    if (rc != SQLITE_OK)
+        return rc;
+
+    auto table = new Table {};
+    table->Data = data;
+
+    *vtab = table;
+
+    return SQLITE_OK;
+}
+
+int Disconnect(sqlite3_vtab* vtab)
+{
+    delete static_cast<Table*>(vtab);
+    return SQLITE_OK;
+}
+
+int BestIndex(sqlite3_vtab* vtab, sqlite3_index_info* info)
+{
+    const double rowsCount =
+        double(static_cast<Table*>(vtab)->Data->Rows.size()) + 1.0;
+
+    for (int i = 0; i < info->nConstraint; ++i)
+    {
+        const auto& constraint = info->aConstraint[i];
+
+        if (
+            constraint.usable && constraint.iColumn == 0 &&
+            constraint.op == SQLITE_INDEX_CONSTRAINT_EQ)
+        {
+            info->aConstraintUsage[i].argvIndex = 1;
+            info->aConstraintUsage[i].omit = 1;
+
+            info->idxNum = TrackIndexLookup;
+            info->estimatedCost = std::log2(rowsCount);
+            info->estimatedRows = 16;
+
+            return SQLITE_OK;
+        }
+    }
+
+    info->idxNum = FullScan;
+    info->estimatedCost = rowsCount;
+    info->estimatedRows = sqlite3_int64(rowsCount);
+
+    return SQLITE_OK;
+}
+
+int Open(sqlite3_vtab*, sqlite3_vtab_cursor** cursor)
+{
+    *cursor = new Cursor {};
+    return SQLITE_OK;
+}
+
+int Close(sqlite3_vtab_cursor* cursor)
+{
+    delete static_cast<Cursor*>(cursor);
+    return SQLITE_OK;
+}
+
+int Filter(
+    sqlite3_vtab_cursor* baseCursor, int idxNum, const char*, int argc,
+    sqlite3_value** argv)
+{
+    auto cursor = static_cast<Cursor*>(baseCursor);
+    const auto& rows = GetTableData(baseCursor).Rows;
+
+    cursor->Current = 0;
+    cursor->End = rows.size();
+
+    if (idxNum != TrackIndexLookup || argc != 1)
+        return SQLITE_OK;
+
+    int64_t trackIndex = 0;
+
+    const auto type = sqlite3_value_numeric_type(argv[0]);
+
+    if (type == SQLITE_INTEGER)
+    {
+        trackIndex = sqlite3_value_int64(argv[0]);
+    }
+    else if (type == SQLITE_FLOAT)
+    {
+        // track_index = 3.0 matches track 3, as it does for the regular tables
+        const double value = sqlite3_value_double(argv[0]);
+
+        if (
+            value < -9.2e18 || value > 9.2e18 ||
+            std::trunc(value) != value)
+        {
+            cursor->End = 0;
+            return SQLITE_OK;
+        }
+
+        trackIndex = int64_t(value);
+    }
+    else
+    {
+        cursor->End = 0;
+        return SQLITE_OK;
+    }
+
+    const auto range = std::equal_range(
+        rows.begin(), rows.end(), trackIndex,
+        [](const auto& lhs, const auto& rhs)
+        {
+            using L = std::decay_t<decltype(lhs)>;
+
+            if constexpr (std::is_same_v<L, Row>)
+                return std::get<int64_t>(lhs[0]) < rhs;
+            else
+                return lhs < std::get<int64_t>(rhs[0]);
+        });
+
+    cursor->Current = range.first - rows.begin();
+    cursor->End = range.second - rows.begin();
+
+    return SQLITE_OK;
+}
+
+int Next(sqlite3_vtab_cursor* cursor)
+{
+    ++static_cast<Cursor*>(cursor)->Current;
+    return SQLITE_OK;
+}
+
+int Eof(sqlite3_vtab_cursor* baseCursor)
+{
+    auto cursor = static_cast<Cursor*>(baseCursor);
+    return cursor->Current >= cursor->End;
+}
+
+int Column(sqlite3_vtab_cursor* baseCursor, sqlite3_context* ctx, int column)
+{
+    auto cursor = static_cast<Cursor*>(baseCursor);
+    const auto& row = GetTableData(baseCursor).Rows[cursor->Current];
+
+    std::visit(
+        [ctx](auto&& value)
+        {
+            using T = std::decay_t<decltype(value)>;
+
+            if constexpr (std::is_same_v<T, int64_t>)
+                sqlite3_result_int64(ctx, value);
+            else if constexpr (std::is_same_v<T, double>)
+                sqlite3_result_double(ctx, value);
+            else
+                sqlite3_result_text(
+                    ctx, value.data(), int(value.size()), SQLITE_TRANSIENT);
+        },
+        row.at(column));
+
+    return SQLITE_OK;
+}
+
+int RowId(sqlite3_vtab_cursor* cursor, sqlite3_int64* rowId)
+{
+    *rowId = static_cast<Cursor*>(cursor)->Current;
+    return SQLITE_OK;
+}
+
+sqlite3_module MakeModule()
+{
+    sqlite3_module module {};
+
+    // xCreate is left empty, so the tables are eponymous-only
+    module.xConnect = Connect;
+    module.xBestIndex = BestIndex;
+    module.xDisconnect = Disconnect;
+    module.xDestroy = Disconnect;
+    module.xOpen = Open;
+    module.xClose = Close;
+    module.xFilter = Filter;
+    module.xNext = Next;
+    module.xEof = Eof;
+    module.xColumn = Column;
+    module.xRowid = RowId;
+
+    return module;
+}
+
+const sqlite3_module ProjectTableModule = MakeModule();
+
+void RegisterTable(
+    SQLite::Database& db, const char* name, std::unique_ptr<TableData> data)
+{
+    const int rc = sqlite3_create_module_v2(
+        db.getHandle(), name, &ProjectTableModule, data.get(),
+        [](void* data) { delete static_cast<TableData*>(data); });
+
+    // The destructor is invoked by SQLite even if the registration fails
+    data.release();
+
+    if (rc != SQLITE_OK)
+        throw SQLite::Exception(db.getHandle(), rc);
+}
+
+int64_t GetClipSamplesCount(const Clip& clip)
+{
+    int64_t samplesCount = 0;
+
+    for (auto sequence : clip)
+        samplesCount += sequence->getNumSamples();
+
+    return samplesCount;
+}
+} // namespace
+
+void RegisterProjectTables(SQLite::Database& db, const AudacityProject& project)
+{
+    auto tracks = std::make_unique<TableData>();
+    tracks->Schema =
+        "CREATE TABLE x(track_index INTEGER, name TEXT, channel INTEGER, linked INTEGER, rate INTEGER, sample_format INTEGER, clips_count INTEGER)";
+
+    auto clips = std::make_unique<TableData>();
+    clips->Schema =
+        "CREATE TABLE x(track_index INTEGER, clip_index INTEGER, name TEXT, offset REAL, trim_left REAL, trim_right REAL, num_samples INTEGER, play_start REAL, play_end REAL)";
+
+    auto blocks = std::make_unique<TableData>();
+    blocks->Schema =
+        "CREATE TABLE x(track_index INTEGER, clip_index INTEGER, sequence_index INTEGER, block_index INTEGER, blockid INTEGER, start INTEGER, length INTEGER, sample_format INTEGER, silent INTEGER)";
+
+    for (const auto& track : project.getWaveTracks())
+    {
+        const int64_t trackIndex = track.getParentIndex();
+        const double rate = track.getSampleRate();
+
+        tracks->Rows.push_back(
+            { trackIndex, std::string(track.getTrackName()),
+              int64_t(track.getChannel()), int64_t(track.isLinked()),
+              int64_t(track.getSampleRate()), int64_t(track.getSampleFormat()),
+              int64_t(track.getClips().size()) });
+
+        for (auto clip : track.getClips())
+        {
+            const int64_t clipIndex = clip->getParentIndex();
+            const int64_t samplesCount = GetClipSamplesCount(*clip);
+
+            clips->Rows.push_back(
+                { trackIndex, clipIndex, std::string(clip->getName()),
+                  clip->getOffset(), clip->getTrimLeft(), clip->getTrimRight(),
+                  samplesCount, clip->getOffset() + clip->getTrimLeft(),
+                  clip->getOffset() + samplesCount / rate -
+                      clip->getTrimRight() });
+
+            for (auto sequence : *clip)
+            {
+                for (auto block : *sequence)
+                {
+                    blocks->Rows.push_back(
+                        { trackIndex, clipIndex,
+                          int64_t(sequence->getParentIndex()),
+                          int64_t(block->getParentIndex()), block->getBlockId(),
+                          block->getStart(), block->getLength(),
+                          int64_t(sequence->getFormat()),
+                          int64_t(block->isSilence()) });
+                }
+            }
+        }
+    }
+
+    RegisterTable(db, "project_tracks", std::move(tracks));
+    RegisterTable(db, "project_clips", std::move(clips));
+    RegisterTable(db, "project_blocks", std::move(blocks));
+}
+
+void RunProjectQuery(SQLite::Database& db, const std::string& sql)
+{
+    sqlite3* handle = db.getHandle();
+
+    const char* tail = sql.c_str();
+
+    while (tail != nullptr && *tail != '\0')
+    {
+        sqlite3_stmt* rawStatement = nullptr;
+
+        int rc = sqlite3_prepare_v2(handle, tail, -1, &rawStatement, &tail);
+
+        if (rc != SQLITE_OK)
+            throw SQLite::Exception(handle, rc);
+
+        // Comments and whitespaces produce no statement
+        if (rawStatement == nullptr)
+            continue;
+
+        std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)> statement(
+            rawStatement, sqlite3_finalize);
+
+        const int columnsCount = sqlite3_column_count(rawStatement);
+
+        for (int column = 0; column < columnsCount; ++column)
+        {
+            fmt::print(
+                "{}{}", column > 0 ? "|" : "",
+                sqlite3_column_name(rawStatement, column));
+        }
+
+        if (columnsCount > 0)
+            fmt::print("\n");
+
+        while ((rc = sqlite3_step(rawStatement)) == SQLITE_ROW)
+        {
+            for (int column = 0; column < columnsCount; ++column)
+            {
+                if (column > 0)
+                    fmt::print("|");
+
+                switch (sqlite3_column_type(rawStatement, column))
+                {
+                case SQLITE_INTEGER:
+                    fmt::print("{}", sqlite3_column_int64(rawStatement, column));
+                    break;
+                case SQLITE_FLOAT:
+                    fmt::print("{}", sqlite3_column_double(rawStatement, column));
+                    break;
+                case SQLITE_TEXT:
+                    fmt::print(
+                        "{}", reinterpret_cast<const char*>(
+                                  sqlite3_column_text(rawStatement, column)));
+                    break;
+                case SQLITE_BLOB:
+                    fmt::print(
+                        "<blob {} bytes>",
+                        sqlite3_column_bytes(rawStatement, column));
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            fmt::print("\n");
+        }
+
+        if (rc != SQLITE_DONE)
+            throw SQLite::Exception(handle, rc);
+    }
+}
@@ -0,0 +1,19 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <string>
+#include <SQLiteCpp/SQLiteCpp.h>
+
+class AudacityProject;
+
+// Registers project_tracks, project_clips and project_blocks virtual tables
+// on the connection. Tables hold a snapshot of the project model taken at the
+// moment of the registration.
+void RegisterProjectTables(SQLite::Database& db, const AudacityProject& project);
+
+// Executes one or more SQL statements and prints the results
+void RunProjectQuery(SQLite::Database& db, const std::string& sql);
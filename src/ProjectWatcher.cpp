@@ -0,0 +1,568 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "ProjectWatcher.h"
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+#include <fmt/format.h>
+#include <SQLiteCpp/SQLiteCpp.h>
+#include <sqlite3.h>
+
+#ifdef __linux__
+#   include <poll.h>
+#   include <sys/inotify.h>
+#   include <unistd.h>
+#endif
+
+#include "BinaryXMLConverter.h"
+#include "Hash.h"
+#include "ProjectBlobReader.h"
+#include "SampleBlock.h"
+#include "XMLHandler.h"
+
+namespace
+{
+constexpr uint32_t WalMagic = 0x377f0682;
+constexpr size_t WalHeaderSize = 32;
+constexpr size_t WalFrameHeaderSize = 24;
+
+uint32_t ReadBigEndian32(const uint8_t* data)
+{
+    return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) |
+           (uint32_t(data[2]) << 8) | uint32_t(data[3]);
+}
+
+uint32_t ReadLittleEndian32(const uint8_t* data)
+{
+    return (uint32_t(data[3]) << 24) | (uint32_t(data[2]) << 16) |
+           (uint32_t(data[1]) << 8) | uint32_t(data[0]);
+}
+
+// Checksum used by SQLite for the WAL header and frames
+void UpdateWalChecksum(
+    const uint8_t* data, size_t size, bool bigEndian, uint32_t checksum[2])
+{
+    for (size_t i = 0; i + 8 <= size; i += 8)
+    {
+        const uint32_t first =
+            bigEndian ? ReadBigEndian32(data + i) : ReadLittleEndian32(data + i);
+        const uint32_t second = bigEndian ? ReadBigEndian32(data + i + 4) :
+                                            ReadLittleEndian32(data + i + 4);
+
+        checksum[0] += first + checksum[1];
+        checksum[1] += second + checksum[0];
+    }
+}
+
+// Maps the changed file to the project it belongs to
+std::filesystem::path GetProjectPath(const std::filesystem::path& path)
+{
+    if (path.extension() == ".aup3")
+        return path;
+
+    if (path.extension() == ".aup3-wal")
+    {
+        auto projectPath = path;
+        projectPath.replace_extension(".aup3");
+        return projectPath;
+    }
+
+    return {};
+}
+
+class BlockReferencesCollector final : public XMLHandler
+{
+public:
+    void HandleTagStart(
+        std::string_view name, const AttributeList& attributes) override
+    {
+        if (name != "waveblock")
+            return;
+
+        for (const auto& attr : attributes)
+        {
+            if (attr.Name != "blockid")
+                continue;
+
+            const auto blockId = GetAttributeValue<int64_t>(attr.Value);
+
+            if (blockId > 0)
+                Blocks.emplace(blockId);
+        }
+    }
+
+    void HandleTagEnd(std::string_view) override
+    {
+    }
+
+    void HandleCharData(std::string_view) override
+    {
+    }
+
+    std::unordered_set<int64_t> Blocks;
+};
+} // namespace
+
+ProjectWatcher::ProjectWatcher(std::filesystem::path root)
+    : mRoot(std::move(root))
+{
+    if (!std::filesystem::is_directory(mRoot))
+        throw std::runtime_error(
+            fmt::format("{} is not a directory", mRoot.u8string()));
+
+#ifdef __linux__
+    mNotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (mNotifyFd < 0)
+        throw std::runtime_error("Failed to initialize inotify");
+
+    addWatches(mRoot);
+#endif
+}
+
+ProjectWatcher::~ProjectWatcher()
+{
+#ifdef __linux__
+    if (mNotifyFd >= 0)
+        close(mNotifyFd);
+#endif
+}
+
+void ProjectWatcher::run()
+{
+    fmt::print("Watching {}\n", mRoot.u8string());
+
+    scanDirectory();
+
+    while (true)
+    {
+        waitForChanges();
+        validatePending();
+    }
+}
+
+void ProjectWatcher::scanDirectory()
+{
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(
+             mRoot, std::filesystem::directory_options::skip_permission_denied))
+    {
+        if (entry.is_regular_file() && entry.path().extension() == ".aup3")
+            scheduleValidation(entry.path());
+    }
+}
+
+#ifdef __linux__
+void ProjectWatcher::addWatches(const std::filesystem::path& directory)
+{
+    constexpr uint32_t mask = IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO |
+                              IN_CREATE | IN_DELETE;
+
+    auto addWatch = [this](const std::filesystem::path& path)
+    {
+        const int wd = inotify_add_watch(mNotifyFd, path.c_str(), mask);
+
+        if (wd >= 0)
+            mWatches[wd] = path;
+        else
+            fmt::print("Failed to watch {}\n", path.u8string());
+    };
+
+    addWatch(directory);
+
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(
+             directory,
+             std::filesystem::directory_options::skip_permission_denied))
+    {
+        if (entry.is_directory())
+            addWatch(entry.path());
+    }
+}
+
+void ProjectWatcher::waitForChanges()
+{
+    pollfd fd { mNotifyFd, POLLIN, 0 };
+
+    if (poll(&fd, 1, 500) <= 0)
+        return;
+
+    alignas(inotify_event) std::array<char, 64 * 1024> buffer;
+
+    while (true)
+    {
+        const auto bytesRead = read(mNotifyFd, buffer.data(), buffer.size());
+
+        if (bytesRead <= 0)
+            return;
+
+        for (ssize_t offset = 0; offset < bytesRead;)
+        {
+            const auto event =
+                reinterpret_cast<const inotify_event*>(buffer.data() + offset);
+
+            offset += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                // Some events are lost, so everything is checked again
+                scanDirectory();
+                continue;
+            }
+
+            if (event->mask & IN_IGNORED)
+            {
+                mWatches.erase(event->wd);
+                continue;
+            }
+
+            auto it = mWatches.find(event->wd);
+
+            if (it == mWatches.end() || event->len == 0)
+                continue;
+
+            const auto path = it->second / event->name;
+
+            if (
+                (event->mask & IN_ISDIR) &&
+                (event->mask & (IN_CREATE | IN_MOVED_TO)))
+            {
+                addWatches(path);
+
+                for (const auto& entry :
+                     std::filesystem::recursive_directory_iterator(path))
+                {
+                    if (entry.path().extension() == ".aup3")
+                        scheduleValidation(entry.path());
+                }
+
+                continue;
+            }
+
+            const auto projectPath = GetProjectPath(path);
+
+            if (!projectPath.empty())
+                scheduleValidation(projectPath);
+        }
+    }
+}
+#else
+void ProjectWatcher::waitForChanges()
+{
+    // Unchanged projects are skipped by the write time
+    std::this_thread::sleep_for(PollInterval);
+    scanDirectory();
+}
+#endif
+
+void ProjectWatcher::scheduleValidation(const std::filesystem::path& path)
+{
+    mPending[path.u8string()] = Clock::now();
+}
+
+void ProjectWatcher::validatePending()
+{
+    const auto now = Clock::now();
+
+    std::vector<std::string> ready;
+
+    for (const auto& [path, lastChange] : mPending)
+    {
+        if (now - lastChange >= QuietPeriod)
+            ready.push_back(path);
+    }
+
+    for (const auto& path : ready)
+    {
+        mPending.erase(path);
+
+        const auto projectPath = std::filesystem::u8path(path);
+
+        if (!std::filesystem::exists(projectPath))
+        {
+            if (mProjects.erase(path) > 0)
+                fmt::print("{}: removed\n", path);
+
+            continue;
+        }
+
+        validateProject(projectPath, mProjects[path]);
+    }
+}
+
+void ProjectWatcher::validateProject(
+    const std::filesystem::path& path, ProjectState& state)
+{
+    auto walPath = path;
+    walPath += "-wal";
+
+    std::error_code ec;
+
+    const auto writeTime = std::filesystem::last_write_time(path, ec);
+    const auto walWriteTime = std::filesystem::last_write_time(walPath, ec);
+
+    if (
+        writeTime == state.LastWriteTime &&
+        walWriteTime == state.LastWalWriteTime)
+        return;
+
+    std::vector<std::string> issues;
+
+    size_t newBlocks = 0;
+    size_t documents = 0;
+
+    try
+    {
+        SQLite::Database db(path.u8string(), SQLite::OPEN_READONLY);
+        db.setBusyTimeout(1000);
+
+        newBlocks = validateNewBlocks(db, state, issues);
+        documents = validateDocuments(db, state, issues);
+    }
+    catch (const SQLite::Exception& ex)
+    {
+        // Audacity is still writing, try again later
+        if (
+            ex.getErrorCode() == SQLITE_BUSY ||
+            ex.getErrorCode() == SQLITE_LOCKED)
+        {
+            scheduleValidation(path);
+            return;
+        }
+
+        issues.push_back(ex.what());
+    }
+    catch (const std::exception& ex)
+    {
+        issues.push_back(ex.what());
+    }
+
+    const auto walFrames = validateWal(walPath, state.Wal, issues);
+
+    state.LastWriteTime = writeTime;
+    state.LastWalWriteTime = walWriteTime;
+
+    if (newBlocks == 0 && documents == 0 && walFrames == 0 && issues.empty())
+        return;
+
+    fmt::print(
+        "{}: {} new blocks, {} documents, {} WAL frames checked. {}\n",
+        path.u8string(), newBlocks, documents, walFrames,
+        issues.empty() ? std::string("OK") :
+                         fmt::format("{} issues found:", issues.size()));
+
+    for (const auto& issue : issues)
+        fmt::print("    {}\n", issue);
+}
+
+size_t ProjectWatcher::validateNewBlocks(
+    SQLite::Database& db, ProjectState& state,
+    std::vector<std::string>& issues)
+{
+    // length() is served from the record header, blobs are not read
+    SQLite::Statement stmt(
+        db,
+        "SELECT blockid, sampleformat, length(samples), length(summary256), length(summary64k) FROM sampleblocks WHERE blockid > ?1 ORDER BY blockid;");
+
+    stmt.bind(1, state.LastBlockId);
+
+    size_t blocksCount = 0;
+
+    while (stmt.executeStep())
+    {
+        const int64_t blockId = stmt.getColumn(0).getInt64();
+
+        state.LastBlockId = blockId;
+        ++blocksCount;
+
+        const auto problem = ValidateSampleBlockLayout(
+            stmt.getColumn(1).getInt(), stmt.getColumn(2).getInt64(),
+            stmt.getColumn(3).getInt64(), stmt.getColumn(4).getInt64());
+
+        if (!problem.empty())
+            issues.push_back(fmt::format("Block {}: {}", blockId, problem));
+    }
+
+    return blocksCount;
+}
+
+size_t ProjectWatcher::validateDocuments(
+    SQLite::Database& db, ProjectState& state,
+    std::vector<std::string>& issues)
+{
+    size_t documentsCount = 0;
+
+    for (const std::string table : { "project", "autosave" })
+    {
+        if (!db.tableExists(table))
+            continue;
+
+        SQLite::Statement stmt(
+            db, fmt::format("SELECT dict, doc FROM {} WHERE id = 1;", table));
+
+        if (!stmt.executeStep())
+        {
+            state.DocumentHashes.erase(table);
+            continue;
+        }
+
+        const auto dict = stmt.getColumn(0);
+        const auto doc = stmt.getColumn(1);
+
+        const auto hash = CalculateHash(
+            doc.getBlob(), doc.getBytes(),
+            CalculateHash(dict.getBlob(), dict.getBytes()));
+
+        auto it = state.DocumentHashes.find(table);
+
+        if (it != state.DocumentHashes.end() && it->second == hash)
+            continue;
+
+        ++documentsCount;
+
+        BlockReferencesCollector collector;
+
+        try
+        {
+            BinaryXMLConverter::Parse(*ReadProjectBlob(db, table), collector);
+        }
+        catch (const std::exception& ex)
+        {
+            issues.push_back(fmt::format(
+                "Failed to parse the {} document: {}", table, ex.what()));
+            continue;
+        }
+
+        // Audacity never deletes the referenced blocks,
+        // so only the new references are checked
+        SQLite::Statement blockExists(
+            db, "SELECT 1 FROM sampleblocks WHERE blockid = ?1;");
+
+        size_t missingBlocks = 0;
+
+        for (auto blockId : collector.Blocks)
+        {
+            if (state.ReferencedBlocks.count(blockId) > 0)
+                continue;
+
+            blockExists.bind(1, blockId);
+
+            if (blockExists.executeStep())
+                state.ReferencedBlocks.emplace(blockId);
+            else
+                ++missingBlocks;
+
+            blockExists.reset();
+        }
+
+        if (missingBlocks > 0)
+            issues.push_back(fmt::format(
+                "The {} document references {} missing blocks", table,
+                missingBlocks));
+
+        state.DocumentHashes[table] = hash;
+    }
+
+    return documentsCount;
+}
+
+uint64_t ProjectWatcher::validateWal(
+    const std::filesystem::path& walPath, WalState& state,
+    std::vector<std::string>& issues)
+{
+    std::ifstream file(walPath, std::ios::binary);
+
+    std::array<uint8_t, WalHeaderSize> header;
+
+    if (!file || !file.read(reinterpret_cast<char*>(header.data()), header.size()))
+    {
+        // WAL is missing or was truncated by a checkpoint
+        state = {};
+        return 0;
+    }
+
+    const uint32_t magic = ReadBigEndian32(header.data());
+    const uint32_t salt1 = ReadBigEndian32(header.data() + 16);
+    const uint32_t salt2 = ReadBigEndian32(header.data() + 20);
+
+    if ((magic & 0xFFFFFFFE) != WalMagic)
+    {
+        issues.push_back("WAL has invalid header");
+        state = {};
+        return 0;
+    }
+
+    // A new salt means that the WAL was restarted
+    if (state.PageSize == 0 || salt1 != state.Salt1 || salt2 != state.Salt2)
+    {
+        state = {};
+
+        state.Salt1 = salt1;
+        state.Salt2 = salt2;
+        state.PageSize = ReadBigEndian32(header.data() + 8);
+        state.BigEndianChecksum = (magic & 1) != 0;
+
+        UpdateWalChecksum(
+            header.data(), 24, state.BigEndianChecksum, state.Checksum);
+
+        if (
+            state.Checksum[0] != ReadBigEndian32(header.data() + 24) ||
+            state.Checksum[1] != ReadBigEndian32(header.data() + 28))
+        {
+            issues.push_back("WAL header checksum mismatch");
+            state = {};
+            return 0;
+        }
+    }
+
+    const size_t frameSize = WalFrameHeaderSize + state.PageSize;
+
+    file.seekg(WalHeaderSize + state.ValidFrames * frameSize);
+
+    std::vector<uint8_t> frame(frameSize);
+
+    uint32_t checksum[2] = { state.Checksum[0], state.Checksum[1] };
+    uint64_t frameIndex = state.ValidFrames;
+    uint64_t newFrames = 0;
+
+    while (file.read(reinterpret_cast<char*>(frame.data()), frame.size()))
+    {
+        // Frames left from the previous WAL generation
+        if (
+            ReadBigEndian32(frame.data() + 8) != state.Salt1 ||
+            ReadBigEndian32(frame.data() + 12) != state.Salt2)
+            break;
+
+        UpdateWalChecksum(frame.data(), 8, state.BigEndianChecksum, checksum);
+        UpdateWalChecksum(
+            frame.data() + WalFrameHeaderSize, state.PageSize,
+            state.BigEndianChecksum, checksum);
+
+        // As in SQLite, a mismatch after the last commit marks the end of
+        // the log: Audacity may be in the middle of writing the frame
+        if (
+            checksum[0] != ReadBigEndian32(frame.data() + 16) ||
+            checksum[1] != ReadBigEndian32(frame.data() + 20))
+            break;
+
+        ++frameIndex;
+
+        // Only the committed transactions are remembered, uncommitted frames
+        // can still be rewritten
+        if (ReadBigEndian32(frame.data() + 4) != 0)
+        {
+            newFrames += frameIndex - state.ValidFrames;
+
+            state.ValidFrames = frameIndex;
+            state.Checksum[0] = checksum[0];
+            state.Checksum[1] = checksum[1];
+        }
+    }
+
+    return newFrames;
+}
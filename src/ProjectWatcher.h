@@ -0,0 +1,99 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace SQLite
+{
+class Database;
+}
+
+// Watches a directory tree and validates the .aup3 files as they change.
+// Only the parts changed since the previous validation are checked:
+// new sample blocks, a new project document and new WAL frames.
+class ProjectWatcher final
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Projects are validated once no changes were seen for this long
+    static constexpr std::chrono::seconds QuietPeriod { 2 };
+    // Used when file system notifications are not available
+    static constexpr std::chrono::seconds PollInterval { 10 };
+
+    explicit ProjectWatcher(std::filesystem::path root);
+    ~ProjectWatcher();
+
+    ProjectWatcher(const ProjectWatcher&) = delete;
+    ProjectWatcher& operator=(const ProjectWatcher&) = delete;
+
+    // Never returns, unless an error occurs
+    void run();
+
+private:
+    struct WalState final
+    {
+        uint32_t Salt1 { 0 };
+        uint32_t Salt2 { 0 };
+        uint32_t PageSize { 0 };
+        bool BigEndianChecksum { false };
+
+        uint64_t ValidFrames { 0 };
+        uint32_t Checksum[2] { 0, 0 };
+    };
+
+    struct ProjectState final
+    {
+        std::filesystem::file_time_type LastWriteTime {};
+        std::filesystem::file_time_type LastWalWriteTime {};
+
+        int64_t LastBlockId { 0 };
+
+        std::unordered_map<std::string, uint64_t> DocumentHashes;
+        std::unordered_set<int64_t> ReferencedBlocks;
+
+        WalState Wal;
+    };
+
+    void scanDirectory();
+    void waitForChanges();
+
+    void scheduleValidation(const std::filesystem::path& path);
+    void validatePending();
+
+    void validateProject(const std::filesystem::path& path, ProjectState& state);
+
+    static size_t validateNewBlocks(
+        SQLite::Database& db, ProjectState& state,
+        std::vector<std::string>& issues);
+
+    static size_t validateDocuments(
+        SQLite::Database& db, ProjectState& state,
+        std::vector<std::string>& issues);
+
+    static uint64_t validateWal(
+        const std::filesystem::path& walPath, WalState& state,
+        std::vector<std::string>& issues);
+
+    std::filesystem::path mRoot;
+
+    std::unordered_map<std::string, ProjectState> mProjects;
+    std::unordered_map<std::string, Clock::time_point> mPending;
+
+#ifdef __linux__
+    void addWatches(const std::filesystem::path& directory);
+
+    int mNotifyFd { -1 };
+    std::unordered_map<int, std::filesystem::path> mWatches;
+#endif
+};
@@ -0,0 +1,197 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "SampleBlock.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <fmt/format.h>
+
+namespace
+{
+constexpr size_t Summary256Length = 256;
+constexpr size_t Summary64kLength = 65536;
+constexpr size_t FieldsPerFrame = 3;
+
+// Audacity (SqliteSampleBlock::SetSizes) always stores 256 summary256 frames
+// for every summary64k frame, the unused frames are padding
+size_t Summary64kFramesCount(size_t samplesCount)
+{
+    return (samplesCount + Summary64kLength - 1) / Summary64kLength;
+}
+
+size_t Summary256FramesCount(size_t samplesCount)
+{
+    return Summary64kFramesCount(samplesCount) * (Summary64kLength / Summary256Length);
+}
+} // namespace
+
+std::string ValidateSampleBlockLayout(
+    int32_t sampleFormat, int64_t samplesSize, int64_t summary256Size,
+    int64_t summary64kSize)
+{
+    if (
+        sampleFormat != int32_t(SampleFormat::Int16) &&
+        sampleFormat != int32_t(SampleFormat::Int24) &&
+        sampleFormat != int32_t(SampleFormat::Float32))
+        return fmt::format("invalid sample format {}", sampleFormat);
+
+    const int64_t sampleSize = DiskBytesPerSample(SampleFormat(sampleFormat));
+
+    if (samplesSize % sampleSize != 0)
+        return fmt::format(
+            "{} bytes of samples is not a multiple of {}", samplesSize,
+            sampleSize);
+
+    const size_t samplesCount = size_t(samplesSize / sampleSize);
+    const int64_t frameSize = FieldsPerFrame * sizeof(float);
+
+    if (
+        summary256Size !=
+            int64_t(Summary256FramesCount(samplesCount)) * frameSize ||
+        summary64kSize !=
+            int64_t(Summary64kFramesCount(samplesCount)) * frameSize)
+        return "invalid summary";
+
+    return {};
+}
+
+SampleBlockSummary CalculateSampleBlockSummary(
+    SampleFormat format, const void* data, size_t samplesCount)
+{
+    SampleBlockSummary summary;
+
+    if (samplesCount == 0)
+        return summary;
+
+    std::vector<float> samples(samplesCount);
+    ConvertToFloat(format, data, samplesCount, samples.data());
+
+    // Frames with samples, the rest of summary256 is padding
+    const size_t usedFrames256 =
+        (samplesCount + Summary256Length - 1) / Summary256Length;
+
+    const size_t frames256 = Summary256FramesCount(samplesCount);
+    const size_t frames64k = Summary64kFramesCount(samplesCount);
+
+    summary.Summary256.resize(frames256 * FieldsPerFrame);
+    summary.Summary64k.resize(frames64k * FieldsPerFrame);
+
+    double totalSquares = 0.0;
+
+    for (size_t frame = 0; frame < usedFrames256; ++frame)
+    {
+        const size_t first = frame * Summary256Length;
+        const size_t last = std::min(first + Summary256Length, samplesCount);
+
+        float min = std::numeric_limits<float>::max();
+        float max = std::numeric_limits<float>::lowest();
+        double squares = 0.0;
+
+        for (size_t i = first; i < last; ++i)
+        {
+            const float sample = samples[i];
+
+            min = std::min(min, sample);
+            max = std::max(max, sample);
+            squares += double(sample) * sample;
+        }
+
+        summary.Summary256[frame * FieldsPerFrame] = min;
+        summary.Summary256[frame * FieldsPerFrame + 1] = max;
+        summary.Summary256[frame * FieldsPerFrame + 2] =
+            float(std::sqrt(squares / (last - first)));
+
+        totalSquares += squares;
+    }
+
+    // Padding does not affect min and max of the summary64k frames
+    for (size_t frame = usedFrames256; frame < frames256; ++frame)
+    {
+        summary.Summary256[frame * FieldsPerFrame] =
+            std::numeric_limits<float>::max();
+        summary.Summary256[frame * FieldsPerFrame + 1] =
+            std::numeric_limits<float>::lowest();
+        summary.Summary256[frame * FieldsPerFrame + 2] = 0.0f;
+    }
+
+    constexpr size_t framesPer64k = Summary64kLength / Summary256Length;
+
+    // Audacity weights the last partial summary256 frame by its length
+    const double lastFrameFraction =
+        1.0 - double(samplesCount - (usedFrames256 - 1) * Summary256Length) /
+                  Summary256Length;
+
+    for (size_t frame = 0; frame < frames64k; ++frame)
+    {
+        const size_t first = frame * framesPer64k;
+        const size_t last = first + framesPer64k;
+
+        float min = std::numeric_limits<float>::max();
+        float max = std::numeric_limits<float>::lowest();
+        double squares = 0.0;
+
+        for (size_t i = first; i < last; ++i)
+        {
+            const float rms = summary.Summary256[i * FieldsPerFrame + 2];
+
+            min = std::min(min, summary.Summary256[i * FieldsPerFrame]);
+            max = std::max(max, summary.Summary256[i * FieldsPerFrame + 1]);
+            squares += double(rms) * rms;
+        }
+
+        const double denominator =
+            frame + 1 < frames64k ?
+                double(framesPer64k) :
+                double(usedFrames256 - first) - lastFrameFraction;
+
+        summary.Summary64k[frame * FieldsPerFrame] = min;
+        summary.Summary64k[frame * FieldsPerFrame + 1] = max;
+        summary.Summary64k[frame * FieldsPerFrame + 2] =
+            float(std::sqrt(squares / denominator));
+    }
+
+    summary.Min = *std::min_element(samples.begin(), samples.end());
+    summary.Max = *std::max_element(samples.begin(), samples.end());
+    summary.Rms = std::sqrt(totalSquares / samplesCount);
+
+    return summary;
+}
+
+int64_t InsertSampleBlock(
+    SQLite::Database& db, SampleFormat format, const void* data,
+    size_t samplesCount)
+{
+    return InsertSampleBlock(
+        db, format, data, samplesCount,
+        CalculateSampleBlockSummary(format, data, samplesCount));
+}
+
+int64_t InsertSampleBlock(
+    SQLite::Database& db, SampleFormat format, const void* data,
+    size_t samplesCount, const SampleBlockSummary& summary)
+{
+    SQLite::Statement query(
+        db,
+        R"(INSERT INTO sampleblocks (sampleformat, summin, summax, sumrms, summary256, summary64k, samples) VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7);)");
+
+    query.bind(1, static_cast<int32_t>(format));
+    query.bind(2, summary.Min);
+    query.bind(3, summary.Max);
+    query.bind(4, summary.Rms);
+    query.bind(
+        5, summary.Summary256.data(),
+        int(summary.Summary256.size() * sizeof(float)));
+    query.bind(
+        6, summary.Summary64k.data(),
+        int(summary.Summary64k.size() * sizeof(float)));
+    query.bind(7, data, int(samplesCount * DiskBytesPerSample(format)));
+
+    query.exec();
+
+    return db.getLastInsertRowid();
+}
@@ -0,0 +1,47 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+#include "SampleFormat.h"
+
+// Summary data, as Audacity stores it in the sampleblocks table.
+// Summaries contain (min, max, rms) triplets for every 256 and 65536 samples.
+// Summary256 is padded to 256 frames for every summary64k frame.
+struct SampleBlockSummary final
+{
+    double Min { 0.0 };
+    double Max { 0.0 };
+    double Rms { 0.0 };
+
+    std::vector<float> Summary256;
+    std::vector<float> Summary64k;
+};
+
+// Checks that the sizes of the stored blobs are consistent with each other.
+// Returns the description of the problem or an empty string.
+std::string ValidateSampleBlockLayout(
+    int32_t sampleFormat, int64_t samplesSize, int64_t summary256Size,
+    int64_t summary64kSize);
+
+SampleBlockSummary CalculateSampleBlockSummary(
+    SampleFormat format, const void* data, size_t samplesCount);
+
+// Inserts a new block into the sampleblocks table and returns its id.
+// Data is expected to use the DiskBytesPerSample layout.
+int64_t InsertSampleBlock(
+    SQLite::Database& db, SampleFormat format, const void* data,
+    size_t samplesCount);
+
+// Same as above, but uses the summary calculated in advance
+int64_t InsertSampleBlock(
+    SQLite::Database& db, SampleFormat format, const void* data,
+    size_t samplesCount, const SampleBlockSummary& summary);
@@ -6,6 +6,9 @@
 #include "SampleFormat.h"
 
 #include <exception>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <fmt/format.h>
 
 SampleFormat SampleFormatFromString(std::string_view format)
@@ -49,3 +52,67 @@ uint32_t DiskBytesPerSample(SampleFormat format)
         throw std::runtime_error(fmt::format("Unsupported format {}", format));
     }
 }
+
+void ConvertToFloat(
+    SampleFormat format, const void* data, size_t samplesCount, float* output)
+{
+    switch (format)
+    {
+    case SampleFormat::Int16:
+    {
+        auto input = static_cast<const int16_t*>(data);
+
+        for (size_t i = 0; i < samplesCount; ++i)
+            output[i] = input[i] / 32768.0f;
+
+        break;
+    }
+    case SampleFormat::Int24:
+    {
+        auto input = static_cast<const int32_t*>(data);
+
+        for (size_t i = 0; i < samplesCount; ++i)
+            output[i] = input[i] / 8388608.0f;
+
+        break;
+    }
+    case SampleFormat::Float32:
+        std::memcpy(output, data, samplesCount * sizeof(float));
+        break;
+    default:
+        throw std::runtime_error(fmt::format("Unsupported format {}", format));
+    }
+}
+
+void ConvertFromFloat(
+    SampleFormat format, const float* data, size_t samplesCount, void* output)
+{
+    switch (format)
+    {
+    case SampleFormat::Int16:
+    {
+        auto out = static_cast<int16_t*>(output);
+
+        for (size_t i = 0; i < samplesCount; ++i)
+            out[i] = int16_t(
+                std::clamp(std::lrint(data[i] * 32768.0f), -32768L, 32767L));
+
+        break;
+    }
+    case SampleFormat::Int24:
+    {
+        auto out = static_cast<int32_t*>(output);
+
+        for (size_t i = 0; i < samplesCount; ++i)
+            out[i] = int32_t(std::clamp(
+                std::lrint(data[i] * 8388608.0f), -8388608L, 8388607L));
+
+        break;
+    }
+    case SampleFormat::Float32:
+        std::memcpy(output, data, samplesCount * sizeof(float));
+        break;
+    default:
+        throw std::runtime_error(fmt::format("Unsupported format {}", format));
+    }
+}
@@ -7,6 +7,7 @@
 
 #include <string_view>
 #include <cstdint>
+#include <cstddef>
 
 enum class SampleFormat
 {
@@ -19,3 +20,10 @@ SampleFormat SampleFormatFromString(std::string_view format);
 
 uint32_t BytesPerSample(SampleFormat format);
 uint32_t DiskBytesPerSample(SampleFormat format);
+
+// Converts samples stored using DiskBytesPerSample layout to float
+void ConvertToFloat(
+    SampleFormat format, const void* data, size_t samplesCount, float* output);
+// Converts float samples to the DiskBytesPerSample layout of the format
+void ConvertFromFloat(
+    SampleFormat format, const float* data, size_t samplesCount, void* output);
@@ -0,0 +1,270 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "StorageReport.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+#include <fmt/format.h>
+
+#include "AudacityDatabase.h"
+#include "ProjectModel.h"
+
+namespace
+{
+struct BlockReferences final
+{
+    uint64_t Bytes { 0 };
+    uint32_t References { 0 };
+
+    const WaveTrack* FirstTrack { nullptr };
+    const Clip* FirstClip { nullptr };
+
+    bool SharedBetweenTracks { false };
+    bool SharedBetweenClips { false };
+    bool Stored { false };
+};
+
+struct StorageUsage final
+{
+    double ExclusiveBytes { 0 };
+    double SharedBytes { 0 };
+    double TrimmedBytes { 0 };
+};
+
+// Calls callback(track, clip, block, hiddenSamples) for every
+// non silent block reference in the project
+template<typename Callback>
+void ForEachBlockReference(const AudacityProject& project, Callback callback)
+{
+    for (const auto& track : project.getWaveTracks())
+    {
+        const double rate = track.getSampleRate();
+
+        for (auto clip : track.getClips())
+        {
+            const int64_t firstSample = llrint(clip->getTrimLeft() * rate);
+            const int64_t lastSampleOffset = llrint(clip->getTrimRight() * rate);
+
+            for (auto sequence : *clip)
+            {
+                const int64_t lastSample =
+                    sequence->getNumSamples() - lastSampleOffset;
+
+                for (auto block : *sequence)
+                {
+                    if (block->isSilence())
+                        continue;
+
+                    const int64_t blockStart = block->getStart();
+                    const int64_t blockEnd = blockStart + block->getLength();
+
+                    const int64_t visibleSamples = std::max<int64_t>(
+                        0, std::min(blockEnd, lastSample) -
+                               std::max(blockStart, firstSample));
+
+                    callback(
+                        track, *clip, *block,
+                        block->getLength() - visibleSamples);
+                }
+            }
+        }
+    }
+}
+
+void AddReference(
+    StorageUsage& usage, const BlockReferences& references, bool shared,
+    int64_t blockLength, int64_t hiddenSamples)
+{
+    const double bytes = double(references.Bytes) / references.References;
+
+    if (shared)
+        usage.SharedBytes += bytes;
+    else
+        usage.ExclusiveBytes += bytes;
+
+    if (blockLength > 0)
+        usage.TrimmedBytes += bytes * hiddenSamples / blockLength;
+}
+
+void AppendJsonString(fmt::memory_buffer& buffer, std::string_view str)
+{
+    buffer.push_back('"');
+
+    for (const char c : str)
+    {
+        if (c == '"' || c == '\\')
+        {
+            buffer.push_back('\\');
+            buffer.push_back(c);
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+            fmt::format_to(std::back_inserter(buffer), "\\u{:04x}", int(c));
+        else
+            buffer.push_back(c);
+    }
+
+    buffer.push_back('"');
+}
+
+void AppendUsage(fmt::memory_buffer& buffer, const StorageUsage& usage)
+{
+    fmt::format_to(
+        std::back_inserter(buffer),
+        "\"exclusive_bytes\": {}, \"shared_bytes\": {}, \"trimmed_bytes\": {}",
+        llround(usage.ExclusiveBytes), llround(usage.SharedBytes),
+        llround(usage.TrimmedBytes));
+}
+} // namespace
+
+void ExportStorageReport(
+    AudacityDatabase& db, const AudacityProject& project,
+    const std::filesystem::path& path)
+{
+    std::unordered_map<int64_t, BlockReferences> blocks;
+
+    ForEachBlockReference(
+        project, [&blocks](const auto& track, const auto& clip,
+                           const auto& block, int64_t) {
+            auto& references = blocks[block.getBlockId()];
+
+            if (references.References++ == 0)
+            {
+                references.FirstTrack = &track;
+                references.FirstClip = &clip;
+            }
+            else
+            {
+                references.SharedBetweenTracks |=
+                    references.FirstTrack != &track;
+                references.SharedBetweenClips |= references.FirstClip != &clip;
+            }
+        });
+
+    uint64_t totalBytes = 0;
+    uint64_t unreferencedBytes = 0;
+    size_t totalBlocks = 0;
+    size_t unreferencedBlocks = 0;
+
+    // length() does not read the blob data
+    SQLite::Statement stmt(
+        db.DB(), "SELECT blockid, length(samples) FROM sampleblocks;");
+
+    while (stmt.executeStep())
+    {
+        const int64_t blockId = stmt.getColumn(0).getInt64();
+        const uint64_t bytes = stmt.getColumn(1).getInt64();
+
+        totalBytes += bytes;
+        ++totalBlocks;
+
+        auto it = blocks.find(blockId);
+
+        if (it == blocks.end())
+        {
+            unreferencedBytes += bytes;
+            ++unreferencedBlocks;
+            continue;
+        }
+
+        it->second.Bytes = bytes;
+        it->second.Stored = true;
+    }
+
+    const size_t missingBlocks = std::count_if(
+        blocks.begin(), blocks.end(),
+        [](const auto& p) { return !p.second.Stored; });
+
+    std::unordered_map<const WaveTrack*, StorageUsage> tracksUsage;
+    std::unordered_map<const Clip*, StorageUsage> clipsUsage;
+
+    ForEachBlockReference(
+        project,
+        [&](const auto& track, const auto& clip, const auto& block,
+            int64_t hiddenSamples) {
+            const auto& references = blocks[block.getBlockId()];
+
+            AddReference(
+                tracksUsage[&track], references,
+                references.SharedBetweenTracks, block.getLength(),
+                hiddenSamples);
+
+            AddReference(
+                clipsUsage[&clip], references, references.SharedBetweenClips,
+                block.getLength(), hiddenSamples);
+        });
+
+    fmt::memory_buffer buffer;
+    auto out = std::back_inserter(buffer);
+
+    fmt::format_to(out, "{{\n  \"project\": ");
+    AppendJsonString(buffer, db.getProjectPath().u8string());
+
+    fmt::format_to(
+        out,
+        ",\n  \"total_bytes\": {},\n  \"total_blocks\": {},\n"
+        "  \"unreferenced_bytes\": {},\n  \"unreferenced_blocks\": {},\n"
+        "  \"missing_blocks\": {},\n  \"tracks\": [",
+        totalBytes, totalBlocks, unreferencedBytes, unreferencedBlocks,
+        missingBlocks);
+
+    bool firstTrack = true;
+
+    for (const auto& track : project.getWaveTracks())
+    {
+        fmt::format_to(
+            out, "{}\n    {{\n      \"index\": {}, \"channel\": {}, \"name\": ",
+            firstTrack ? "" : ",", track.getParentIndex(), track.getChannel());
+
+        firstTrack = false;
+
+        AppendJsonString(buffer, track.getTrackName());
+        fmt::format_to(out, ",\n      ");
+        AppendUsage(buffer, tracksUsage[&track]);
+        fmt::format_to(out, ",\n      \"clips\": [");
+
+        bool firstClip = true;
+
+        for (auto clip : track.getClips())
+        {
+            fmt::format_to(
+                out, "{}\n        {{ \"index\": {}, \"name\": ",
+                firstClip ? "" : ",", clip->getParentIndex());
+
+            firstClip = false;
+
+            AppendJsonString(buffer, clip->getName());
+            fmt::format_to(out, ", ");
+            AppendUsage(buffer, clipsUsage[clip]);
+            fmt::format_to(out, " }}");
+        }
+
+        fmt::format_to(out, "{}]\n    }}", firstClip ? "" : "\n      ");
+    }
+
+    fmt::format_to(out, "{}]\n}}\n", firstTrack ? "" : "\n  ");
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+    if (!file)
+        throw std::runtime_error(
+            fmt::format("Failed to open {} for writing", path.u8string()));
+
+    file.write(buffer.data(), buffer.size());
+
+    if (!file.flush())
+        throw std::runtime_error(
+            fmt::format("Failed to write {}", path.u8string()));
+
+    fmt::print(
+        "Storage report was written to {}. {:.1f} MiB in {} blocks, {:.1f} MiB are not referenced\n",
+        path.u8string(), totalBytes / (1024.0 * 1024.0), totalBlocks,
+        unreferencedBytes / (1024.0 * 1024.0));
+}
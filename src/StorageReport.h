@@ -0,0 +1,27 @@
+/*
+ SPDX-FileCopyrightText: 2021 Dmitry Vedenko <dmitry@crsib.me>
+ SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#pragma once
+
+#include <filesystem>
+
+class AudacityDatabase;
+class AudacityProject;
+
+// Writes a JSON report on where the sample data is stored.
+//
+// For every track and clip the report contains:
+// * exclusive_bytes: blocks referenced only by this track (clip). Removing
+//   the track (clip) frees this space;
+// * shared_bytes: blocks referenced by other tracks (clips) as well, split
+//   proportionally to the number of references;
+// * trimmed_bytes: part of the exclusive and shared bytes, that is hidden
+//   by the clip trimming.
+//
+// The project totals include the bytes of the blocks that are not
+// referenced by any clip.
+void ExportStorageReport(
+    AudacityDatabase& db, const AudacityProject& project,
+    const std::filesystem::path& path);
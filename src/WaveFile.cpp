@@ -7,10 +7,14 @@
 #include "WaveFile.h"
 
 #include <algorithm>
+#include <cstring>
 
 #include <fmt/format.h>
 #include <cstdio>
 
+#include "AsyncFileWriter.h"
+#include "FileUtils.h"
+
 namespace
 {
 struct Header
@@ -57,15 +61,6 @@ void WaveFile::writeBlock(const void* data, size_t blockSize, uint16_t channel)
 
 namespace
 {
-FILE* OpenFile(const std::filesystem::path& path)
-{
-    #ifdef _WIN32
-        return _wfopen(path.native().c_str(), L"wb");
-    #else
-        return fopen(path.native().c_str(), "wb");
-    #endif
-}
-
 void CloseFile(std::FILE* fp)
 {
     std::fclose(fp);
@@ -73,9 +68,75 @@ void CloseFile(std::FILE* fp)
 }
 
 
+namespace
+{
+Header MakeHeader(
+    SampleFormat fmt, uint32_t sampleRate, uint16_t numChannels,
+    size_t dataSize)
+{
+    const uint16_t bytesPerSample = BytesPerSample(fmt);
+
+    Header header;
+
+    header.AudioFormat = fmt == SampleFormat::Float32 ? 3 : 1;
+    header.NumChannels = numChannels;
+    header.SampleRate = sampleRate;
+    header.ByteRate = sampleRate * numChannels * bytesPerSample;
+    header.BlockAlign = numChannels * bytesPerSample;
+    header.BitsPerSample = bytesPerSample * 8;
+
+    header.ChunkSize += dataSize;
+    header.Subchunk2Size = dataSize;
+
+    return header;
+}
+
+// Channels are read sample by sample, the shorter ones are padded
+// with silence. Interleaved frames are passed to the sink in batches.
+template<typename Sink>
+void InterleaveChannels(
+    const std::vector<Buffer>& channels, size_t channelSize,
+    uint16_t bytesPerSample, Sink&& sink)
+{
+    constexpr size_t FramesPerBatch = 4096;
+
+    std::vector<BufferCursor> cursors;
+    cursors.reserve(channels.size());
+
+    for (const auto& channel : channels)
+        cursors.emplace_back(channel);
+
+    const size_t frameSize = channels.size() * bytesPerSample;
+    const size_t framesCount = channelSize / bytesPerSample;
+
+    std::vector<uint8_t> frames(FramesPerBatch * frameSize);
+
+    for (size_t frame = 0; frame < framesCount; frame += FramesPerBatch)
+    {
+        const size_t batchSize = std::min(FramesPerBatch, framesCount - frame);
+
+        for (size_t batchFrame = 0; batchFrame < batchSize; ++batchFrame)
+        {
+            auto samplePtr = frames.data() + batchFrame * frameSize;
+
+            for (auto& cursor : cursors)
+            {
+                const size_t bytesRead = cursor.read(samplePtr, bytesPerSample);
+
+                std::memset(samplePtr + bytesRead, 0, bytesPerSample - bytesRead);
+
+                samplePtr += bytesPerSample;
+            }
+        }
+
+        sink(frames.data(), batchSize * frameSize);
+    }
+}
+} // namespace
+
 void WaveFile::writeFile()
 {
-    std::unique_ptr<FILE, decltype(&CloseFile)> file(OpenFile(mPath), CloseFile);
+    std::unique_ptr<FILE, decltype(&CloseFile)> file(OpenFile(mPath, "wb"), CloseFile);
 
     if (file == nullptr)
         throw std::runtime_error(
@@ -83,15 +144,6 @@ void WaveFile::writeFile()
 
     const uint16_t bytesPerSample = BytesPerSample(mFmt);
 
-    Header header;
-
-    header.AudioFormat = mFmt == SampleFormat::Float32 ? 3 : 1;
-    header.NumChannels = mNumChannels;
-    header.SampleRate = mSampleRate;
-    header.ByteRate = mSampleRate * mNumChannels * bytesPerSample;
-    header.BlockAlign = mNumChannels * bytesPerSample;
-    header.BitsPerSample = bytesPerSample * 8;
-
     auto it = std::max_element(
         mChannels.begin(), mChannels.end(),
         [](const auto& lhs, const auto& rhs)
@@ -99,37 +151,255 @@ void WaveFile::writeFile()
 
     const size_t dataSize = mNumChannels * it->getSize();
 
-    header.ChunkSize += dataSize;
-    header.Subchunk2Size = dataSize;
+    const Header header = MakeHeader(mFmt, mSampleRate, mNumChannels, dataSize);
 
     if (sizeof(Header) != fwrite(&header, 1, sizeof(Header), file.get()))
         throw std::runtime_error("Failed to write WAV header");
 
-    const auto maxSamples = it->getSize() / bytesPerSample;
+    if (mNumChannels == 1)
+    {
+        if (it->getSize() != it->writeTo(file.get()))
+            throw std::runtime_error("Failed to write sample to WAV file");
+
+        return;
+    }
+
+    InterleaveChannels(
+        mChannels, it->getSize(), bytesPerSample,
+        [&file](const uint8_t* data, size_t size)
+        {
+            if (size != fwrite(data, 1, size, file.get()))
+                throw std::runtime_error("Failed to write sample to WAV file");
+        });
+}
+
+void WaveFile::writeFile(AsyncFileWriter& writer)
+{
+    const uint16_t bytesPerSample = BytesPerSample(mFmt);
+
+    auto it = std::max_element(
+        mChannels.begin(), mChannels.end(),
+        [](const auto& lhs, const auto& rhs)
+        { return lhs.getSize() < rhs.getSize(); });
+
+    const size_t channelSize = it->getSize();
+    const size_t dataSize = mNumChannels * channelSize;
+
+    const Header header = MakeHeader(mFmt, mSampleRate, mNumChannels, dataSize);
+
+    // Mono samples are already in the file layout
+    if (mNumChannels == 1)
+    {
+        const auto headerBytes = reinterpret_cast<const uint8_t*>(&header);
+
+        writer.write(
+            mPath,
+            std::vector<uint8_t>(headerBytes, headerBytes + sizeof(Header)),
+            std::make_unique<Buffer>(std::move(mChannels[0])));
+
+        return;
+    }
+
+    auto data = std::make_unique<Buffer>();
+    data->append(&header, sizeof(Header));
+
+    InterleaveChannels(
+        mChannels, channelSize, bytesPerSample,
+        [&data](const uint8_t* frames, size_t size)
+        { data->append(frames, size); });
+
+    for (auto& channel : mChannels)
+        channel.reset();
+
+    writer.write(mPath, std::move(data));
+}
+
+WaveFileStream::WaveFileStream(
+    const std::filesystem::path& path, SampleFormat fmt, uint32_t sampleRate,
+    uint16_t numChannels, size_t maxQueuedSamples)
+    : mPath(path)
+    , mFmt(fmt)
+    , mSampleRate(sampleRate)
+    , mNumChannels(numChannels)
+    , mMaxQueuedSamples(maxQueuedSamples)
+{
+    mFile = OpenFile(mPath, "wb");
+
+    if (mFile == nullptr)
+        throw std::runtime_error(
+            fmt::format("Failed to open {} for writing", mPath.u8string()));
+
+    // Placeholder, the sizes are known once the file is finished
+    try
+    {
+        writeHeader();
+    }
+    catch (...)
+    {
+        CloseFile(mFile);
+        throw;
+    }
+
+    mThread = std::thread([this] { writerThread(); });
+}
+
+WaveFileStream::~WaveFileStream()
+{
+    if (mFinished)
+        return;
+
+    try
+    {
+        finish();
+    }
+    catch (...)
+    {
+        fmt::print("Failed to write {}\n", mPath.u8string());
+    }
+}
+
+void WaveFileStream::write(std::vector<float> frames)
+{
+    const size_t size = frames.size();
+
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        // A single request larger than the limit is still accepted
+        mSpaceCondition.wait(
+            lock,
+            [this, size]
+            {
+                return mError || mQueuedSamples == 0 ||
+                       mQueuedSamples + size <= mMaxQueuedSamples;
+            });
+
+        if (mError)
+            std::rethrow_exception(mError);
+
+        mQueuedSamples += size;
+        mQueue.push_back(std::move(frames));
+    }
+
+    mQueueCondition.notify_one();
+}
+
+void WaveFileStream::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFinishing = true;
+    }
+
+    mQueueCondition.notify_one();
+    mThread.join();
+
+    mFinished = true;
+
+    if (!mError)
+    {
+        try
+        {
+            writeHeader();
+        }
+        catch (...)
+        {
+            mError = std::current_exception();
+        }
+    }
+
+    CloseFile(mFile);
+    mFile = nullptr;
 
-    std::vector<uint8_t> sampleData(mNumChannels * bytesPerSample);
+    if (mError)
+        std::rethrow_exception(mError);
+}
 
-    for (size_t sampleIndex = 0; sampleIndex < maxSamples; ++sampleIndex)
+void WaveFileStream::writerThread()
+{
+    while (true)
     {
-        const auto offset = sampleIndex * bytesPerSample;
+        std::vector<float> frames;
+        bool failed;
 
-        for (size_t channelIndex = 0; channelIndex < mNumChannels; ++channelIndex)
         {
-            const auto& buffer = mChannels[channelIndex];
+            std::unique_lock<std::mutex> lock(mMutex);
+
+            mQueueCondition.wait(
+                lock, [this] { return mFinishing || !mQueue.empty(); });
+
+            if (mQueue.empty())
+                return;
 
-            // By definition, the buffer will have at least one
-            // sample in this case
-            const auto bufferSize = buffer.getSize();
+            frames = std::move(mQueue.front());
+            mQueue.pop_front();
 
-            if (bufferSize >= offset)
-                buffer.read(&sampleData[channelIndex * bytesPerSample], offset, bytesPerSample);
-            else
-                std::memset(&sampleData[channelIndex * bytesPerSample], 0, bytesPerSample);
+            failed = mError != nullptr;
         }
 
-        if (sampleData.size() != fwrite(sampleData.data(), 1, sampleData.size(), file.get()))
-            throw std::runtime_error("Failed to write sample to WAV file");
+        std::exception_ptr error;
+
+        try
+        {
+            // Frames queued after an error are dropped
+            if (!failed)
+                writeFrames(frames);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            mQueuedSamples -= frames.size();
 
+            if (error && !mError)
+                mError = error;
+        }
+
+        mSpaceCondition.notify_all();
+    }
+}
+
+void WaveFileStream::writeFrames(const std::vector<float>& frames)
+{
+    const size_t bytesPerSample = BytesPerSample(mFmt);
+
+    mConversionBuffer.resize(frames.size() * DiskBytesPerSample(mFmt));
+    ConvertFromFloat(mFmt, frames.data(), frames.size(), mConversionBuffer.data());
+
+    // WAV stores 24 bit samples packed
+    if (mFmt == SampleFormat::Int24)
+    {
+        for (size_t i = 0; i < frames.size(); ++i)
+            std::memmove(
+                mConversionBuffer.data() + i * bytesPerSample,
+                mConversionBuffer.data() + i * 4, bytesPerSample);
     }
+
+    const size_t size = frames.size() * bytesPerSample;
+
+    if (size != fwrite(mConversionBuffer.data(), 1, size, mFile))
+        throw std::runtime_error(
+            fmt::format("Failed to write samples to {}", mPath.u8string()));
+
+    mDataSize += size;
 }
 
+void WaveFileStream::writeHeader()
+{
+    // Sizes are saturated for the files over 4 GiB
+    const size_t dataSize = size_t(
+        std::min<uint64_t>(mDataSize, UINT32_MAX - sizeof(Header)));
+
+    const Header header = MakeHeader(mFmt, mSampleRate, mNumChannels, dataSize);
+
+    if (
+        std::fseek(mFile, 0, SEEK_SET) != 0 ||
+        sizeof(Header) != fwrite(&header, 1, sizeof(Header), mFile) ||
+        std::fseek(mFile, 0, SEEK_END) != 0)
+        throw std::runtime_error(
+            fmt::format("Failed to write WAV header to {}", mPath.u8string()));
+}
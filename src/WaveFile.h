@@ -8,11 +8,20 @@
 
 #include <filesystem>
 #include <cstdint>
+#include <cstdio>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "Buffer.h"
 
 #include "SampleFormat.h"
 
+class AsyncFileWriter;
+
 class WaveFile final
 {
 public:
@@ -24,8 +33,10 @@ public:
     void writeBlock(const void* data, size_t blockSize, uint16_t channel);
 
     void writeFile();
+    // Queues the file to the writer. Channel data is consumed.
+    void writeFile(AsyncFileWriter& writer);
 private:
-    const std::filesystem::path& mPath;
+    std::filesystem::path mPath;
 
     SampleFormat mFmt;
     uint32_t mSampleRate;
@@ -33,3 +44,58 @@ private:
 
     std::vector<Buffer> mChannels;
 };
+
+// Writes a WAV file progressively on its own thread, so several files are
+// converted and written in parallel. The sizes in the header are set once
+// the file is finished.
+class WaveFileStream final
+{
+public:
+    static constexpr size_t DefaultMaxQueuedSamples = 16 * 1024 * 1024;
+
+    WaveFileStream(
+        const std::filesystem::path& path, SampleFormat fmt, uint32_t sampleRate,
+        uint16_t numChannels, size_t maxQueuedSamples = DefaultMaxQueuedSamples);
+    ~WaveFileStream();
+
+    WaveFileStream(const WaveFileStream&) = delete;
+    WaveFileStream& operator=(const WaveFileStream&) = delete;
+
+    // Queues the interleaved frames. Blocks while too many samples are queued.
+    void write(std::vector<float> frames);
+
+    // Writes the queued frames and the final header.
+    // Rethrows the first error, if any.
+    void finish();
+
+private:
+    void writerThread();
+    void writeFrames(const std::vector<float>& frames);
+    void writeHeader();
+
+    std::filesystem::path mPath;
+
+    SampleFormat mFmt;
+    uint32_t mSampleRate;
+    uint16_t mNumChannels;
+
+    FILE* mFile { nullptr };
+    uint64_t mDataSize { 0 };
+
+    std::vector<uint8_t> mConversionBuffer;
+
+    std::thread mThread;
+
+    std::mutex mMutex;
+    std::condition_variable mQueueCondition;
+    std::condition_variable mSpaceCondition;
+
+    std::deque<std::vector<float>> mQueue;
+    size_t mQueuedSamples { 0 };
+    size_t mMaxQueuedSamples;
+
+    std::exception_ptr mError;
+
+    bool mFinishing { false };
+    bool mFinished { false };
+};
@@ -8,9 +8,13 @@
 #include <fmt/format.h>
 
 #include <string_view>
+#include <charconv>
+#include <algorithm>
 
 #include <filesystem>
 #include <fstream>
+#include <thread>
+#include <limits>
 
 #ifdef _WIN32
 #   include <windows.h>
@@ -23,32 +27,153 @@
 #include "BinaryXMLConverter.h"
 #include "AudacityDatabase.h"
 #include "ProjectModel.h"
+#include "ProjectTables.h"
+#include "LegacyProject.h"
+#include "ProjectWatcher.h"
+#include "BlockCatalog.h"
+#include "StorageReport.h"
+#include "MemoryBudget.h"
+#include "Deadline.h"
+#include "Fingerprint.h"
 
 DEFINE_bool(drop_autosave, false, "Drop autosave table, if exists");
 DEFINE_bool(extract_project, false, "Extract Audacity project as an XML file");
 DEFINE_bool(check_integrity, false, "Check AUP3 integrity");
+DEFINE_bool(
+    verify_blocks, false,
+    "Verify the sample blocks against the manifest stored next to the project (path.aup3.manifest). New blocks are added to the manifest");
+DEFINE_int32(
+    rehash_period, 7,
+    "Works with -verify_blocks. Known blocks are re-hashed once in this number of runs. Default is 7");
 DEFINE_bool(analyze_project, false, "Print project statistics");
+DEFINE_bool(
+    storage_report, false,
+    "Write a JSON report on the storage used by every track and clip, including the shared, trimmed and unreferenced blocks");
+DEFINE_bool(
+    benchmark_scan, false,
+    "Read all the sample blocks and print the throughput. Use with -read_profile to compare the profiles");
+DEFINE_string(
+    query, "",
+    "Run SQL query against the project. Parsed project is available as project_tracks, project_clips and project_blocks tables");
+
+DEFINE_string(
+    watch, "",
+    "Watch the directory and validate the projects as they change");
 
 DEFINE_bool(compact, false, "Compact the project");
+DEFINE_bool(
+    compact_document, false,
+    "Rewrite the project document using only the used names and the smallest field types");
 
 DEFINE_bool(recover_db, false, "Try to recover the project database");
 DEFINE_bool(freelist_corrupt, false, "Works with -recover_db. Forces SQLite to consider the freelist to be corrupt.");
 DEFINE_bool(recover_project, false, "Try to recover the project database");
+DEFINE_bool(
+    validate_project, false,
+    "Check that the blocks, sequences, clips and stereo pairs of the project are consistent");
+DEFINE_bool(
+    repair_project, false,
+    "Validate the project and fix the problems found: block starts, sequence lengths, missing blocks and broken stereo links");
+DEFINE_bool(
+    check_boundaries, false,
+    "Look for the clicks at the block boundaries. Runs after -recover_project as well");
+DEFINE_bool(
+    repair_boundaries, false,
+    "Works with -check_boundaries and -recover_project. Smooths the clicks with short fades, written into new blocks");
 
 DEFINE_bool(extract_clips, false, "Try to extract clips from the AUP3");
 
+DEFINE_bool(
+    export_stems, false,
+    "Write every wave track (or a stereo pair) into a WAV file, aligned to the project start");
+DEFINE_bool(
+    stems_multichannel, false,
+    "Works with -export_stems. Writes a single WAV file with a channel per track");
+
+DEFINE_string(
+    merge_from, "",
+    "Append the wave tracks of another project, copying the sample blocks as is");
+
+DEFINE_string(
+    crop, "",
+    "Write a copy of the project containing only the start:end time range (in seconds)");
+
+DEFINE_bool(
+    split_tracks, false,
+    "Write every wave track (or a stereo pair) into a separate project");
+DEFINE_int32(
+    split_threads, 4,
+    "Works with -split_tracks. Number of projects written at once. Default is 4");
+
+DEFINE_bool(
+    export_legacy, false,
+    "Write the project in the Audacity 2.x format (.aup file and the _data directory)");
+
+DEFINE_bool(
+    import_legacy, false,
+    "Convert Audacity 2.x projects (.aup) passed as arguments into .aup3 files");
+DEFINE_int32(
+    import_threads, 0,
+    "Works with -import_legacy. Number of threads reading the block files. Default is the number of CPU cores");
+
+DEFINE_bool(
+    export_catalog, false,
+    "Write the sample blocks metadata of every project passed as an argument into a columnar .catalog file");
+
 DEFINE_bool(
     extract_sample_blocks, false, "Try to extract individual sample blocks");
+DEFINE_bool(
+    pack_sample_blocks, false,
+    "Works with -extract_sample_blocks. Writes all the blocks into a single data file with an index instead of individual wav files.");
 
 DEFINE_bool(extract_as_mono_track, false, "Extract all available samples as a mono track");
 DEFINE_bool(extract_as_stereo_track, false, "Extract all available samples as a stereo track");
 
-DEFINE_int32(sample_rate, 44100, "Bitrate for the extracted samples (-extract_sample_blocks, -extract_as_mono_track, -extract_as_stereo_track). Deafult is 44100");
+DEFINE_bool(rebuild_project, false, "Replace the project document with a new one, referencing the existing sample blocks");
+DEFINE_int32(rebuild_tracks, 1, "Works with -rebuild_project. Number of tracks to distribute the blocks between. Default is 1");
+DEFINE_string(rebuild_blocks, "", "Works with -rebuild_project. Path to a text file with the list of block ids to use, in the order of playback");
+
+DEFINE_int32(sample_rate, 44100, "Bitrate for the extracted samples (-extract_sample_blocks, -extract_as_mono_track, -extract_as_stereo_track, -rebuild_project). Deafult is 44100");
+
+DEFINE_string(
+    read_profile, "default",
+    "Database read profile: default (SQLite defaults) or sequential (large cache, memory mapped I/O and prefetching). Use sequential for the full scans, e.g. -verify_blocks or -benchmark_scan. Default is default");
+
+DEFINE_bool(
+    in_memory, false,
+    "Load the project into memory, regardless of its size. The modified project is written back once all the modes are done");
+DEFINE_string(
+    in_memory_threshold, "2G",
+    "Projects up to this size are loaded into memory automatically, e.g. 512M or 2G. 0 disables the automatic loading. Default is 2G");
+
+DEFINE_string(
+    max_memory, "",
+    "Memory budget for the large intermediate buffers, e.g. 512M or 2G. Once exceeded, buffers are spilled to the temporary files. Default is no limit");
+DEFINE_string(
+    spill_dir, "",
+    "Works with -max_memory. Directory for the spill files. Default is the system temporary directory");
+
+DEFINE_string(
+    fingerprint_index, "",
+    "Path to the audio fingerprint index, used by -index_fingerprints and -find_audio");
+DEFINE_bool(
+    index_fingerprints, false,
+    "Add the fingerprints of the clips of every project passed as an argument to -fingerprint_index");
+DEFINE_bool(
+    find_audio, false,
+    "Print the clips from -fingerprint_index, that contain the audio from every WAV file passed as an argument");
+DEFINE_int32(
+    fingerprint_threads, 0,
+    "Works with -index_fingerprints. Number of threads computing the fingerprints. Default is the number of CPU cores");
+
+DEFINE_int32(
+    deadline, 0,
+    "Time limit in seconds. Once expired, the running mode stops at a consistent state, the remaining modes are skipped and the tool exits with code 4 after printing what was completed. Default is no limit");
 
 DEFINE_string(
     sample_format,
     "float",
-    "Sample format for the extracted samples (-extract_sample_blocks, -extract_as_mono_track, -extract_as_stereo_track). Possible values are: int16, int24, float");
+    "Sample format for the extracted samples (-extract_sample_blocks, -extract_as_mono_track, -extract_as_stereo_track, -export_stems). Possible values are: int16, int24, float");
 
 
 namespace
@@ -56,9 +181,133 @@ namespace
 bool CanContinueInFailedState() noexcept
 {
     return FLAGS_extract_project || FLAGS_recover_db || FLAGS_recover_project ||
+           FLAGS_repair_project ||
            FLAGS_extract_clips || FLAGS_extract_sample_blocks ||
            FLAGS_extract_as_mono_track ||
-           FLAGS_extract_as_stereo_track;
+           FLAGS_extract_as_stereo_track || FLAGS_rebuild_project;
+}
+
+// Exit code for the runs stopped by -deadline
+constexpr int PartialResultExitCode = 4;
+
+bool IsPartial(std::string_view mode)
+{
+    const auto partialResults = Deadline::GetPartialResults();
+
+    return std::any_of(
+        partialResults.begin(), partialResults.end(),
+        [mode](const std::string& result) {
+            return result.size() > mode.size() &&
+                   result.compare(0, mode.size(), mode) == 0 &&
+                   result[mode.size()] == ':';
+        });
+}
+
+std::string JoinModes(const std::vector<std::string>& modes)
+{
+    std::string result;
+
+    for (const auto& mode : modes)
+    {
+        if (!result.empty())
+            result += ", ";
+
+        result += mode;
+    }
+
+    return result.empty() ? "none" : result;
+}
+
+// Keeps track of the modes for the -deadline status report
+class ModesProgress final
+{
+public:
+    // Returns false if the mode must be skipped
+    bool start(std::string mode)
+    {
+        if (Deadline::IsExpired())
+        {
+            mSkipped.push_back(std::move(mode));
+            return false;
+        }
+
+        mStarted.push_back(std::move(mode));
+        return true;
+    }
+
+    // Returns false if some work was not done
+    bool printStatus() const
+    {
+        const auto partialResults = Deadline::GetPartialResults();
+
+        if (partialResults.empty() && mSkipped.empty())
+            return true;
+
+        std::vector<std::string> completed;
+
+        std::copy_if(
+            mStarted.begin(), mStarted.end(), std::back_inserter(completed),
+            [](const auto& mode) { return !IsPartial(mode); });
+
+        fmt::print("Deadline has expired\nCompleted: {}\n", JoinModes(completed));
+
+        for (const auto& result : partialResults)
+            fmt::print("Partial: {}\n", result);
+
+        fmt::print("Skipped: {}\n", JoinModes(mSkipped));
+
+        return false;
+    }
+
+private:
+    std::vector<std::string> mStarted;
+    std::vector<std::string> mSkipped;
+};
+
+std::vector<int64_t> ReadBlocksList(const std::string& path)
+{
+    std::ifstream file(std::filesystem::u8path(path));
+
+    if (!file)
+        throw std::runtime_error(fmt::format("Failed to open {}", path));
+
+    std::vector<int64_t> blocks;
+
+    int64_t blockId;
+
+    while (file >> blockId)
+        blocks.push_back(blockId);
+
+    if (!file.eof())
+        throw std::runtime_error(
+            fmt::format("Failed to parse the list of blocks {}", path));
+
+    return blocks;
+}
+
+std::pair<double, double> ParseTimeRange(const std::string& range)
+{
+    const auto separator = range.find(':');
+
+    if (separator == std::string::npos)
+        throw std::runtime_error(
+            fmt::format("Invalid time range '{}'. Expected start:end", range));
+
+    auto parseTime = [&range](const char* begin, const char* end)
+    {
+        double result = 0.0;
+
+        const auto conversion = std::from_chars(begin, end, result);
+
+        if (conversion.ec != std::errc {} || conversion.ptr != end)
+            throw std::runtime_error(fmt::format(
+                "Invalid time range '{}'. Expected start:end", range));
+
+        return result;
+    };
+
+    return { parseTime(range.data(), range.data() + separator),
+             parseTime(range.data() + separator + 1, range.data() + range.size()) };
 }
 
 void ExtractProjectXML(
@@ -75,18 +324,8 @@ void ExtractProjectXML(
 
     std::fstream xmlFile(xmlPath, std::ios_base::out | std::ios::binary);
 
-    constexpr size_t writeBufferSize = 8 * 1024;
-    char writeBuffer[writeBufferSize];
-
-    size_t offset = 0;
-    size_t bytesRead = 0;
-
-    while (0 !=
-           (bytesRead = xmlText->read(writeBuffer, offset, writeBufferSize)))
-    {
-        xmlFile.write(writeBuffer, bytesRead);
-        offset += bytesRead;
-    }
+    for (const auto& chunk : xmlText->getChunks())
+        xmlFile.write(reinterpret_cast<const char*>(chunk.Data), chunk.Size);
 }
 } // namespace
 #ifdef _WIN32
@@ -126,6 +365,45 @@ int main(int argc, char **argv)
 
     gflags::ParseCommandLineFlags(&argsLeft, &argv, true);
 
+    Deadline::Set(std::chrono::seconds(std::max(0, FLAGS_deadline)));
+
+    try
+    {
+        if (!FLAGS_max_memory.empty())
+            MemoryBudget::SetLimit(ParseMemorySize(FLAGS_max_memory));
+
+        if (!FLAGS_spill_dir.empty())
+            MemoryBudget::SetSpillDirectory(
+                std::filesystem::u8path(FLAGS_spill_dir));
+    }
+    catch (const std::exception& ex)
+    {
+        fmt::print("{}\n", ex.what());
+        return 1;
+    }
+
+    if (FLAGS_rebuild_project && FLAGS_rebuild_tracks <= 0)
+    {
+        fmt::print("-rebuild_tracks must be positive\n");
+        return 1;
+    }
+
+    if (!FLAGS_watch.empty())
+    {
+        try
+        {
+            ProjectWatcher watcher(std::filesystem::u8path(FLAGS_watch));
+            watcher.run();
+        }
+        catch (const std::exception& ex)
+        {
+            fmt::print("{}\n", ex.what());
+            return -1;
+        }
+
+        return 0;
+    }
+
     if (argc == argsLeft || argsLeft == 1)
     {
         gflags::ShowUsageWithFlags(argv[0]);
@@ -136,16 +414,127 @@ int main(int argc, char **argv)
 
     try
     {
+        if (FLAGS_import_legacy)
+        {
+            const size_t threadsCount =
+                FLAGS_import_threads > 0 ?
+                    size_t(FLAGS_import_threads) :
+                    std::max(1u, std::thread::hardware_concurrency());
+
+            for (int i = 1; i < argsLeft; ++i)
+            {
+                const auto aupPath = std::filesystem::u8path(argv[i]);
+
+                auto path = aupPath;
+                path.replace_extension("aup3");
+
+                ImportLegacyProject(aupPath, path, threadsCount);
+            }
+
+            return 0;
+        }
+
+        if (FLAGS_index_fingerprints || FLAGS_find_audio)
+        {
+            if (FLAGS_fingerprint_index.empty())
+                throw std::runtime_error("-fingerprint_index is required");
+
+            const auto indexPath =
+                std::filesystem::u8path(FLAGS_fingerprint_index);
+
+            const size_t threadsCount =
+                FLAGS_fingerprint_threads > 0 ?
+                    size_t(FLAGS_fingerprint_threads) :
+                    std::max(1u, std::thread::hardware_concurrency());
+
+            for (int i = 1; i < argsLeft; ++i)
+            {
+                const auto path = std::filesystem::u8path(argv[i]);
+
+                if (FLAGS_find_audio)
+                {
+                    FindAudio(indexPath, path);
+                    continue;
+                }
+
+                AudacityDatabase database(
+                    path, { std::filesystem::u8path(argv[0]),
+                            FLAGS_freelist_corrupt, false });
+
+                database.setReadProfile(
+                    ReadProfileFromString(FLAGS_read_profile));
+
+                AudacityProject project(database);
+
+                IndexProjectFingerprints(
+                    database, project, indexPath, threadsCount);
+            }
+
+            return 0;
+        }
+
+        if (FLAGS_export_catalog)
+        {
+            size_t failedProjects = 0;
+
+            // A broken project should not stop the batch
+            for (int i = 1; i < argsLeft; ++i)
+            {
+                const auto path = std::filesystem::u8path(argv[i]);
+
+                if (Deadline::IsExpired())
+                {
+                    fmt::print(
+                        "Deadline has expired\nCompleted: {} projects\nSkipped: {} projects, starting from {}\n",
+                        i - 1, argsLeft - i, path.u8string());
+
+                    return PartialResultExitCode;
+                }
+
+                try
+                {
+                    AudacityDatabase database(
+                        path, { std::filesystem::u8path(argv[0]),
+                                FLAGS_freelist_corrupt, false });
+
+                    database.setReadProfile(
+                        ReadProfileFromString(FLAGS_read_profile));
+
+                    AudacityProject project(database);
+
+                    auto catalogPath = path;
+                    catalogPath.replace_extension("catalog");
+
+                    ExportBlockCatalog(database, project, catalogPath);
+                }
+                catch (const std::exception& ex)
+                {
+                    fmt::print("{}: {}\n", path.u8string(), ex.what());
+                    ++failedProjects;
+                }
+            }
+
+            return failedProjects == 0 ? 0 : 3;
+        }
+
         AudacityDatabase projectDatabase(
             projectPath, { std::filesystem::u8path(argv[0]),
                            FLAGS_freelist_corrupt, FLAGS_recover_db });
 
-        if (FLAGS_drop_autosave)
+        projectDatabase.setReadProfile(ReadProfileFromString(FLAGS_read_profile));
+
+        projectDatabase.loadIntoMemory(
+            FLAGS_in_memory ? std::numeric_limits<uint64_t>::max() :
+                              ParseMemorySize(FLAGS_in_memory_threshold));
+
+        ModesProgress modes;
+
+        if (FLAGS_drop_autosave && modes.start("drop_autosave"))
         {
             projectDatabase.dropAutosave();
         }
 
-        if (FLAGS_check_integrity)
+        if (FLAGS_check_integrity && modes.start("check_integrity"))
         {
             if (!projectDatabase.checkIntegrity())
             {
@@ -155,13 +544,42 @@ int main(int argc, char **argv)
                 if (!CanContinueInFailedState())
                     return 3;
             }
+            else if (IsPartial("check_integrity"))
+            {
+                fmt::print("Database integrity check was not finished\n");
+            }
             else
             {
                 fmt::print("Database integrity check has passed\n");
             }
         }
 
-        if (FLAGS_extract_project)
+        if (FLAGS_verify_blocks && modes.start("verify_blocks"))
+        {
+            if (!projectDatabase.verifySampleBlocks(
+                    uint32_t(std::max(1, FLAGS_rehash_period))))
+            {
+                fmt::print(
+                    "Block verification for '{}' has failed.\n",
+                    projectPath.string());
+
+                if (!CanContinueInFailedState())
+                    return 3;
+            }
+            else if (IsPartial("verify_blocks"))
+            {
+                fmt::print("Block verification was not finished\n");
+            }
+            else
+            {
+                fmt::print("Block verification has passed\n");
+            }
+        }
+
+        if (FLAGS_benchmark_scan && modes.start("benchmark_scan"))
+            projectDatabase.benchmarkSampleBlocksScan();
+
+        if (FLAGS_extract_project && modes.start("extract_project"))
         {
             if (projectDatabase.hasAutosave())
                 ExtractProjectXML(projectDatabase.DB(), "autosave", projectPath);
@@ -169,14 +587,17 @@ int main(int argc, char **argv)
             ExtractProjectXML(projectDatabase.DB(), "project", projectPath);
         }
 
-        if (FLAGS_recover_db)
+        if (FLAGS_recover_db && modes.start("recover_db"))
         {
             projectDatabase.recoverDatabase();
         }
 
         std::unique_ptr<AudacityProject> project;
 
-        if (FLAGS_recover_project)
+        // The modes that can fix the project still run after a failed validation
+        bool validationFailed = false;
+
+        if (FLAGS_recover_project && modes.start("recover_project"))
         {
             if (project == nullptr)
                 project = std::make_unique<AudacityProject>(projectDatabase);
@@ -184,7 +605,36 @@ int main(int argc, char **argv)
             project->recoverProject();
         }
 
-        if (FLAGS_compact)
+        if ((FLAGS_validate_project || FLAGS_repair_project) &&
+            modes.start("validate_project"))
+        {
+            if (project == nullptr)
+                project = std::make_unique<AudacityProject>(projectDatabase);
+
+            if (project->validateProject(FLAGS_repair_project) > 0)
+            {
+                fmt::print(
+                    "Project validation for '{}' has failed.\n",
+                    projectPath.string());
+
+                if (!CanContinueInFailedState())
+                    return 3;
+
+                validationFailed = true;
+            }
+        }
+
+        // Recovered blocks and silence often join with a click
+        if ((FLAGS_check_boundaries || FLAGS_recover_project) &&
+            modes.start("check_boundaries"))
+        {
+            if (project == nullptr)
+                project = std::make_unique<AudacityProject>(projectDatabase);
+
+            project->checkBlockBoundaries(FLAGS_repair_boundaries);
+        }
+
+        if (FLAGS_compact && modes.start("compact"))
         {
             if (project == nullptr)
                 project = std::make_unique<AudacityProject>(projectDatabase);
@@ -192,7 +642,59 @@ int main(int argc, char **argv)
             project->removeUnusedBlocks();
         }
 
-        if (FLAGS_analyze_project)
+        if (FLAGS_compact_document && modes.start("compact_document"))
+        {
+            if (project == nullptr)
+                project = std::make_unique<AudacityProject>(projectDatabase);
+
+            project->compactDocument();
+        }
+
+        if (!FLAGS_merge_from.empty() && modes.start("merge_from"))
+        {
+            if (project == nullptr)
+                project = std::make_unique<AudacityProject>(projectDatabase);
+
+            AudacityDatabase otherDatabase(
+                std::filesystem::u8path(FLAGS_merge_from),
+                { std::filesystem::u8path(argv[0]), FLAGS_freelist_corrupt,
+                  FLAGS_recover_db });
+
+            AudacityProject otherProject(otherDatabase);
+
+            project->mergeProject(otherProject);
+        }
+
+        if (!FLAGS_crop.empty() && modes.start("crop"))
+        {
+            if (project == nullptr)
+                project = std::make_unique<AudacityProject>(projectDatabase);
+
+            const auto [start, end] = ParseTimeRange(FLAGS_crop);
+
+            project->cropProject(start, end);
+        }
+
+        if (FLAGS_split_tracks && modes.start("split_tracks"))
+        {
+            if (project == nullptr)
+                project = std::make_unique<AudacityProject>(projectDatabase);
+
+            project->splitTracks(std::max(1, FLAGS_split_threads));
+        }
+
+        if (FLAGS_export_legacy && modes.start("export_legacy"))
+        {
+            if (project == nullptr)
+                project = std::make_unique<AudacityProject>(projectDatabase);
+
+            auto legacyPath = projectPath;
+            legacyPath.replace_extension("legacy.aup");
+
+            ExportLegacyProject(projectDatabase, *project, legacyPath);
+        }
+
+        if (FLAGS_analyze_project && modes.start("analyze_project"))
         {
             if (project == nullptr)
                 project = std::make_unique<AudacityProject>(projectDatabase);
@@ -200,7 +702,27 @@ int main(int argc, char **argv)
             project->printProjectStatistics();
         }
 
-        if (FLAGS_extract_clips)
+        if (FLAGS_storage_report && modes.start("storage_report"))
+        {
+            if (project == nullptr)
+                project = std::make_unique<AudacityProject>(projectDatabase);
+
+            auto reportPath = projectPath;
+            reportPath.replace_extension("storage.json");
+
+            ExportStorageReport(projectDatabase, *project, reportPath);
+        }
+
+        if (!FLAGS_query.empty() && modes.start("query"))
+        {
+            if (project == nullptr)
+                project = std::make_unique<AudacityProject>(projectDatabase);
+
+            RegisterProjectTables(projectDatabase.DB(), *project);
+            RunProjectQuery(projectDatabase.DB(), FLAGS_query);
+        }
+
+        if (FLAGS_extract_clips && modes.start("extract_clips"))
         {
             if (project == nullptr)
                 project = std::make_unique<AudacityProject>(projectDatabase);
@@ -208,23 +730,54 @@ int main(int argc, char **argv)
             project->extractClips();
         }
 
-        if (FLAGS_extract_sample_blocks)
+        if (FLAGS_export_stems && modes.start("export_stems"))
         {
-            projectDatabase.extractSampleBlocks(
-                SampleFormatFromString(FLAGS_sample_format), FLAGS_sample_rate);
+            if (project == nullptr)
+                project = std::make_unique<AudacityProject>(projectDatabase);
+
+            project->exportStems(
+                SampleFormatFromString(FLAGS_sample_format),
+                FLAGS_stems_multichannel);
         }
 
-        if (FLAGS_extract_as_mono_track)
+        if (FLAGS_extract_sample_blocks && modes.start("extract_sample_blocks"))
+        {
+            if (FLAGS_pack_sample_blocks)
+                projectDatabase.extractPackedSampleBlocks();
+            else
+                projectDatabase.extractSampleBlocks(
+                    SampleFormatFromString(FLAGS_sample_format), FLAGS_sample_rate);
+        }
+
+        if (FLAGS_extract_as_mono_track && modes.start("extract_as_mono_track"))
         {
             projectDatabase.extractTrack(
                 SampleFormatFromString(FLAGS_sample_format), FLAGS_sample_rate, false);
         }
 
-        if (FLAGS_extract_as_stereo_track)
+        if (FLAGS_extract_as_stereo_track && modes.start("extract_as_stereo_track"))
         {
             projectDatabase.extractTrack(
                 SampleFormatFromString(FLAGS_sample_format), FLAGS_sample_rate, true);
         }
+
+        if (FLAGS_rebuild_project && modes.start("rebuild_project"))
+        {
+            projectDatabase.rebuildProject(
+                FLAGS_sample_rate, FLAGS_rebuild_tracks,
+                FLAGS_rebuild_blocks.empty() ?
+                    std::vector<int64_t> {} :
+                    ReadBlocksList(FLAGS_rebuild_blocks));
+        }
+
+        // Failures are reported here rather than in the destructor
+        projectDatabase.saveInMemoryDatabase();
+
+        if (!modes.printStatus())
+            return PartialResultExitCode;
+
+        if (validationFailed)
+            return 3;
     }
     catch (const fmt::format_error& err)
     {